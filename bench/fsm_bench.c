@@ -0,0 +1,450 @@
+/**
+ * @file fsm_bench.c
+ * @author Mauro Medina
+ * @brief Dispatch benchmark, prints one CSV line per case
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fsm.h"
+#include "fsm_batch.h"
+
+// The music player example is one of the workloads
+#define print(...)
+#define main music_main
+#include "../example/fsm_music.c"
+#undef main
+#undef print
+// Made with tools/fsm_2_c.py from the music player
+#include "../example/music_player_dispatch.h"
+
+//----------------------------------------------------------------------
+//	DEFINES
+//----------------------------------------------------------------------
+
+// Events per case, can be changed with the first argument
+#define BENCH_EVENTS_DEFAULT (1u << 20)
+
+#define BENCH_EV FSM_EV_FIRST
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+
+// Machine built at runtime, states indexed by id like FSM_STATES_INIT
+typedef struct {
+    fsm_state_t states[FSM_MAX_STATES+1];
+    fsm_transition_t transitions[FSM_MAX_STATES+1];
+    size_t num_transitions;
+    fsm_state_t* initial_state;
+} bench_machine_t;
+
+#ifdef FSM_COMPACT
+// Storage of a compact fsm_t, one per instance of the largest case
+typedef struct {
+    fsm_ext_t ext;
+    fsm_actors_t actors;
+    uint8_t events[FSM_EVENTS_BUFF_SIZE(FSM_MAX_EVENTS)] __attribute__((aligned(8)));
+} bench_storage_t;
+
+#define BENCH_MAX_FSMS 4096
+
+static bench_storage_t bench_storage[BENCH_MAX_FSMS];
+#endif
+
+static volatile uint32_t bench_work;
+
+static const uint32_t music_events[] = {
+    EV_POWER, EV_PLAY, EV_MODE_CHANGE, EV_MODE_CHANGE, EV_MODE_CHANGE, EV_MENU, EV_VOLUME_UP, EV_BACK,
+    EV_SELECT, EV_BACK, EV_BACK, EV_PLAY, EV_PAUSE, EV_LOW_BATTERY, EV_CHARGE, EV_POWER,
+};
+#define MUSIC_NUM_EVENTS (sizeof(music_events) / sizeof(music_events[0]))
+
+//----------------------------------------------------------------------
+//	HELPERS
+//----------------------------------------------------------------------
+
+static void bench_action(fsm_t *self, void *data) { bench_work++; }
+
+static uint64_t bench_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_report(const char *workload, const char *param, uint32_t value, uint32_t events, uint64_t ns)
+{
+    double ns_per_event = (double)ns / events;
+
+    printf("%s,%s,%u,%u,%.1f,%.0f\n", workload, param, value, events, ns_per_event, 1e9 / ns_per_event);
+}
+
+static void bench_state_add(bench_machine_t *m, int id, int parent)
+{
+    fsm_state_t *s = &m->states[id];
+
+    s->state_id     = id;
+    s->parent       = (parent != FSM_ST_NONE) ? &m->states[parent] : NULL;
+    s->entry_action = bench_action;
+    s->exit_action  = bench_action;
+    if (s->parent && (s->parent->default_substate == NULL)) s->parent->default_substate = s;
+}
+
+static void bench_transition_add(bench_machine_t *m, int source, uint32_t event, int target)
+{
+    fsm_transition_t *t = &m->transitions[++m->num_transitions];
+
+    t->source_state = &m->states[source];
+    t->event        = event;
+    t->target_state = &m->states[target];
+}
+
+// Two branches of depth levels, each transition leaves one and enters the other
+static void bench_depth_build(bench_machine_t *m, int depth)
+{
+    memset(m, 0, sizeof(*m));
+    for (int i = 1; i <= depth; i++)
+    {
+        bench_state_add(m, i, i - 1);
+        bench_state_add(m, depth + i, (i > 1) ? depth + i - 1 : FSM_ST_NONE);
+    }
+    bench_transition_add(m, depth, BENCH_EV, 2 * depth);
+    bench_transition_add(m, 2 * depth, BENCH_EV, depth);
+    m->initial_state = &m->states[1];
+}
+
+// Sibling states under a root, all moving to the next one on the same event
+static void bench_ring_build(bench_machine_t *m, int num_states)
+{
+    memset(m, 0, sizeof(*m));
+    bench_state_add(m, FSM_ST_FIRST, FSM_ST_NONE);
+    for (int i = 0; i < num_states; i++)
+    {
+        bench_state_add(m, 2 + i, FSM_ST_FIRST);
+    }
+    for (int i = 0; i < num_states; i++)
+    {
+        bench_transition_add(m, 2 + i, BENCH_EV, 2 + (i + 1) % num_states);
+    }
+    m->initial_state = &m->states[FSM_ST_FIRST];
+}
+
+// Config of the n-th fsm of a case, NULL for the defaults of fsm_init
+static const fsm_config_t *bench_config(uint32_t n, fsm_config_t *config)
+{
+#ifdef FSM_COMPACT
+    *config = (fsm_config_t){
+        .events_buff = bench_storage[n].events,
+        .events_len = FSM_MAX_EVENTS,
+        .actors = &bench_storage[n].actors,
+        .ext = &bench_storage[n].ext,
+    };
+    return config;
+#else
+    (void)n;
+    (void)config;
+    return NULL;
+#endif
+}
+
+static int bench_machine_init(fsm_t *fsm, bench_machine_t *m)
+{
+    fsm_config_t config;
+
+    // The same memory holds different machines, the pool compiles each one
+    return fsm_init_ex(fsm, m->transitions, m->num_transitions, BENCH_EV + 1, 0, m->initial_state, NULL, bench_config(0, &config));
+}
+
+//----------------------------------------------------------------------
+//	CASES
+//----------------------------------------------------------------------
+
+static uint64_t bench_loop(fsm_t *fsm, uint32_t event, uint32_t events)
+{
+    uint64_t start = bench_ns();
+
+    for (uint32_t i = 0; i < events; i++)
+    {
+        fsm_dispatch(fsm, event, NULL);
+        fsm_run(fsm);
+    }
+    return bench_ns() - start;
+}
+
+static void bench_music(uint32_t events)
+{
+    static fsm_def_t def;
+    fsm_t *fsm = calloc(1, sizeof(fsm_t));
+    fsm_config_t config;
+    uint64_t start;
+
+    fsm_init_ex(fsm, FSM_TRANSITIONS_GET(music_player), FSM_TRANSITIONS_SIZE(music_player), EV_LAST, 0,
+                &FSM_STATE_GET(music_player, ST_ROOT), NULL, bench_config(0, &config));
+    fsm_actor_link(fsm, FSM_ACTOR_GET(speaker_led), FSM_ACTOR_SIZE(speaker_led));
+
+    start = bench_ns();
+    for (uint32_t i = 0; i < events; i++)
+    {
+        fsm_dispatch(fsm, music_events[i % MUSIC_NUM_EVENTS], NULL);
+        fsm_run(fsm);
+    }
+    bench_report("music", "actors", 1, events, bench_ns() - start);
+    fsm_deinit(fsm);
+
+    // Same machine with the generated dispatcher
+    music_player_def_init(&def, EV_LAST, &FSM_STATE_GET(music_player, ST_ROOT));
+    fsm_init_def(fsm, &def, 0, NULL, bench_config(0, &config));
+    fsm_actor_link(fsm, FSM_ACTOR_GET(speaker_led), FSM_ACTOR_SIZE(speaker_led));
+
+    start = bench_ns();
+    for (uint32_t i = 0; i < events; i++)
+    {
+        fsm_dispatch(fsm, music_events[i % MUSIC_NUM_EVENTS], NULL);
+        fsm_run(fsm);
+    }
+    bench_report("music", "compiled", 1, events, bench_ns() - start);
+
+    fsm_deinit(fsm);
+    free(fsm);
+}
+
+static void bench_depth(uint32_t events)
+{
+    static const int depths[] = {1, 2, 4, 8};
+    bench_machine_t *m = calloc(1, sizeof(*m));
+    fsm_t *fsm = calloc(1, sizeof(fsm_t));
+
+    for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++)
+    {
+        if (depths[i] > MAX_HIERARCHY_DEPTH) break;
+
+        bench_depth_build(m, depths[i]);
+        if (bench_machine_init(fsm, m) != 0) continue;
+        bench_report("depth", "levels", depths[i], events, bench_loop(fsm, BENCH_EV, events));
+        fsm_deinit(fsm);
+    }
+    free(fsm);
+    free(m);
+}
+
+static void bench_transitions(uint32_t events)
+{
+    static const int num_states[] = {2, 8, 16, FSM_MAX_STATES - 1};
+    bench_machine_t *m = calloc(1, sizeof(*m));
+    fsm_t *fsm = calloc(1, sizeof(fsm_t));
+
+    for (size_t i = 0; i < sizeof(num_states) / sizeof(num_states[0]); i++)
+    {
+        bench_ring_build(m, num_states[i]);
+        if (bench_machine_init(fsm, m) != 0) continue;
+        bench_report("transitions", "per_event", num_states[i], events, bench_loop(fsm, BENCH_EV, events));
+        fsm_deinit(fsm);
+    }
+    free(fsm);
+    free(m);
+}
+
+static void bench_actors(uint32_t events)
+{
+    static const int num_actors[] = {0, 1, 4, FSM_MAX_ACTORS};
+    static struct fsm_actor_t actors[FSM_MAX_ACTORS][4];
+    bench_machine_t *m = calloc(1, sizeof(*m));
+    fsm_t *fsm = calloc(1, sizeof(fsm_t));
+
+    // Exit actors are notified on the common parent, entry actors on the target
+    for (int a = 0; a < FSM_MAX_ACTORS; a++)
+    {
+        actors[a][1] = (struct fsm_actor_t){.state_id = FSM_ST_FIRST, .exit_action = bench_action};
+        actors[a][2] = (struct fsm_actor_t){.state_id = 2, .entry_action = bench_action, .run_action = bench_action};
+        actors[a][3] = (struct fsm_actor_t){.state_id = 3, .entry_action = bench_action, .run_action = bench_action};
+    }
+
+    bench_ring_build(m, 2);
+    for (size_t i = 0; i < sizeof(num_actors) / sizeof(num_actors[0]); i++)
+    {
+        if (bench_machine_init(fsm, m) != 0) continue;
+        for (int a = 0; a < num_actors[i]; a++)
+        {
+            fsm_actor_link(fsm, actors[a], 4);
+        }
+        bench_report("actors", "linked", num_actors[i], events, bench_loop(fsm, BENCH_EV, events));
+        fsm_deinit(fsm);
+    }
+    free(fsm);
+    free(m);
+}
+
+static void bench_queue(uint32_t events)
+{
+    static const uint32_t batches[] = {1, 8, 32, FSM_MAX_EVENTS};
+    static struct fsm_events_t evs[FSM_MAX_EVENTS];
+    bench_machine_t *m = calloc(1, sizeof(*m));
+    fsm_t *fsm = calloc(1, sizeof(fsm_t));
+
+    for (size_t i = 0; i < FSM_MAX_EVENTS; i++)
+    {
+        evs[i].event = BENCH_EV;
+    }
+
+    bench_ring_build(m, 2);
+    for (size_t i = 0; i < sizeof(batches) / sizeof(batches[0]); i++)
+    {
+        uint32_t num = events - events % batches[i];
+        uint64_t start;
+
+        if (bench_machine_init(fsm, m) != 0) continue;
+
+        // Events pile up in the queue before running the fsm
+        start = bench_ns();
+        for (uint32_t n = 0; n < num; n += batches[i])
+        {
+            for (uint32_t b = 0; b < batches[i]; b++)
+            {
+                fsm_dispatch(fsm, BENCH_EV, NULL);
+            }
+            fsm_run(fsm);
+        }
+        bench_report("queue", "pending", batches[i], num, bench_ns() - start);
+        fsm_deinit(fsm);
+
+        if (bench_machine_init(fsm, m) != 0) continue;
+
+        // Same events, queued with one call per batch
+        start = bench_ns();
+        for (uint32_t n = 0; n < num; n += batches[i])
+        {
+            fsm_dispatch_batch(fsm, evs, batches[i]);
+            fsm_run(fsm);
+        }
+        bench_report("queue", "batch", batches[i], num, bench_ns() - start);
+        fsm_deinit(fsm);
+    }
+    free(fsm);
+    free(m);
+}
+
+static void bench_instances(uint32_t events)
+{
+    static const uint32_t num_instances[] = {1, 16, 256, 1024};
+
+    for (size_t i = 0; i < sizeof(num_instances) / sizeof(num_instances[0]); i++)
+    {
+        uint32_t num = num_instances[i];
+        fsm_t *fsms = calloc(num, sizeof(fsm_t));
+        fsm_config_t config;
+        uint64_t start;
+
+        for (uint32_t n = 0; n < num; n++)
+        {
+            fsm_init_ex(&fsms[n], FSM_TRANSITIONS_GET(music_player), FSM_TRANSITIONS_SIZE(music_player), EV_LAST, 0,
+                        &FSM_STATE_GET(music_player, ST_ROOT), NULL, bench_config(n, &config));
+        }
+
+        // Every instance walks the music sequence, one event at a time
+        start = bench_ns();
+        for (uint32_t e = 0; e < events; e++)
+        {
+            fsm_t *fsm = &fsms[e % num];
+
+            fsm_dispatch(fsm, music_events[(e / num) % MUSIC_NUM_EVENTS], NULL);
+            fsm_run(fsm);
+        }
+        bench_report("music", "instances", num, events, bench_ns() - start);
+
+        for (uint32_t n = 0; n < num; n++)
+        {
+            fsm_deinit(&fsms[n]);
+        }
+        free(fsms);
+    }
+}
+
+static void bench_batch(uint32_t events)
+{
+    static const uint32_t num_instances[] = {16, 256, 4096};
+    static fsm_batch_event_t evs[FSM_BATCH_WAVE];
+    static fsm_def_t def;
+    bench_machine_t *m = calloc(1, sizeof(*m));
+    fsm_batch_t *batch = calloc(1, sizeof(*batch));
+
+    bench_ring_build(m, 2);
+    if (fsm_def_init(&def, m->transitions, m->num_transitions, BENCH_EV + 1, m->initial_state) != 0) events = 0;
+
+    for (size_t i = 0; (events > 0) && (i < sizeof(num_instances) / sizeof(num_instances[0])); i++)
+    {
+        uint32_t num = num_instances[i];
+        uint32_t total = events - events % FSM_BATCH_WAVE;
+        fsm_t *fsms = calloc(num, sizeof(fsm_t));
+        void *buff = malloc(FSM_BATCH_BUFF_SIZE(num));
+        uint32_t next = 0;
+        fsm_config_t config;
+        uint64_t start;
+
+        // One fsm_t per instance, the same events
+        for (uint32_t n = 0; n < num; n++)
+        {
+            fsm_init_def(&fsms[n], &def, 0, NULL, bench_config(n, &config));
+        }
+        start = bench_ns();
+        for (uint32_t e = 0; e < total; e++)
+        {
+            fsm_t *fsm = &fsms[e % num];
+
+            fsm_dispatch(fsm, BENCH_EV, NULL);
+            fsm_run(fsm);
+        }
+        bench_report("instances", "fsm_t", num, total, bench_ns() - start);
+
+        // Same instances as arrays, a vector of events at a time
+        fsm_batch_init(batch, &def, num, buff, NULL);
+        start = bench_ns();
+        for (uint32_t e = 0; e < total; e += FSM_BATCH_WAVE)
+        {
+            for (uint32_t k = 0; k < FSM_BATCH_WAVE; k++)
+            {
+                evs[k].instance = next;
+                evs[k].event    = BENCH_EV;
+                if (++next == num) next = 0;
+            }
+            fsm_batch_process(batch, evs, FSM_BATCH_WAVE);
+        }
+        bench_report("instances", "batch", num, total, bench_ns() - start);
+
+        for (uint32_t n = 0; n < num; n++)
+        {
+            fsm_deinit(&fsms[n]);
+        }
+        free(buff);
+        free(fsms);
+    }
+    free(batch);
+    free(m);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t events = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : BENCH_EVENTS_DEFAULT;
+
+    if (events == 0) events = BENCH_EVENTS_DEFAULT;
+
+    printf("workload,param,value,events,ns_per_transition,events_per_sec\n");
+
+    bench_music(events);
+    bench_depth(events);
+    bench_transitions(events);
+    bench_actors(events);
+    bench_queue(events);
+    bench_instances(events);
+    bench_batch(events);
+
+    return 0;
+}
@@ -0,0 +1,354 @@
+/* Generated by tools/fsm_2_c.py from fsm_music.c, do not edit */
+#ifndef MUSIC_PLAYER_DISPATCH_H_
+#define MUSIC_PLAYER_DISPATCH_H_
+
+#include "fsm.h"
+
+static int music_player_dispatch(fsm_t *fsm, uint32_t event, void *data)
+{
+    switch (fsm->state_id) {
+    case ST_OFF:
+        switch (event) {
+        case EV_POWER:
+            // ST_OFF -> ST_PAUSED
+            fsm_compiled_exit(fsm, ST_ROOT, 1, data);
+            enter_on(fsm, data);
+            enter_paused(fsm, data);
+            fsm_compiled_enter(fsm, ST_ON, ST_PAUSED, 1, data);
+            return 1;
+        case EV_LOW_BATTERY:
+            // ST_OFF -> ST_LOW_BATTERY
+            fsm_compiled_exit(fsm, ST_ROOT, 1, data);
+            enter_low_battery(fsm, data);
+            fsm_compiled_enter(fsm, ST_LOW_BATTERY, ST_LOW_BATTERY, 1, data);
+            return 1;
+        default:
+            return 0;
+        }
+    case ST_NORMAL:
+        switch (event) {
+        case EV_MODE_CHANGE:
+            // ST_NORMAL -> ST_SHUFFLE
+            fsm_compiled_exit(fsm, ST_PLAYING, 1, data);
+            enter_shuffle(fsm, data);
+            fsm_compiled_enter(fsm, ST_SHUFFLE, ST_SHUFFLE, 1, data);
+            return 1;
+        case EV_PAUSE:
+            // ST_NORMAL -> ST_PAUSED
+            fsm_compiled_exit(fsm, ST_ON, 2, data);
+            enter_paused(fsm, data);
+            fsm_compiled_enter(fsm, ST_PAUSED, ST_PAUSED, 2, data);
+            return 1;
+        case EV_STOP:
+            // ST_NORMAL -> ST_PAUSED
+            fsm_compiled_exit(fsm, ST_ON, 2, data);
+            enter_paused(fsm, data);
+            fsm_compiled_enter(fsm, ST_PAUSED, ST_PAUSED, 2, data);
+            return 1;
+        case EV_POWER:
+            // ST_NORMAL -> ST_OFF
+            fsm_compiled_exit(fsm, ST_ROOT, 3, data);
+            enter_off(fsm, data);
+            fsm_compiled_enter(fsm, ST_OFF, ST_OFF, 3, data);
+            return 1;
+        case EV_MENU:
+            // ST_NORMAL -> ST_MENU
+            fsm_compiled_exit(fsm, ST_ON, 2, data);
+            enter_menu(fsm, data);
+            fsm_compiled_enter(fsm, ST_MENU, ST_MENU, 2, data);
+            return 1;
+        case EV_LOW_BATTERY:
+            // ST_NORMAL -> ST_LOW_BATTERY
+            fsm_compiled_exit(fsm, ST_ROOT, 3, data);
+            enter_low_battery(fsm, data);
+            fsm_compiled_enter(fsm, ST_LOW_BATTERY, ST_LOW_BATTERY, 3, data);
+            return 1;
+        default:
+            return 0;
+        }
+    case ST_SHUFFLE:
+        switch (event) {
+        case EV_MODE_CHANGE:
+            // ST_SHUFFLE -> ST_REPEAT
+            fsm_compiled_exit(fsm, ST_PLAYING, 1, data);
+            enter_repeat(fsm, data);
+            fsm_compiled_enter(fsm, ST_REPEAT, ST_REPEAT, 1, data);
+            return 1;
+        case EV_PAUSE:
+            // ST_SHUFFLE -> ST_PAUSED
+            fsm_compiled_exit(fsm, ST_ON, 2, data);
+            enter_paused(fsm, data);
+            fsm_compiled_enter(fsm, ST_PAUSED, ST_PAUSED, 2, data);
+            return 1;
+        case EV_STOP:
+            // ST_SHUFFLE -> ST_PAUSED
+            fsm_compiled_exit(fsm, ST_ON, 2, data);
+            enter_paused(fsm, data);
+            fsm_compiled_enter(fsm, ST_PAUSED, ST_PAUSED, 2, data);
+            return 1;
+        case EV_POWER:
+            // ST_SHUFFLE -> ST_OFF
+            fsm_compiled_exit(fsm, ST_ROOT, 3, data);
+            enter_off(fsm, data);
+            fsm_compiled_enter(fsm, ST_OFF, ST_OFF, 3, data);
+            return 1;
+        case EV_MENU:
+            // ST_SHUFFLE -> ST_MENU
+            fsm_compiled_exit(fsm, ST_ON, 2, data);
+            enter_menu(fsm, data);
+            fsm_compiled_enter(fsm, ST_MENU, ST_MENU, 2, data);
+            return 1;
+        case EV_LOW_BATTERY:
+            // ST_SHUFFLE -> ST_LOW_BATTERY
+            fsm_compiled_exit(fsm, ST_ROOT, 3, data);
+            enter_low_battery(fsm, data);
+            fsm_compiled_enter(fsm, ST_LOW_BATTERY, ST_LOW_BATTERY, 3, data);
+            return 1;
+        default:
+            return 0;
+        }
+    case ST_REPEAT:
+        switch (event) {
+        case EV_MODE_CHANGE:
+            // ST_REPEAT -> ST_NORMAL
+            fsm_compiled_exit(fsm, ST_PLAYING, 1, data);
+            enter_normal(fsm, data);
+            fsm_compiled_enter(fsm, ST_NORMAL, ST_NORMAL, 1, data);
+            return 1;
+        case EV_PAUSE:
+            // ST_REPEAT -> ST_PAUSED
+            fsm_compiled_exit(fsm, ST_ON, 2, data);
+            enter_paused(fsm, data);
+            fsm_compiled_enter(fsm, ST_PAUSED, ST_PAUSED, 2, data);
+            return 1;
+        case EV_STOP:
+            // ST_REPEAT -> ST_PAUSED
+            fsm_compiled_exit(fsm, ST_ON, 2, data);
+            enter_paused(fsm, data);
+            fsm_compiled_enter(fsm, ST_PAUSED, ST_PAUSED, 2, data);
+            return 1;
+        case EV_POWER:
+            // ST_REPEAT -> ST_OFF
+            fsm_compiled_exit(fsm, ST_ROOT, 3, data);
+            enter_off(fsm, data);
+            fsm_compiled_enter(fsm, ST_OFF, ST_OFF, 3, data);
+            return 1;
+        case EV_MENU:
+            // ST_REPEAT -> ST_MENU
+            fsm_compiled_exit(fsm, ST_ON, 2, data);
+            enter_menu(fsm, data);
+            fsm_compiled_enter(fsm, ST_MENU, ST_MENU, 2, data);
+            return 1;
+        case EV_LOW_BATTERY:
+            // ST_REPEAT -> ST_LOW_BATTERY
+            fsm_compiled_exit(fsm, ST_ROOT, 3, data);
+            enter_low_battery(fsm, data);
+            fsm_compiled_enter(fsm, ST_LOW_BATTERY, ST_LOW_BATTERY, 3, data);
+            return 1;
+        default:
+            return 0;
+        }
+    case ST_PAUSED:
+        switch (event) {
+        case EV_PLAY:
+            // ST_PAUSED -> ST_NORMAL
+            fsm_compiled_exit(fsm, ST_ON, 1, data);
+            enter_playing(fsm, data);
+            enter_normal(fsm, data);
+            fsm_compiled_enter(fsm, ST_PLAYING, ST_NORMAL, 1, data);
+            return 1;
+        case EV_POWER:
+            // ST_PAUSED -> ST_OFF
+            fsm_compiled_exit(fsm, ST_ROOT, 2, data);
+            enter_off(fsm, data);
+            fsm_compiled_enter(fsm, ST_OFF, ST_OFF, 2, data);
+            return 1;
+        case EV_MENU:
+            // ST_PAUSED -> ST_MENU
+            fsm_compiled_exit(fsm, ST_ON, 1, data);
+            enter_menu(fsm, data);
+            fsm_compiled_enter(fsm, ST_MENU, ST_MENU, 1, data);
+            return 1;
+        case EV_LOW_BATTERY:
+            // ST_PAUSED -> ST_LOW_BATTERY
+            fsm_compiled_exit(fsm, ST_ROOT, 2, data);
+            enter_low_battery(fsm, data);
+            fsm_compiled_enter(fsm, ST_LOW_BATTERY, ST_LOW_BATTERY, 2, data);
+            return 1;
+        default:
+            return 0;
+        }
+    case ST_MENU:
+        switch (event) {
+        case EV_BACK:
+            // ST_MENU -> ST_PAUSED
+            fsm_compiled_exit(fsm, ST_ON, 1, data);
+            enter_paused(fsm, data);
+            fsm_compiled_enter(fsm, ST_ON, ST_PAUSED, 1, data);
+            return 1;
+        case EV_VOLUME_UP:
+            // ST_MENU -> ST_VOLUME_ADJUST
+            fsm_compiled_exit(fsm, ST_MENU, 0, data);
+            enter_volume_adjust(fsm, data);
+            fsm_compiled_enter(fsm, ST_VOLUME_ADJUST, ST_VOLUME_ADJUST, 0, data);
+            return 1;
+        case EV_VOLUME_DOWN:
+            // ST_MENU -> ST_VOLUME_ADJUST
+            fsm_compiled_exit(fsm, ST_MENU, 0, data);
+            enter_volume_adjust(fsm, data);
+            fsm_compiled_enter(fsm, ST_VOLUME_ADJUST, ST_VOLUME_ADJUST, 0, data);
+            return 1;
+        case EV_SELECT:
+            // ST_MENU -> ST_PLAYLIST_SELECT
+            fsm_compiled_exit(fsm, ST_MENU, 0, data);
+            enter_playlist_select(fsm, data);
+            fsm_compiled_enter(fsm, ST_PLAYLIST_SELECT, ST_PLAYLIST_SELECT, 0, data);
+            return 1;
+        case EV_POWER:
+            // ST_MENU -> ST_OFF
+            fsm_compiled_exit(fsm, ST_ROOT, 2, data);
+            enter_off(fsm, data);
+            fsm_compiled_enter(fsm, ST_OFF, ST_OFF, 2, data);
+            return 1;
+        case EV_MENU:
+            // ST_MENU -> ST_MENU
+            fsm_compiled_exit(fsm, ST_MENU, 0, data);
+            enter_menu(fsm, data);
+            fsm_compiled_enter(fsm, ST_MENU, ST_MENU, 0, data);
+            return 1;
+        case EV_LOW_BATTERY:
+            // ST_MENU -> ST_LOW_BATTERY
+            fsm_compiled_exit(fsm, ST_ROOT, 2, data);
+            enter_low_battery(fsm, data);
+            fsm_compiled_enter(fsm, ST_LOW_BATTERY, ST_LOW_BATTERY, 2, data);
+            return 1;
+        default:
+            return 0;
+        }
+    case ST_VOLUME_ADJUST:
+        switch (event) {
+        case EV_BACK:
+            // ST_VOLUME_ADJUST -> ST_MENU
+            fsm_compiled_exit(fsm, ST_MENU, 1, data);
+            enter_menu(fsm, data);
+            fsm_compiled_enter(fsm, ST_MENU, ST_MENU, 1, data);
+            return 1;
+        case EV_VOLUME_UP:
+            // ST_VOLUME_ADJUST -> ST_VOLUME_ADJUST
+            fsm_compiled_exit(fsm, ST_VOLUME_ADJUST, 0, data);
+            enter_volume_adjust(fsm, data);
+            fsm_compiled_enter(fsm, ST_VOLUME_ADJUST, ST_VOLUME_ADJUST, 0, data);
+            return 1;
+        case EV_VOLUME_DOWN:
+            // ST_VOLUME_ADJUST -> ST_VOLUME_ADJUST
+            fsm_compiled_exit(fsm, ST_VOLUME_ADJUST, 0, data);
+            enter_volume_adjust(fsm, data);
+            fsm_compiled_enter(fsm, ST_VOLUME_ADJUST, ST_VOLUME_ADJUST, 0, data);
+            return 1;
+        case EV_SELECT:
+            // ST_VOLUME_ADJUST -> ST_PLAYLIST_SELECT
+            fsm_compiled_exit(fsm, ST_MENU, 1, data);
+            enter_playlist_select(fsm, data);
+            fsm_compiled_enter(fsm, ST_PLAYLIST_SELECT, ST_PLAYLIST_SELECT, 1, data);
+            return 1;
+        case EV_POWER:
+            // ST_VOLUME_ADJUST -> ST_OFF
+            fsm_compiled_exit(fsm, ST_ROOT, 3, data);
+            enter_off(fsm, data);
+            fsm_compiled_enter(fsm, ST_OFF, ST_OFF, 3, data);
+            return 1;
+        case EV_MENU:
+            // ST_VOLUME_ADJUST -> ST_MENU
+            fsm_compiled_exit(fsm, ST_MENU, 1, data);
+            enter_menu(fsm, data);
+            fsm_compiled_enter(fsm, ST_MENU, ST_MENU, 1, data);
+            return 1;
+        case EV_LOW_BATTERY:
+            // ST_VOLUME_ADJUST -> ST_LOW_BATTERY
+            fsm_compiled_exit(fsm, ST_ROOT, 3, data);
+            enter_low_battery(fsm, data);
+            fsm_compiled_enter(fsm, ST_LOW_BATTERY, ST_LOW_BATTERY, 3, data);
+            return 1;
+        default:
+            return 0;
+        }
+    case ST_PLAYLIST_SELECT:
+        switch (event) {
+        case EV_BACK:
+            // ST_PLAYLIST_SELECT -> ST_MENU
+            fsm_compiled_exit(fsm, ST_MENU, 1, data);
+            enter_menu(fsm, data);
+            fsm_compiled_enter(fsm, ST_MENU, ST_MENU, 1, data);
+            return 1;
+        case EV_VOLUME_UP:
+            // ST_PLAYLIST_SELECT -> ST_VOLUME_ADJUST
+            fsm_compiled_exit(fsm, ST_MENU, 1, data);
+            enter_volume_adjust(fsm, data);
+            fsm_compiled_enter(fsm, ST_VOLUME_ADJUST, ST_VOLUME_ADJUST, 1, data);
+            return 1;
+        case EV_VOLUME_DOWN:
+            // ST_PLAYLIST_SELECT -> ST_VOLUME_ADJUST
+            fsm_compiled_exit(fsm, ST_MENU, 1, data);
+            enter_volume_adjust(fsm, data);
+            fsm_compiled_enter(fsm, ST_VOLUME_ADJUST, ST_VOLUME_ADJUST, 1, data);
+            return 1;
+        case EV_SELECT:
+            // ST_PLAYLIST_SELECT -> ST_PLAYLIST_SELECT
+            fsm_compiled_exit(fsm, ST_PLAYLIST_SELECT, 0, data);
+            enter_playlist_select(fsm, data);
+            fsm_compiled_enter(fsm, ST_PLAYLIST_SELECT, ST_PLAYLIST_SELECT, 0, data);
+            return 1;
+        case EV_POWER:
+            // ST_PLAYLIST_SELECT -> ST_OFF
+            fsm_compiled_exit(fsm, ST_ROOT, 3, data);
+            enter_off(fsm, data);
+            fsm_compiled_enter(fsm, ST_OFF, ST_OFF, 3, data);
+            return 1;
+        case EV_MENU:
+            // ST_PLAYLIST_SELECT -> ST_MENU
+            fsm_compiled_exit(fsm, ST_MENU, 1, data);
+            enter_menu(fsm, data);
+            fsm_compiled_enter(fsm, ST_MENU, ST_MENU, 1, data);
+            return 1;
+        case EV_LOW_BATTERY:
+            // ST_PLAYLIST_SELECT -> ST_LOW_BATTERY
+            fsm_compiled_exit(fsm, ST_ROOT, 3, data);
+            enter_low_battery(fsm, data);
+            fsm_compiled_enter(fsm, ST_LOW_BATTERY, ST_LOW_BATTERY, 3, data);
+            return 1;
+        default:
+            return 0;
+        }
+    case ST_LOW_BATTERY:
+        switch (event) {
+        case EV_CHARGE:
+            // ST_LOW_BATTERY -> ST_PAUSED
+            fsm_compiled_exit(fsm, ST_ROOT, 1, data);
+            enter_on(fsm, data);
+            enter_paused(fsm, data);
+            fsm_compiled_enter(fsm, ST_ON, ST_PAUSED, 1, data);
+            return 1;
+        case EV_LOW_BATTERY:
+            // ST_LOW_BATTERY -> ST_LOW_BATTERY
+            fsm_compiled_exit(fsm, ST_LOW_BATTERY, 0, data);
+            enter_low_battery(fsm, data);
+            fsm_compiled_enter(fsm, ST_LOW_BATTERY, ST_LOW_BATTERY, 0, data);
+            return 1;
+        default:
+            return 0;
+        }
+    default:
+        return 0;
+    }
+}
+
+// Compiles the tables of music_player and sets the generated dispatcher
+static int music_player_def_init(fsm_def_t *def, size_t num_events, fsm_state_t *initial_state)
+{
+    int ret = fsm_def_init(def, FSM_TRANSITIONS_GET(music_player), FSM_TRANSITIONS_SIZE(music_player), num_events, initial_state);
+
+    if (ret == 0) def->dispatch = music_player_dispatch;
+    return ret;
+}
+
+#endif /* MUSIC_PLAYER_DISPATCH_H_ */
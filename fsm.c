@@ -1,360 +1,2183 @@
-/**
- * @file fsm.c
- * @author Mauro Medina
- * @brief 
- * @version 1.0.1
- * @date 2024-07-17
- * 
- * @copyright Copyright (c) 2024
- * 
- */
-#include <stddef.h>
-#include <stdbool.h>
-#include <string.h>
-
-#include "fsm.h"
-
-#ifdef FREERTOS_API
-#include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
-#else
-#include "ring_buff.h"
-#endif 
-
-struct internal_ctx {
-	int terminate:  1;
-	int is_exit:    1;
-    int handled:    1;
-};
-
-static void enter_state(fsm_t *fsm, fsm_state_t *lca, fsm_state_t *target, void *data) {
-    fsm_state_t* state_path[MAX_HIERARCHY_DEPTH];
-    fsm_state_t* state_target = (fsm_state_t*)target;
-    int depth = 0;
-
-    // Check for default substate
-    while (state_target->default_substate) {
-        state_target = state_target->default_substate;
-    }
-
-    // Build path from target to LCA (exclusive)
-    for (fsm_state_t* s = (fsm_state_t*)state_target; s != lca && s != NULL; s = s->parent) {
-        state_path[depth++] = s;
-        if (depth >= MAX_HIERARCHY_DEPTH) break;
-    }
-
-    // Execute entry actions from LCA (exclusive) to target state
-    for (int i = depth - 1; i >= 0; i--) {
-        if (state_path[i]->entry_action) {
-            state_path[i]->entry_action(fsm, data);
-        }
-    }
-
-    // When source state is target state, execute entry action
-    if((lca == state_target) && (depth == 0))
-    {
-        if(lca->entry_action) lca->entry_action(fsm, data);
-    }
-    
-    // Actors
-    for (size_t i = 0; ((i < FSM_MAX_ACTORS) && (fsm->actors_table[i].actor != NULL)); i++)
-    {
-        for (size_t j = FSM_ACTOR_FIRST; j < fsm->actors_table[i].len; j++)
-        {
-            if((fsm->actors_table[i].actor[j].state_id == target->state_id) && (fsm->actors_table[i].actor[j].entry_action != NULL)) fsm->actors_table[i].actor[j].entry_action(fsm, data);
-        }
-    }
-
-    fsm->current_state = (fsm_state_t*)state_target;
-}
-
-static void exit_state(fsm_t *fsm, fsm_state_t *state, void *data) {
-    for (fsm_state_t* s = fsm->current_state; s != state && s != NULL; s = s->parent) {
-        if (s->exit_action) {
-            s->exit_action(fsm, data);
-        }
-        s->t_count = s->t_period;
-    }
-    // Actors
-    for (size_t i = 0; ((i < FSM_MAX_ACTORS) && (fsm->actors_table[i].actor != NULL)); i++)
-    {
-        for (size_t j = FSM_ACTOR_FIRST; j < fsm->actors_table[i].len; j++)
-        {
-            if((fsm->actors_table[i].actor[j].state_id == state->state_id) && (fsm->actors_table[i].actor[j].exit_action != NULL)) fsm->actors_table[i].actor[j].exit_action(fsm, data);
-        }
-    }
-}
-
-static void transition_work(fsm_t *fsm, fsm_action_t action, void *data) {
-    if (action) {
-        action(fsm, data);
-    }
-}
-
-static fsm_state_t* find_lca(fsm_state_t *s1, fsm_state_t *s2) {
-    fsm_state_t *a = s1, *b = s2;
-    while (a != b) {
-        if (a == NULL) a = s2;
-        else if (b == NULL) b = s1;
-        else {
-            a = a->parent;
-            b = b->parent;
-        }
-    }
-    return a;
-}
-
-static void fsm_smart_events_init(fsm_t *fsm)
-{
-    uint32_t idx = 0;
-
-    memset(fsm->smart_event, 0, sizeof(fsm_smt_events_t));
-
-    // Sorts transitions by event id
-    for (int i = FSM_TIMEOUT_EV; i <= (fsm->num_events+FSM_EV_FIRST); i++)
-    {
-        for (int j = 1; j <= fsm->num_transitions; j++)
-        {
-            if(fsm->transitions[j].event == i)
-            {
-                fsm->smart_event[i].source_state[idx] = fsm->transitions[j].source_state;
-                fsm->smart_event[i].transition_action[idx] = fsm->transitions[j].transition_action;
-                fsm->smart_event[i].target_state[idx] = fsm->transitions[j].target_state;
-                if(++idx >= FSM_MAX_TRANSITIONS) break;
-            }
-        }
-        idx = 0;
-    }
-    
-}
-
-int fsm_init(fsm_t *fsm, const fsm_transition_t *transitions, size_t num_transitions, size_t num_events, uint32_t time_period_ticks, fsm_state_t* initial_state, void *initial_data) {
-    struct internal_ctx *const internal = (void *)&fsm->internal;
-
-    if(fsm == NULL || transitions == NULL || initial_state == NULL) return -1;
-    if(num_transitions == 0) return -2;
-
-    fsm->transitions         = transitions;
-    fsm->num_transitions     = num_transitions;
-    fsm->num_events          = num_events;
-    fsm->terminate_val       = 0;   
-    internal->terminate      = false;
-    internal->is_exit        = false;
-    fsm->current_data        = initial_data;
-    fsm->fsm_ms_ticks        = time_period_ticks;
-    
-    memset(fsm->actors_table, 0, sizeof(fsm->actors_table));
-
-    fsm_smart_events_init(fsm);
-
-#ifdef FREERTOS_API
-    fsm->event_queue = xQueueCreate(FSM_MAX_EVENTS, sizeof(struct fsm_events_t));
-    if(fsm->event_queue == NULL) return -3;
-#else
-    ringbuff_init(&fsm->event_queue, fsm->events_buff, FSM_MAX_EVENTS, sizeof(struct fsm_events_t));
-#endif
-    enter_state(fsm, initial_state, initial_state, initial_data);
-
-    return 0;
-}
-
-int fsm_actor_link(fsm_t *fsm, struct fsm_actor_t *actor, int size) {
-    
-    if(fsm == NULL || actor == NULL) return -1;
-
-    for (uint16_t i = 0; i < FSM_MAX_ACTORS; i++)
-    {
-        // Search empty spot
-        if(fsm->actors_table[i].len == 0)
-        {
-            fsm->actors_table[i].actor = actor;
-            fsm->actors_table[i].len = size;
-
-            return 0;
-        }
-    }
-    return -2;
-}
-
-int fsm_timed_event_set(fsm_state_t *state, uint32_t ticks)
-{
-    if(state == NULL) return -1;
-
-    state->t_period = ticks;
-    state->t_count = ticks;
-
-    return 0;
-}
-
-void fsm_dispatch(fsm_t *fsm, uint32_t event, void *data) {
-    
-    if(fsm == NULL) return;
-    if(fsm->num_transitions == 0) return;
-
-    struct fsm_events_t new_event = {event, data};
-
-#ifdef FREERTOS_API
-    if(xPortInIsrContext())
-    {
-        xQueueSendFromISR(fsm->event_queue, &new_event, NULL);
-    }else
-    {
-        xQueueSend(fsm->event_queue, &new_event, 0);
-    }
-#else
-    ringbuff_put(&fsm->event_queue, &new_event);
-#endif    
-}
-
-static int fsm_process_events(fsm_t *fsm) {
-    
-    if(fsm == NULL) return -1;
-    if(fsm->num_transitions == 0) return -2;
-
-    struct internal_ctx *const internal = (void *)&fsm->internal;
-
-    struct fsm_events_t current_event;
-
-#ifdef FREERTOS_API
-    int event_ready = 0;
-    if(xPortInIsrContext())
-    {
-        event_ready = xQueueReceiveFromISR(fsm->event_queue, &current_event, NULL);
-    }else
-    {
-        event_ready = xQueueReceive(fsm->event_queue, &current_event, 0);
-    }
-    while(event_ready) {
-#else
-    while (ringbuff_get(&fsm->event_queue, &current_event) == 0) {
-#endif    
-        internal->handled = 0;
-
-        fsm_state_t* current = fsm->current_state;
-        while (internal->handled == 0 && current != NULL) 
-        {
-            for (int i = 0; (i < FSM_MAX_TRANSITIONS+1) && (fsm->smart_event[current_event.event].source_state[i] != NULL); i++)
-            {
-                if(fsm->smart_event[current_event.event].source_state[i] == current)
-                {
-                    fsm_state_t* lca = find_lca(fsm->current_state, fsm->smart_event[current_event.event].target_state[i]);
-
-                    exit_state(fsm, lca, current_event.data);
-                    transition_work(fsm, fsm->smart_event[current_event.event].transition_action[i], current_event.data);
-                    enter_state(fsm, lca, fsm->smart_event[current_event.event].target_state[i], current_event.data);
-
-                    /* No need to continue if terminate was set in the exit action */
-                    if (internal->terminate) {
-                        return fsm->terminate_val;
-                    }
-                    internal->handled = 1;
-                }
-            }
-            current = current->parent;
-        }
-        
-        if (internal->terminate) {
-            return fsm->terminate_val;
-        }
-#ifdef FREERTOS_API        
-        if(xPortInIsrContext())
-        {
-            event_ready = xQueueReceiveFromISR(fsm->event_queue, &current_event, NULL);
-        }else
-        {
-            event_ready = xQueueReceive(fsm->event_queue, &current_event, 0);
-        }
-#endif        
-    }
-    return 0;
-}
-
-int fsm_run(fsm_t *fsm)
-{
-    if(fsm == NULL) return -1;
-
-    struct internal_ctx *const internal = (void *)&fsm->internal;
-
-    /* No need to continue if terminate was set */
-	if (internal->terminate) {
-		return fsm->terminate_val;
-	}
-    
-    fsm_process_events(fsm);
-
-    // Run state
-    if (fsm->current_state->run_action) {
-        fsm->current_state->run_action(fsm, fsm->current_data);
-    }
-
-    // Actors
-    for (size_t i = 0; ((i < FSM_MAX_ACTORS) && (fsm->actors_table[i].actor != NULL)); i++)
-    {
-        for (size_t j = FSM_ACTOR_FIRST; j < fsm->actors_table[i].len; j++)
-        {
-            if((fsm->actors_table[i].actor[j].state_id == fsm->current_state->state_id) && (fsm->actors_table[i].actor[j].run_action != NULL)) fsm->actors_table[i].actor[j].run_action(fsm, fsm->current_data);
-        }
-    }
-    return 0;
-}
-
-int fsm_state_get(fsm_t *fsm)
-{
-    if(fsm == NULL) return FSM_ST_NONE;
-
-    return fsm->current_state->state_id;
-}
-
-void fsm_terminate(fsm_t *fsm, int val)
-{
-    if(fsm == NULL) return;
-
-    struct internal_ctx *const internal = (void *)&fsm->internal;
-
-    internal->terminate = true;
-    fsm->terminate_val = val;  
-}
-
-int fsm_has_pending_events(fsm_t *fsm) {
-    if(fsm == NULL) return -1;
-
-#ifdef FREERTOS_API
-        if(xPortInIsrContext())
-        {
-            return uxQueueMessagesWaitingFromISR(fsm->event_queue) > 0;
-        }else
-        {
-            return uxQueueMessagesWaiting(fsm->event_queue) > 0;
-        }
-#else
-    return ringbuff_num(&fsm->event_queue) > 0;
-#endif
-}
-
-void fsm_flush_events(fsm_t *fsm) {
-    
-    if(fsm == NULL) return;
-
-#ifdef FREERTOS_API
-    xQueueReset(fsm->event_queue);
-#else
-    ringbuff_flush(&fsm->event_queue);
-#endif
-}
-
-void fsm_ticks_hook(fsm_t *fsm)
-{
-    struct fsm_events_t new_event = {FSM_TIMEOUT_EV, fsm->current_data};
-
-    if(fsm->current_state->t_count > 0)
-    {
-        fsm->current_state->t_count--;
-        if(fsm->current_state->t_count == 0) 
-        {
-            ringbuff_put_first(&fsm->event_queue, &new_event);
-#ifdef CONFIG_RUN_ON_TIMER_HOOK            
-            fsm_run(fsm);
-#endif            
-        }
-    }
+/**
+ * @file fsm.c
+ * @author Mauro Medina
+ * @brief 
+ * @version 1.0.1
+ * @date 2024-07-17
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+#ifdef FSM_POSIX_API
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "fsm.h"
+#ifdef FSM_EXEC
+#include "fsm_exec.h"
+#endif
+
+#ifdef FREERTOS_API
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#else
+#include "ring_buff.h"
+#include "mpsc_queue.h"
+#endif 
+
+// Queued in place of a coalesced event, the low bits are its slot
+#define FSM_EV_COALESCED    0x80000000u
+// Set in the id of the events holding a reference to a pooled payload
+#define FSM_EV_POOLED       0x40000000u
+
+struct internal_ctx {
+	uint8_t terminate:  1;
+	uint8_t is_exit:    1;
+	uint8_t flushed:    1;
+};
+
+_Static_assert((FSM_MAX_EVENTS & (FSM_MAX_EVENTS - 1)) == 0, "FSM_MAX_EVENTS must be a power of 2");
+_Static_assert(FSM_MAX_ROUTES <= (1u << (8 * sizeof(fsm_index_t))), "FSM_MAX_ROUTES does not fit in fsm_index_t");
+_Static_assert(FSM_MAX_COALESCE < FSM_EV_POOLED, "FSM_MAX_COALESCE slots are in the low bits of the event id");
+_Static_assert(sizeof(struct internal_ctx) == sizeof(((fsm_t *)0)->internal), "internal_ctx does not fit in fsm_t.internal");
+_Static_assert(FSM_MAX_STATES < (1u << (8 * sizeof(fsm_state_id_t))), "FSM_MAX_STATES does not fit in fsm_state_id_t");
+_Static_assert((FSM_PRIO_LANES >= 1) && (FSM_PRIO_LANES <= 33), "FSM_PRIO_LANES lanes above normal are flagged in 32 bits");
+
+#ifdef FSM_COMPACT
+#define FSM_ACTORS(fsm)     ((fsm)->actors)
+#else
+#define FSM_ACTORS(fsm)     (&(fsm)->actors)
+#endif
+
+#ifndef FREERTOS_API
+RINGBUFF_TYPED_DEFINE(fsm_ring, struct fsm_events_t)
+#endif
+
+// Initialized and with an event queue, the proxy fsm_t of a batch has none
+static inline bool fsm_has_queue(const fsm_t *fsm)
+{
+    return (fsm->def != NULL) && (FSM_EXT(fsm)->queue != FSM_QUEUE_NONE);
+}
+
+#if !defined(FREERTOS_API) && (defined(__unix__) || defined(__APPLE__))
+#define FSM_HAS_POSIX_CLOCK 1
+
+static uint64_t fsm_clock_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+#endif
+
+#if defined(FSM_HAS_POSIX_CLOCK) || defined(FREERTOS_API)
+static uint64_t fsm_clock_default(void)
+{
+#ifdef FREERTOS_API
+    return (uint64_t)xTaskGetTickCount() * portTICK_PERIOD_MS;
+#else
+    return fsm_clock_ms();
+#endif
+}
+#define FSM_CLOCK_DEFAULT fsm_clock_default
+#else
+#define FSM_CLOCK_DEFAULT NULL
+#endif
+
+static void fsm_deadline_arm(fsm_t *fsm)
+{
+    uint32_t period = FSM_STATE(fsm)->t_period;
+
+    FSM_EXT(fsm)->deadline = (period > 0) ? FSM_EXT(fsm)->clock() + period : FSM_NO_DEADLINE;
+}
+
+static void fsm_stats_watermark(fsm_t *fsm, uint32_t num)
+{
+    uint32_t max = __atomic_load_n(&FSM_EXT(fsm)->stats.high_watermark, __ATOMIC_RELAXED);
+
+    while ((num > max) && !__atomic_compare_exchange_n(&FSM_EXT(fsm)->stats.high_watermark, &max, num, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Only the owner thread takes events from the queue
+static void fsm_stats_processed(fsm_t *fsm, uint32_t num)
+{
+    __atomic_store_n(&FSM_EXT(fsm)->stats.processed, FSM_EXT(fsm)->stats.processed + num, __ATOMIC_RELAXED);
+}
+
+static void fsm_stats_count(fsm_t *fsm, int status)
+{
+    switch (status)
+    {
+    case FSM_DISPATCH_OVERWRITE:
+        __atomic_fetch_add(&FSM_EXT(fsm)->stats.overwritten, 1, __ATOMIC_RELAXED);
+        break;
+    case FSM_DISPATCH_SPILLED:
+        __atomic_fetch_add(&FSM_EXT(fsm)->stats.spilled, 1, __ATOMIC_RELAXED);
+        break;
+    case FSM_DISPATCH_COALESCED:
+        __atomic_fetch_add(&FSM_EXT(fsm)->stats.coalesced, 1, __ATOMIC_RELAXED);
+        break;
+    case FSM_DISPATCH_REJECTED:
+    case FSM_DISPATCH_TIMEOUT:
+        __atomic_fetch_add(&FSM_EXT(fsm)->stats.dropped, 1, __ATOMIC_RELAXED);
+        break;
+    default:
+        break;
+    }
+}
+
+static void fsm_event_fd_signal(fsm_t *fsm)
+{
+#ifdef FSM_POSIX_API
+    uint64_t one = 1;
+
+    // Only the first event since the owner woke up writes to the eventfd
+    if (!__atomic_exchange_n(&FSM_EXT(fsm)->event_signaled, 1, __ATOMIC_SEQ_CST))
+    {
+        if (write(FSM_EXT(fsm)->event_fd, &one, sizeof(one)) < 0) {}
+    }
+#else
+    (void)fsm;
+#endif
+}
+
+static void fsm_notify(fsm_t *fsm)
+{
+    fsm_event_fd_signal(fsm);
+#ifdef FSM_EXEC
+    if (FSM_EXT(fsm)->exec) fsm_exec_notify(fsm);
+#endif
+}
+
+static void fsm_coalesce_init(fsm_t *fsm, const fsm_config_t *config)
+{
+    FSM_EXT(fsm)->num_coalesce = (config->coalesce != NULL) ? config->num_coalesce : 0;
+    FSM_EXT(fsm)->event_count = 1;
+    if (FSM_EXT(fsm)->num_coalesce > FSM_MAX_COALESCE) FSM_EXT(fsm)->num_coalesce = FSM_MAX_COALESCE;
+
+    for (uint32_t i = 0; i < FSM_EXT(fsm)->num_coalesce; i++)
+    {
+        FSM_EXT(fsm)->coalesce[i].event = config->coalesce[i].event;
+        FSM_EXT(fsm)->coalesce[i].mode  = config->coalesce[i].mode;
+        FSM_EXT(fsm)->coalesce[i].count = 0;
+        FSM_EXT(fsm)->coalesce[i].data  = NULL;
+    }
+}
+
+// The queued event was lost, a coalesced one is queued again by the next dispatch, a pooled payload is released
+static void fsm_event_drop(fsm_t *fsm, const struct fsm_events_t *event)
+{
+    if (event->event & FSM_EV_COALESCED)
+    {
+        __atomic_store_n(&FSM_EXT(fsm)->coalesce[event->event & ~FSM_EV_COALESCED].count, 0, __ATOMIC_RELAXED);
+    }else if (event->event & FSM_EV_POOLED)
+    {
+        fsm_pool_release(event->data);
+    }
+}
+
+static void fsm_events_drop(fsm_t *fsm, const struct fsm_events_t *events, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+        fsm_event_drop(fsm, &events[i]);
+    }
+}
+
+// Events taken from the queue but not handled, after a terminate or a flush
+static void fsm_events_discard(fsm_t *fsm, const struct fsm_events_t *events, uint32_t n)
+{
+    if (n == 0) return;
+
+    fsm_events_drop(fsm, events, n);
+    __atomic_fetch_add(&FSM_EXT(fsm)->stats.dropped, n, __ATOMIC_RELAXED);
+}
+
+// Gives the event id and data of a coalesced event taken from the queue
+static uint32_t fsm_coalesce_take(fsm_t *fsm, uint32_t event, void **data)
+{
+    uint32_t slot = event & ~FSM_EV_COALESCED;
+
+    // Dispatches from now on queue the event again
+    FSM_EXT(fsm)->event_count = __atomic_exchange_n(&FSM_EXT(fsm)->coalesce[slot].count, 0, __ATOMIC_ACQUIRE);
+    if (FSM_EXT(fsm)->coalesce[slot].mode == FSM_COALESCE_LATEST)
+    {
+        *data = __atomic_load_n(&FSM_EXT(fsm)->coalesce[slot].data, __ATOMIC_RELAXED);
+    }
+    return FSM_EXT(fsm)->coalesce[slot].event;
+}
+
+#ifndef FREERTOS_API
+static int fsm_lane_init(fsm_t *fsm, struct ringbuff *ring, struct mpsc_queue *mpsc, void *buff, uint32_t len)
+{
+    if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC)
+    {
+        return mpsc_queue_init(mpsc, buff, len, sizeof(struct fsm_events_t));
+    }
+    return ringbuff_init(ring, buff, len, sizeof(struct fsm_events_t));
+}
+#endif
+
+static int fsm_queue_init(fsm_t *fsm, const fsm_config_t *config)
+{
+    if (config->queue == FSM_QUEUE_NONE) return -1;
+
+    FSM_EXT(fsm)->queue = config->queue;
+#if FSM_PRIO_LANES > 1
+    FSM_EXT(fsm)->priorities = config->priorities;
+    FSM_EXT(fsm)->num_priorities = (config->priorities != NULL) ? config->num_priorities : 0;
+#endif
+#ifdef FSM_POSIX_API
+    // Events come from any thread
+    FSM_EXT(fsm)->queue = FSM_QUEUE_MPSC;
+    FSM_EXT(fsm)->event_signaled = 0;
+    FSM_EXT(fsm)->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(FSM_EXT(fsm)->event_fd < 0) return -1;
+#endif
+    FSM_EXT(fsm)->overflow = config->overflow;
+    FSM_EXT(fsm)->block_timeout_ms = config->block_timeout_ms;
+    FSM_EXT(fsm)->timeout_pending = 0;
+    memset(&FSM_EXT(fsm)->stats, 0, sizeof(FSM_EXT(fsm)->stats));
+    fsm_coalesce_init(fsm, config);
+
+#ifdef FREERTOS_API
+    FSM_EXT(fsm)->event_queue = xQueueCreate(FSM_MAX_EVENTS, sizeof(struct fsm_events_t));
+    if(FSM_EXT(fsm)->event_queue == NULL) return -1;
+#else
+    void *buff = config->events_buff;
+    uint32_t len = config->events_len;
+
+    if (buff == NULL)
+    {
+#ifdef FSM_COMPACT
+        return -1;
+#else
+        buff = &FSM_EXT(fsm)->events_buff;
+        len = FSM_MAX_EVENTS;
+#endif
+    }
+
+    memset(&FSM_EXT(fsm)->spill, 0, sizeof(FSM_EXT(fsm)->spill));
+    if ((config->overflow == FSM_OVERFLOW_SPILL) && (config->spill_buff != NULL))
+    {
+        if (ringbuff_init(&FSM_EXT(fsm)->spill, config->spill_buff, config->spill_len, sizeof(struct fsm_events_t)) != 0) return -1;
+    }
+    if (fsm_lane_init(fsm, &FSM_EXT(fsm)->event_queue.ring, &FSM_EXT(fsm)->event_queue.mpsc, buff, len) != 0) return -1;
+
+#if FSM_PRIO_LANES > 1
+    buff = config->prio_buff;
+    len = config->prio_len;
+    FSM_EXT(fsm)->prio_lanes = FSM_PRIO_LANES - 1;
+    FSM_EXT(fsm)->prio_pending = 0;
+    if (buff == NULL)
+    {
+#ifdef FSM_COMPACT
+        FSM_EXT(fsm)->prio_lanes = 0;
+#else
+        buff = FSM_EXT(fsm)->prio_buff;
+        len = FSM_PRIO_EVENTS;
+#endif
+    }
+    for (uint32_t i = 0; i < FSM_EXT(fsm)->prio_lanes; i++)
+    {
+        void *lane_buff = (uint8_t *)buff + i * FSM_EVENTS_BUFF_SIZE(len);
+
+        if (fsm_lane_init(fsm, &FSM_EXT(fsm)->prio_queue[i].ring, &FSM_EXT(fsm)->prio_queue[i].mpsc, lane_buff, len) != 0) return -1;
+    }
+#endif
+#endif
+    return 0;
+}
+
+#ifdef FREERTOS_API
+static int fsm_queue_put(fsm_t *fsm, const struct fsm_events_t *event)
+{
+    struct fsm_events_t oldest;
+
+    if(xPortInIsrContext())
+    {
+        if (xQueueSendFromISR(FSM_EXT(fsm)->event_queue, event, NULL) == pdTRUE) return FSM_DISPATCH_OK;
+        if ((FSM_EXT(fsm)->overflow == FSM_OVERFLOW_DROP_OLDEST) && (xQueueReceiveFromISR(FSM_EXT(fsm)->event_queue, &oldest, NULL) == pdTRUE))
+        {
+            fsm_event_drop(fsm, &oldest);
+            if (xQueueSendFromISR(FSM_EXT(fsm)->event_queue, event, NULL) == pdTRUE) return FSM_DISPATCH_OVERWRITE;
+        }
+        // Can not block inside an ISR
+        return FSM_DISPATCH_REJECTED;
+    }
+
+    if (FSM_EXT(fsm)->overflow == FSM_OVERFLOW_BLOCK)
+    {
+        return (xQueueSend(FSM_EXT(fsm)->event_queue, event, pdMS_TO_TICKS(FSM_EXT(fsm)->block_timeout_ms)) == pdTRUE) ? FSM_DISPATCH_OK : FSM_DISPATCH_TIMEOUT;
+    }
+    if (xQueueSend(FSM_EXT(fsm)->event_queue, event, 0) == pdTRUE) return FSM_DISPATCH_OK;
+    if ((FSM_EXT(fsm)->overflow == FSM_OVERFLOW_DROP_OLDEST) && (xQueueReceive(FSM_EXT(fsm)->event_queue, &oldest, 0) == pdTRUE))
+    {
+        fsm_event_drop(fsm, &oldest);
+        if (xQueueSend(FSM_EXT(fsm)->event_queue, event, 0) == pdTRUE) return FSM_DISPATCH_OVERWRITE;
+    }
+    return FSM_DISPATCH_REJECTED;
+}
+#else
+static int fsm_queue_put_mpsc(fsm_t *fsm, const struct fsm_events_t *event)
+{
+    if (mpsc_queue_put(&FSM_EXT(fsm)->event_queue.mpsc, event) == 0) return FSM_DISPATCH_OK;
+
+    // Producers can not drop the oldest event, only the owner thread reads the queue
+    if (FSM_EXT(fsm)->overflow != FSM_OVERFLOW_BLOCK) return FSM_DISPATCH_REJECTED;
+
+#ifdef FSM_HAS_POSIX_CLOCK
+    uint64_t deadline = fsm_clock_ms() + FSM_EXT(fsm)->block_timeout_ms;
+    do {
+        sched_yield();
+        if (mpsc_queue_put(&FSM_EXT(fsm)->event_queue.mpsc, event) == 0) return FSM_DISPATCH_OK;
+    } while (fsm_clock_ms() < deadline);
+#endif
+    return FSM_DISPATCH_TIMEOUT;
+}
+
+static int fsm_queue_put(fsm_t *fsm, const struct fsm_events_t *event)
+{
+    if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC)
+    {
+        return fsm_queue_put_mpsc(fsm, event);
+    }
+
+    // Once spilled, events keep going to the spill buffer to keep the order
+    if ((FSM_EXT(fsm)->spill.len == 0) || (ringbuff_num(&FSM_EXT(fsm)->spill) == 0))
+    {
+        if (ringbuff_num(&FSM_EXT(fsm)->event_queue.ring) < FSM_EXT(fsm)->event_queue.ring.len)
+        {
+            fsm_ring_put(&FSM_EXT(fsm)->event_queue.ring, event);
+            return FSM_DISPATCH_OK;
+        }
+        if (FSM_EXT(fsm)->overflow == FSM_OVERFLOW_DROP_OLDEST)
+        {
+            struct fsm_events_t oldest;
+
+            if (fsm_ring_get(&FSM_EXT(fsm)->event_queue.ring, &oldest) == 0) fsm_event_drop(fsm, &oldest);
+            fsm_ring_put(&FSM_EXT(fsm)->event_queue.ring, event);
+            return FSM_DISPATCH_OVERWRITE;
+        }
+    }
+    if ((FSM_EXT(fsm)->spill.len != 0) && (ringbuff_num(&FSM_EXT(fsm)->spill) < FSM_EXT(fsm)->spill.len))
+    {
+        fsm_ring_put(&FSM_EXT(fsm)->spill, event);
+        return FSM_DISPATCH_SPILLED;
+    }
+    // A single thread can not wait for itself to drain the queue
+    return FSM_DISPATCH_REJECTED;
+}
+#endif
+
+static int fsm_queue_put_first(fsm_t *fsm, const struct fsm_events_t *event);
+
+static int fsm_queue_put_prio(fsm_t *fsm, const struct fsm_events_t *event, uint32_t prio)
+{
+#if FSM_PRIO_LANES > 1
+#ifdef FREERTOS_API
+    // A single queue, the event goes to the front
+    if (prio > FSM_PRIO_NORMAL) return fsm_queue_put_first(fsm, event);
+#else
+    if ((prio > FSM_PRIO_NORMAL) && (FSM_EXT(fsm)->prio_lanes > 0))
+    {
+        uint32_t lane = ((prio < FSM_EXT(fsm)->prio_lanes) ? prio : FSM_EXT(fsm)->prio_lanes) - 1;
+
+        if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC)
+        {
+            if (mpsc_queue_put(&FSM_EXT(fsm)->prio_queue[lane].mpsc, event) != 0) return FSM_DISPATCH_REJECTED;
+        }else
+        {
+            if (ringbuff_num(&FSM_EXT(fsm)->prio_queue[lane].ring) >= FSM_EXT(fsm)->prio_queue[lane].ring.len) return FSM_DISPATCH_REJECTED;
+            fsm_ring_put(&FSM_EXT(fsm)->prio_queue[lane].ring, event);
+        }
+        // The owner only looks at the flagged lanes
+        __atomic_fetch_or(&FSM_EXT(fsm)->prio_pending, 1u << lane, __ATOMIC_RELEASE);
+        return FSM_DISPATCH_OK;
+    }
+#endif
+#endif
+    return fsm_queue_put(fsm, event);
+}
+
+static int fsm_queue_put_first(fsm_t *fsm, const struct fsm_events_t *event)
+{
+#ifdef FREERTOS_API
+    if(xPortInIsrContext())
+    {
+        return (xQueueSendToFrontFromISR(FSM_EXT(fsm)->event_queue, event, NULL) == pdTRUE) ? FSM_DISPATCH_OK : FSM_DISPATCH_REJECTED;
+    }
+    return (xQueueSendToFront(FSM_EXT(fsm)->event_queue, event, 0) == pdTRUE) ? FSM_DISPATCH_OK : FSM_DISPATCH_REJECTED;
+#else
+    if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC)
+    {
+        // Only the owner thread reads the queue, the timeout is flagged instead
+#ifdef FSM_LATENCY_STATS
+        __atomic_store_n(&FSM_EXT(fsm)->timeout_enqueued, event->enqueued, __ATOMIC_RELAXED);
+#endif
+        __atomic_store_n(&FSM_EXT(fsm)->timeout_pending, 1, __ATOMIC_RELEASE);
+        return FSM_DISPATCH_OK;
+    }
+    // When full, the newest event is dropped
+    int status = (ringbuff_num(&FSM_EXT(fsm)->event_queue.ring) < FSM_EXT(fsm)->event_queue.ring.len) ? FSM_DISPATCH_OK : FSM_DISPATCH_OVERWRITE;
+    if (status == FSM_DISPATCH_OVERWRITE) fsm_event_drop(fsm, fsm_ring_last(&FSM_EXT(fsm)->event_queue.ring));
+    ringbuff_put_first(&FSM_EXT(fsm)->event_queue.ring, (void *)event);
+    return status;
+#endif
+}
+
+// Puts events in the normal lane until one is rejected, the counters are updated but the owner is not notified
+static uint32_t fsm_queue_put_n(fsm_t *fsm, const struct fsm_events_t *events, uint32_t n)
+{
+    uint32_t num = 0;
+    int status = FSM_DISPATCH_OK;
+
+    if (n == 0) return 0;
+
+#ifdef FREERTOS_API
+    // The owner task wakes up once, when the scheduler resumes. Blocking needs it running
+    bool suspend = !xPortInIsrContext() && (FSM_EXT(fsm)->overflow != FSM_OVERFLOW_BLOCK);
+
+    if (suspend) vTaskSuspendAll();
+#else
+    // A single claim of the tail for all the events that fit
+    if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC) num = mpsc_queue_put_n(&FSM_EXT(fsm)->event_queue.mpsc, events, n);
+#endif
+
+    for (; num < n; num++)
+    {
+        status = fsm_queue_put(fsm, &events[num]);
+        fsm_stats_count(fsm, status);
+        if (status < FSM_DISPATCH_OK) break;
+    }
+
+#ifdef FREERTOS_API
+    if (suspend) xTaskResumeAll();
+#endif
+
+    // The rejected event and the ones after it are given back, not queued
+    fsm_events_drop(fsm, &events[num], n - num);
+    return num;
+}
+
+#if !defined(FREERTOS_API) && (FSM_PRIO_LANES > 1)
+// Takes events of the lanes flagged by the producers, the highest one first
+static uint32_t fsm_queue_get_prio(fsm_t *fsm, struct fsm_events_t *events, uint32_t n)
+{
+    uint32_t num = 0;
+
+    if (__atomic_load_n(&FSM_EXT(fsm)->prio_pending, __ATOMIC_RELAXED))
+    {
+        uint32_t pending = __atomic_exchange_n(&FSM_EXT(fsm)->prio_pending, 0, __ATOMIC_ACQUIRE);
+        uint32_t left = 0;
+
+        for (uint32_t lane = FSM_EXT(fsm)->prio_lanes; lane-- > 0;)
+        {
+            if (!(pending & (1u << lane))) continue;
+            if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC)
+            {
+                while ((num < n) && (mpsc_queue_get(&FSM_EXT(fsm)->prio_queue[lane].mpsc, &events[num]) == 0)) num++;
+                if (num == n) left |= 1u << lane;
+            }else
+            {
+                num += fsm_ring_get_n(&FSM_EXT(fsm)->prio_queue[lane].ring, &events[num], n - num);
+                if (ringbuff_num(&FSM_EXT(fsm)->prio_queue[lane].ring) != 0) left |= 1u << lane;
+            }
+        }
+        // Lanes not drained by this batch
+        if (left) __atomic_fetch_or(&FSM_EXT(fsm)->prio_pending, left, __ATOMIC_RELAXED);
+    }
+    return num;
+}
+#endif
+
+// Takes up to n events, num_prio tells how many of the first ones come from the priority lanes
+static uint32_t fsm_queue_get_n(fsm_t *fsm, struct fsm_events_t *events, uint32_t n, uint32_t *num_prio)
+{
+    uint32_t num = 0;
+
+    *num_prio = 0;
+#ifdef FREERTOS_API
+    if(xPortInIsrContext())
+    {
+        while ((num < n) && (xQueueReceiveFromISR(FSM_EXT(fsm)->event_queue, &events[num], NULL) == pdTRUE)) num++;
+    }else
+    {
+        while ((num < n) && (xQueueReceive(FSM_EXT(fsm)->event_queue, &events[num], 0) == pdTRUE)) num++;
+    }
+#else
+#if FSM_PRIO_LANES > 1
+    num = *num_prio = fsm_queue_get_prio(fsm, events, n);
+#endif
+    if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC)
+    {
+        if ((num < n) && __atomic_load_n(&FSM_EXT(fsm)->timeout_pending, __ATOMIC_RELAXED) && __atomic_exchange_n(&FSM_EXT(fsm)->timeout_pending, 0, __ATOMIC_ACQUIRE))
+        {
+            events[num].event = FSM_TIMEOUT_EV;
+            events[num].data  = fsm->current_data;
+#ifdef FSM_LATENCY_STATS
+            events[num].enqueued = __atomic_load_n(&FSM_EXT(fsm)->timeout_enqueued, __ATOMIC_RELAXED);
+#endif
+            num++;
+        }
+        while ((num < n) && (mpsc_queue_get(&FSM_EXT(fsm)->event_queue.mpsc, &events[num]) == 0)) num++;
+    }else
+    {
+        num += fsm_ring_get_n(&FSM_EXT(fsm)->event_queue.ring, &events[num], n - num);
+        // Spilled events are newer than the ones in the queue
+        if ((num < n) && (FSM_EXT(fsm)->spill.len != 0))
+        {
+            num += fsm_ring_get_n(&FSM_EXT(fsm)->spill, &events[num], n - num);
+        }
+    }
+#endif
+    fsm_stats_processed(fsm, num);
+    return num;
+}
+
+static uint32_t fsm_queue_num(fsm_t *fsm)
+{
+#ifdef FREERTOS_API
+    if(xPortInIsrContext())
+    {
+        return uxQueueMessagesWaitingFromISR(FSM_EXT(fsm)->event_queue);
+    }
+    return uxQueueMessagesWaiting(FSM_EXT(fsm)->event_queue);
+#else
+    uint32_t num = 0;
+
+#if FSM_PRIO_LANES > 1
+    // Lanes not flagged are empty
+    if (__atomic_load_n(&FSM_EXT(fsm)->prio_pending, __ATOMIC_RELAXED))
+    {
+        for (uint32_t lane = 0; lane < FSM_EXT(fsm)->prio_lanes; lane++)
+        {
+            num += (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC) ? mpsc_queue_num(&FSM_EXT(fsm)->prio_queue[lane].mpsc) : ringbuff_num(&FSM_EXT(fsm)->prio_queue[lane].ring);
+        }
+    }
+#endif
+    if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC)
+    {
+        return num + mpsc_queue_num(&FSM_EXT(fsm)->event_queue.mpsc) + __atomic_load_n(&FSM_EXT(fsm)->timeout_pending, __ATOMIC_RELAXED);
+    }
+    return num + ringbuff_num(&FSM_EXT(fsm)->event_queue.ring) + ((FSM_EXT(fsm)->spill.len != 0) ? ringbuff_num(&FSM_EXT(fsm)->spill) : 0);
+#endif
+}
+
+#ifndef FREERTOS_API
+static void fsm_lane_flush(fsm_t *fsm, struct ringbuff *ring, struct mpsc_queue *mpsc)
+{
+    struct fsm_events_t event;
+
+    if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC)
+    {
+        while (mpsc_queue_get(mpsc, &event) == 0) fsm_event_drop(fsm, &event);
+    }else
+    {
+        while (fsm_ring_get(ring, &event) == 0) fsm_event_drop(fsm, &event);
+    }
+}
+#endif
+
+// Events are taken out one by one, coalesced and pooled ones are dropped
+static void fsm_queue_flush(fsm_t *fsm)
+{
+#ifdef FREERTOS_API
+    struct fsm_events_t event;
+
+    while (xQueueReceive(FSM_EXT(fsm)->event_queue, &event, 0) == pdTRUE) fsm_event_drop(fsm, &event);
+#else
+#if FSM_PRIO_LANES > 1
+    __atomic_store_n(&FSM_EXT(fsm)->prio_pending, 0, __ATOMIC_RELAXED);
+    for (uint32_t lane = 0; lane < FSM_EXT(fsm)->prio_lanes; lane++)
+    {
+        fsm_lane_flush(fsm, &FSM_EXT(fsm)->prio_queue[lane].ring, &FSM_EXT(fsm)->prio_queue[lane].mpsc);
+    }
+#endif
+    if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC)
+    {
+        __atomic_store_n(&FSM_EXT(fsm)->timeout_pending, 0, __ATOMIC_RELAXED);
+        fsm_lane_flush(fsm, NULL, &FSM_EXT(fsm)->event_queue.mpsc);
+        return;
+    }
+    fsm_lane_flush(fsm, &FSM_EXT(fsm)->event_queue.ring, NULL);
+    if (FSM_EXT(fsm)->spill.len != 0) fsm_lane_flush(fsm, &FSM_EXT(fsm)->spill, NULL);
+#endif
+}
+
+static inline void fsm_actors_notify(fsm_t *fsm, int state_id, enum fsm_action_e kind, void *data) {
+    const fsm_actors_t *actors = FSM_ACTORS(fsm);
+
+    if (actors == NULL) return;
+
+    const fsm_actor_index_t *index = &actors->index[state_id];
+    const fsm_action_t *action = &actors->actions[index->first];
+
+    // Entry, run and exit actions are stored one after the other
+    for (int k = ACTION_ENTRY; k < (int)kind; k++) {
+        action += index->num[k];
+    }
+    for (int i = 0; i < index->num[kind]; i++) {
+        action[i](fsm, data);
+    }
+}
+
+static void fsm_route_fire(fsm_t *fsm, const fsm_route_t *route, uint32_t event, void *data) {
+    const fsm_action_t *action = &fsm->def->route_actions[route->actions];
+    int i = 0;
+#ifdef FSM_TRACE
+    fsm_trace_t *trace = __atomic_load_n(&FSM_EXT(fsm)->trace, __ATOMIC_ACQUIRE);
+    uint64_t t_start = 0, t_exit = 0, t_transition = 0;
+    int source = FSM_STATE(fsm)->state_id;
+
+    if (trace) t_start = fsm_trace_cycles();
+#endif
+
+    // Exit actions from current state to LCA (exclusive)
+    for (; i < route->num_exit; i++) {
+        action[i](fsm, data);
+    }
+    if (route->num_exited) {
+        fsm->t_elapsed = 0;
+    }
+    fsm_actors_notify(fsm, route->exit_actor_id, ACTION_EXIT, data);
+#ifdef FSM_TRACE
+    if (trace) t_exit = fsm_trace_cycles();
+#endif
+
+    if (route->transition_action) {
+        route->transition_action(fsm, data);
+    }
+#ifdef FSM_TRACE
+    if (trace) t_transition = fsm_trace_cycles();
+#endif
+
+    // Entry actions from LCA (exclusive) to target leaf state
+    for (; i < route->num_exit + route->num_entry; i++) {
+        action[i](fsm, data);
+    }
+    fsm_actors_notify(fsm, route->entry_actor_id, ACTION_ENTRY, data);
+
+    fsm->state_id = route->target_leaf->state_id;
+
+#ifdef FSM_TRACE
+    if (trace) {
+        fsm_trace_record_t record = {
+            .timestamp         = t_start,
+            .fsm_id            = FSM_EXT(fsm)->trace_id,
+            .event             = (uint16_t)event,
+            .source            = (uint8_t)source,
+            .target            = (uint8_t)route->target_leaf->state_id,
+            .exit_cycles       = (uint32_t)(t_exit - t_start),
+            .transition_cycles = (uint32_t)(t_transition - t_exit),
+            .entry_cycles      = (uint32_t)(fsm_trace_cycles() - t_transition),
+        };
+        fsm_trace_write(trace, &record);
+    }
+#else
+    (void)event;
+#endif
+
+    // The state timer restarts with the period of the new state
+    if (route->num_exited) {
+        if (FSM_EXT(fsm)->timer.wheel) fsm_wheel_timer_arm(&FSM_EXT(fsm)->timer, FSM_STATE(fsm)->t_period);
+        if (FSM_EXT(fsm)->clock) fsm_deadline_arm(fsm);
+    }
+}
+
+static fsm_state_t* find_lca(fsm_state_t *s1, fsm_state_t *s2) {
+    fsm_state_t *a = s1, *b = s2;
+    while (a != b) {
+        if (a == NULL) a = s2;
+        else if (b == NULL) b = s1;
+        else {
+            a = a->parent;
+            b = b->parent;
+        }
+    }
+    return a;
+}
+
+static int fsm_route_action_add(fsm_def_t *def, fsm_action_t action)
+{
+    if (action == NULL) return 0;
+    if (def->num_route_actions >= FSM_MAX_ROUTE_ACTIONS) return -1;
+
+    def->route_actions[def->num_route_actions++] = action;
+    return 1;
+}
+
+static int fsm_route_build(fsm_def_t *def, fsm_route_t *route, fsm_state_t *current, fsm_state_t *target, fsm_action_t action)
+{
+    fsm_state_t* state_path[MAX_HIERARCHY_DEPTH];
+    fsm_state_t* lca = find_lca(current, target);
+    fsm_state_t* leaf = target;
+    int depth = 0;
+    int ret;
+
+    // Check for default substate
+    while (leaf->default_substate) {
+        leaf = leaf->default_substate;
+    }
+
+    memset(route, 0, sizeof(*route));
+    route->actions           = def->num_route_actions;
+    route->transition_action = action;
+    route->target_leaf       = leaf;
+    route->entry_actor_id    = target->state_id;
+    route->exit_actor_id     = (lca != NULL) ? lca->state_id : FSM_ST_NONE;
+
+    // Exit actions from current state to LCA (exclusive)
+    for (fsm_state_t* s = current; s != lca && s != NULL; s = s->parent) {
+        if ((ret = fsm_route_action_add(def, s->exit_action)) < 0) return -1;
+        route->num_exit += ret;
+        route->num_exited++;
+    }
+
+    // Build path from target to LCA (exclusive)
+    for (fsm_state_t* s = leaf; s != lca && s != NULL; s = s->parent) {
+        state_path[depth++] = s;
+        if (depth >= MAX_HIERARCHY_DEPTH) break;
+    }
+
+    // Entry actions from LCA (exclusive) to target state
+    for (int i = depth - 1; i >= 0; i--) {
+        if ((ret = fsm_route_action_add(def, state_path[i]->entry_action)) < 0) return -1;
+        route->num_entry += ret;
+    }
+
+    // When source state is target state, execute entry action
+    if ((lca == leaf) && (depth == 0)) {
+        if ((ret = fsm_route_action_add(def, lca->entry_action)) < 0) return -1;
+        route->num_entry += ret;
+    }
+    return 0;
+}
+
+static void fsm_state_ids_track(fsm_state_t *state, int *max_id)
+{
+    // Walks up the hierarchy and down the default substates
+    for (fsm_state_t* s = state; s != NULL; s = s->parent) {
+        if (s->state_id > *max_id) *max_id = s->state_id;
+    }
+    for (fsm_state_t* s = state; s != NULL; s = s->default_substate) {
+        if (s->state_id > *max_id) *max_id = s->state_id;
+    }
+}
+
+static int fsm_dispatch_table_init(fsm_def_t *def, fsm_state_t *initial_state)
+{
+    int max_state = 0;
+    uint32_t max_event = 0;
+
+    // States are declared in an array indexed by id
+    def->states = initial_state - initial_state->state_id;
+
+    fsm_state_ids_track(initial_state, &max_state);
+    for (size_t j = 1; j <= def->num_transitions; j++)
+    {
+        fsm_state_ids_track(def->transitions[j].source_state, &max_state);
+        fsm_state_ids_track(def->transitions[j].target_state, &max_state);
+        if (def->transitions[j].event > max_event) max_event = def->transitions[j].event;
+    }
+
+    if (max_state > FSM_MAX_STATES || max_event >= (FSM_MAX_EVENTS + FSM_EV_FIRST)) return -4;
+
+    def->num_states    = max_state + 1;
+    def->num_event_ids = max_event + 1;
+
+    memset(def->dispatch_table, 0, sizeof(def->dispatch_table));
+    def->num_route_actions = 0;
+
+    // Route 0 enters the initial state
+    if (fsm_route_build(def, &def->routes[0], initial_state, initial_state, NULL) != 0) return -4;
+    def->num_routes = 1;
+
+    // For every state, the closest ancestor handling an event wins
+    for (int id = FSM_ST_FIRST; id <= max_state; id++)
+    {
+        fsm_index_t *row = &def->dispatch_table[id * def->num_event_ids];
+
+        // States with a default substate never stay active
+        if ((def->states[id].state_id != id) || (def->states[id].default_substate != NULL)) continue;
+
+        for (fsm_state_t* s = &def->states[id]; s != NULL; s = s->parent)
+        {
+            for (size_t j = 1; j <= def->num_transitions; j++)
+            {
+                const fsm_transition_t *t = &def->transitions[j];
+
+                if ((t->source_state != s) || (row[t->event] != 0)) continue;
+                if (def->num_routes >= FSM_MAX_ROUTES) return -4;
+                if (fsm_route_build(def, &def->routes[def->num_routes], &def->states[id], t->target_state, t->transition_action) != 0) return -4;
+
+                row[t->event] = def->num_routes++;
+            }
+        }
+    }
+    return 0;
+}
+
+int fsm_def_init(fsm_def_t *def, const fsm_transition_t *transitions, size_t num_transitions, size_t num_events, fsm_state_t* initial_state)
+{
+    if(def == NULL || transitions == NULL || initial_state == NULL) return -1;
+    if(num_transitions == 0) return -2;
+
+    def->transitions     = transitions;
+    def->num_transitions = num_transitions;
+    def->num_events      = num_events;
+    def->initial_state   = initial_state;
+    def->dispatch        = NULL;
+
+    if (fsm_dispatch_table_init(def, initial_state) != 0)
+    {
+        // Not usable by any fsm
+        def->num_transitions = 0;
+        return -4;
+    }
+    return 0;
+}
+
+// Definition compiled by fsm_init, shared by the fsm initialized with the same table
+typedef struct fsm_def_node_t {
+    struct fsm_def_node_t *next;
+    // Instances using it, freed with the last one
+    uint32_t refs;
+    // Contents of the table it was compiled from
+    uint32_t print;
+    fsm_def_t def;
+} fsm_def_node_t;
+
+static fsm_def_node_t *fsm_defs;
+
+// Only the list is touched while locked, the definitions are compiled and freed outside
+#if defined(FREERTOS_API) && defined(ESP_PLATFORM)
+static portMUX_TYPE fsm_defs_lock = portMUX_INITIALIZER_UNLOCKED;
+#define FSM_DEFS_LOCK()     taskENTER_CRITICAL(&fsm_defs_lock)
+#define FSM_DEFS_UNLOCK()   taskEXIT_CRITICAL(&fsm_defs_lock)
+#elif defined(FREERTOS_API)
+#define FSM_DEFS_LOCK()     taskENTER_CRITICAL()
+#define FSM_DEFS_UNLOCK()   taskEXIT_CRITICAL()
+#elif defined(__unix__) || defined(__APPLE__)
+static pthread_mutex_t fsm_defs_lock = PTHREAD_MUTEX_INITIALIZER;
+#define FSM_DEFS_LOCK()     pthread_mutex_lock(&fsm_defs_lock)
+#define FSM_DEFS_UNLOCK()   pthread_mutex_unlock(&fsm_defs_lock)
+#else
+// Bare metal, fsm_init and fsm_deinit run on one thread
+#define FSM_DEFS_LOCK()
+#define FSM_DEFS_UNLOCK()
+#endif
+
+static uint32_t fsm_print_add(uint32_t hash, const void *data, size_t n)
+{
+    const uint8_t *bytes = data;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// FNV-1a of everything the definition is compiled from, a table rebuilt at the same address gets a new one
+static uint32_t fsm_def_print(const fsm_transition_t *transitions, size_t num_transitions, fsm_state_t* initial_state)
+{
+    fsm_state_t *states = initial_state - initial_state->state_id;
+    uint32_t hash = 2166136261u;
+    int max_state = 0;
+
+    fsm_state_ids_track(initial_state, &max_state);
+    for (size_t j = 1; j <= num_transitions; j++)
+    {
+        hash = fsm_print_add(hash, &transitions[j].source_state, sizeof(transitions[j].source_state));
+        hash = fsm_print_add(hash, &transitions[j].event, sizeof(transitions[j].event));
+        hash = fsm_print_add(hash, &transitions[j].target_state, sizeof(transitions[j].target_state));
+        hash = fsm_print_add(hash, &transitions[j].transition_action, sizeof(transitions[j].transition_action));
+        fsm_state_ids_track(transitions[j].source_state, &max_state);
+        fsm_state_ids_track(transitions[j].target_state, &max_state);
+    }
+    // Timeouts and run actions are read from the states at run time
+    for (int id = 0; id <= max_state; id++)
+    {
+        hash = fsm_print_add(hash, &states[id].state_id, sizeof(states[id].state_id));
+        hash = fsm_print_add(hash, &states[id].parent, sizeof(states[id].parent));
+        hash = fsm_print_add(hash, &states[id].default_substate, sizeof(states[id].default_substate));
+        hash = fsm_print_add(hash, &states[id].entry_action, sizeof(states[id].entry_action));
+        hash = fsm_print_add(hash, &states[id].exit_action, sizeof(states[id].exit_action));
+    }
+    return hash;
+}
+
+// Node of a definition of the list, NULL for the ones compiled by the caller. Call it locked
+static fsm_def_node_t *fsm_def_node(const fsm_def_t *def)
+{
+    for (fsm_def_node_t *node = fsm_defs; node != NULL; node = node->next)
+    {
+        if (&node->def == def) return node;
+    }
+    return NULL;
+}
+
+// Reuses the definition of the same table and takes a reference. Call it locked
+static const fsm_def_t *fsm_def_find(const fsm_transition_t *transitions, size_t num_transitions, size_t num_events, fsm_state_t* initial_state, uint32_t print)
+{
+    for (fsm_def_node_t *node = fsm_defs; node != NULL; node = node->next)
+    {
+        const fsm_def_t *def = &node->def;
+
+        if ((def->transitions == transitions) && (def->num_transitions == num_transitions) &&
+            (def->num_events == num_events) && (def->initial_state == initial_state) && (node->print == print))
+        {
+            node->refs++;
+            return def;
+        }
+    }
+    return NULL;
+}
+
+static const fsm_def_t *fsm_def_get(const fsm_transition_t *transitions, size_t num_transitions, size_t num_events, fsm_state_t* initial_state)
+{
+    uint32_t print = fsm_def_print(transitions, num_transitions, initial_state);
+    const fsm_def_t *found;
+    fsm_def_node_t *node;
+
+    FSM_DEFS_LOCK();
+    found = fsm_def_find(transitions, num_transitions, num_events, initial_state, print);
+    FSM_DEFS_UNLOCK();
+    if (found != NULL) return found;
+
+    // Or compiles it
+    node = FSM_DEF_ALLOC(sizeof(*node));
+    if (node == NULL) return NULL;
+    if (fsm_def_init(&node->def, transitions, num_transitions, num_events, initial_state) != 0)
+    {
+        FSM_DEF_FREE(node);
+        return NULL;
+    }
+    node->refs  = 1;
+    node->print = print;
+
+    // Another thread may have compiled the same table meanwhile
+    FSM_DEFS_LOCK();
+    found = fsm_def_find(transitions, num_transitions, num_events, initial_state, print);
+    if (found == NULL)
+    {
+        node->next = fsm_defs;
+        fsm_defs = node;
+        found = &node->def;
+    }
+    FSM_DEFS_UNLOCK();
+
+    if (found != &node->def) FSM_DEF_FREE(node);
+    return found;
+}
+
+// Drops the reference of an instance, definitions compiled by the caller are not in the list
+static void fsm_def_put(const fsm_def_t *def)
+{
+    fsm_def_node_t *node, **link;
+
+    FSM_DEFS_LOCK();
+    node = fsm_def_node(def);
+    if ((node != NULL) && (--node->refs == 0))
+    {
+        for (link = &fsm_defs; *link != node; link = &(*link)->next);
+        *link = node->next;
+    }
+    else node = NULL;
+    FSM_DEFS_UNLOCK();
+
+    if (node != NULL) FSM_DEF_FREE(node);
+}
+
+// Takes a reference for an instance of a definition that is already in use
+static void fsm_def_retain(const fsm_def_t *def)
+{
+    fsm_def_node_t *node;
+
+    FSM_DEFS_LOCK();
+    node = fsm_def_node(def);
+    if (node != NULL) node->refs++;
+    FSM_DEFS_UNLOCK();
+}
+
+static int fsm_start(fsm_t *fsm, const fsm_def_t *def, uint32_t time_period_ticks, void *initial_data, const fsm_config_t *config);
+
+int fsm_init(fsm_t *fsm, const fsm_transition_t *transitions, size_t num_transitions, size_t num_events, uint32_t time_period_ticks, fsm_state_t* initial_state, void *initial_data) {
+    return fsm_init_ex(fsm, transitions, num_transitions, num_events, time_period_ticks, initial_state, initial_data, NULL);
+}
+
+int fsm_init_ex(fsm_t *fsm, const fsm_transition_t *transitions, size_t num_transitions, size_t num_events, uint32_t time_period_ticks, fsm_state_t* initial_state, void *initial_data, const fsm_config_t *config) {
+    const fsm_def_t *def;
+
+    if(fsm == NULL || transitions == NULL || initial_state == NULL) return -1;
+    if(num_transitions == 0) return -2;
+
+    def = fsm_def_get(transitions, num_transitions, num_events, initial_state);
+    if(def == NULL) return -4;
+
+    // The reference of fsm_def_get goes to the instance
+    int ret = fsm_start(fsm, def, time_period_ticks, initial_data, config);
+    if (ret != 0) fsm_def_put(def);
+
+    return ret;
+}
+
+// Everything but entering the initial state
+static int fsm_instance_init(fsm_t *fsm, const fsm_def_t *def, uint32_t time_period_ticks, void *initial_data, const fsm_config_t *config) {
+    static const fsm_config_t default_config = {0};
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+
+    if(fsm == NULL || def == NULL) return -1;
+    if(def->num_transitions == 0) return -2;
+    if(config == NULL) config = &default_config;
+
+    fsm->def                 = def;
+    fsm->terminate_val       = 0;   
+    internal->terminate      = false;
+    internal->is_exit        = false;
+    internal->flushed        = false;
+    fsm->current_data        = initial_data;
+    fsm->fsm_ms_ticks        = time_period_ticks;
+    fsm->t_elapsed           = 0;
+    
+#ifdef FSM_COMPACT
+    fsm->actors              = config->actors;
+    fsm->ext                 = config->ext;
+    if (fsm->ext == NULL) return -3;
+#endif
+    fsm_actors_t *actors     = FSM_ACTORS(fsm);
+    fsm_ext_t *ext           = FSM_EXT(fsm);
+    if (actors != NULL) memset(actors, 0, sizeof(*actors));
+    memset(&ext->timer, 0, sizeof(ext->timer));
+    ext->clock               = NULL;
+    ext->deadline            = FSM_NO_DEADLINE;
+#ifdef FSM_EXEC
+    ext->exec                = NULL;
+    ext->exec_next           = NULL;
+    ext->exec_pending        = 0;
+#endif
+#ifdef FSM_LATENCY_STATS
+    ext->latency             = NULL;
+    ext->timeout_enqueued    = 0;
+#endif
+#ifdef FSM_TRACE
+    ext->trace               = NULL;
+    ext->trace_id            = 0;
+#endif
+
+    if (fsm_queue_init(fsm, config) != 0) return -3;
+
+    if (config->timer == FSM_TIMER_DEADLINE)
+    {
+        ext->clock = (config->clock != NULL) ? config->clock : FSM_CLOCK_DEFAULT;
+        if (ext->clock == NULL) return -5;
+    }
+
+    fsm->state_id = def->initial_state->state_id;
+    return 0;
+}
+
+// Inits the instance and enters the initial state
+static int fsm_start(fsm_t *fsm, const fsm_def_t *def, uint32_t time_period_ticks, void *initial_data, const fsm_config_t *config) {
+    int ret = fsm_instance_init(fsm, def, time_period_ticks, initial_data, config);
+
+    if (ret != 0) return ret;
+
+    fsm_route_fire(fsm, &def->routes[0], 0, initial_data);
+    if (FSM_EXT(fsm)->clock) fsm_deadline_arm(fsm);
+
+    return 0;
+}
+
+int fsm_init_def(fsm_t *fsm, const fsm_def_t *def, uint32_t time_period_ticks, void *initial_data, const fsm_config_t *config) {
+    int ret = fsm_start(fsm, def, time_period_ticks, initial_data, config);
+
+    // A definition of the pool, taken from another instance, stays until fsm_deinit of both
+    if (ret == 0) fsm_def_retain(def);
+    return ret;
+}
+
+static fsm_action_t fsm_actor_action_get(const struct fsm_actor_t *actor, enum fsm_action_e kind)
+{
+    switch (kind)
+    {
+    case ACTION_ENTRY:  return actor->entry_action;
+    case ACTION_RUN:    return actor->run_action;
+    default:            return actor->exit_action;
+    }
+}
+
+static int fsm_actor_index_build(fsm_t *fsm)
+{
+    fsm_actors_t *actors = FSM_ACTORS(fsm);
+    uint16_t fill[FSM_MAX_STATES+1][ACTION_EXIT+1];
+    uint16_t first = 0;
+
+    memset(actors->index, 0, sizeof(actors->index));
+
+    // Counts the actions of every state
+    for (size_t i = 0; ((i < FSM_MAX_ACTORS) && (actors->table[i].actor != NULL)); i++)
+    {
+        for (int j = FSM_ACTOR_FIRST; j < actors->table[i].len; j++)
+        {
+            const struct fsm_actor_t *actor = &actors->table[i].actor[j];
+
+            if ((actor->state_id < FSM_ST_FIRST) || (actor->state_id >= fsm->def->num_states)) continue;
+            for (int k = ACTION_ENTRY; k <= ACTION_EXIT; k++)
+            {
+                if (fsm_actor_action_get(actor, k) != NULL) actors->index[actor->state_id].num[k]++;
+            }
+        }
+    }
+
+    // Reserves a contiguous slice per state: entry, run and exit actions
+    for (int id = 0; id < fsm->def->num_states; id++)
+    {
+        fsm_actor_index_t *index = &actors->index[id];
+
+        index->first = first;
+        for (int k = ACTION_ENTRY; k <= ACTION_EXIT; k++)
+        {
+            fill[id][k] = first;
+            first += index->num[k];
+        }
+    }
+    if (first > FSM_MAX_ACTOR_ACTIONS) return -1;
+
+    // Fills the slices keeping the link order
+    for (size_t i = 0; ((i < FSM_MAX_ACTORS) && (actors->table[i].actor != NULL)); i++)
+    {
+        for (int j = FSM_ACTOR_FIRST; j < actors->table[i].len; j++)
+        {
+            const struct fsm_actor_t *actor = &actors->table[i].actor[j];
+
+            if ((actor->state_id < FSM_ST_FIRST) || (actor->state_id >= fsm->def->num_states)) continue;
+            for (int k = ACTION_ENTRY; k <= ACTION_EXIT; k++)
+            {
+                fsm_action_t action = fsm_actor_action_get(actor, k);
+
+                if (action != NULL) actors->actions[fill[actor->state_id][k]++] = action;
+            }
+        }
+    }
+    return 0;
+}
+
+int fsm_actor_link(fsm_t *fsm, struct fsm_actor_t *actor, int size) {
+    
+    if(fsm == NULL || actor == NULL) return -1;
+
+    fsm_actors_t *actors = FSM_ACTORS(fsm);
+
+    // No storage given to a compact fsm
+    if(actors == NULL) return -2;
+
+    for (uint16_t i = 0; i < FSM_MAX_ACTORS; i++)
+    {
+        // Search empty spot
+        if(actors->table[i].len == 0)
+        {
+            actors->table[i].actor = actor;
+            actors->table[i].len = size;
+
+            if (fsm_actor_index_build(fsm) != 0)
+            {
+                // Actor does not fit in the index, unlink it
+                actors->table[i].actor = NULL;
+                actors->table[i].len = 0;
+                fsm_actor_index_build(fsm);
+                return -3;
+            }
+            return 0;
+        }
+    }
+    return -2;
+}
+
+int fsm_timed_event_set(fsm_state_t *state, uint32_t ticks)
+{
+    if(state == NULL) return -1;
+
+    state->t_period = ticks;
+
+    return 0;
+}
+
+// Turns a coalesced event into its marker, unless one is already pending
+static inline int fsm_coalesce_mark(fsm_t *fsm, struct fsm_events_t *event) {
+    uint32_t slot;
+
+    for (slot = 0; (slot < FSM_EXT(fsm)->num_coalesce) && (FSM_EXT(fsm)->coalesce[slot].event != event->event); slot++);
+    if (slot == FSM_EXT(fsm)->num_coalesce) return FSM_DISPATCH_OK;
+
+    if (FSM_EXT(fsm)->coalesce[slot].mode == FSM_COALESCE_LATEST)
+    {
+        __atomic_store_n(&FSM_EXT(fsm)->coalesce[slot].data, event->data, __ATOMIC_RELAXED);
+    }
+    // Still pending, the queued event takes this one
+    if (__atomic_fetch_add(&FSM_EXT(fsm)->coalesce[slot].count, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+        fsm_stats_count(fsm, FSM_DISPATCH_COALESCED);
+        return FSM_DISPATCH_COALESCED;
+    }
+    event->event = FSM_EV_COALESCED | slot;
+    return FSM_DISPATCH_OK;
+}
+
+static inline bool fsm_coalesce_has(fsm_t *fsm, uint32_t event) {
+    for (uint32_t slot = 0; slot < FSM_EXT(fsm)->num_coalesce; slot++)
+    {
+        if (FSM_EXT(fsm)->coalesce[slot].event == event) return true;
+    }
+    return false;
+}
+
+static inline bool fsm_event_has_payload(const struct fsm_events_t *event) {
+#if FSM_INLINE_PAYLOAD > 0
+    return event->payload_len > 0;
+#else
+    (void)event;
+    return false;
+#endif
+}
+
+static inline uint32_t fsm_event_prio(fsm_t *fsm, uint32_t event) {
+#if FSM_PRIO_LANES > 1
+    if (event < FSM_EXT(fsm)->num_priorities) return FSM_EXT(fsm)->priorities[event];
+#endif
+    return FSM_PRIO_NORMAL;
+}
+
+static inline void fsm_event_stamp(fsm_t *fsm, struct fsm_events_t *event) {
+#ifdef FSM_LATENCY_STATS
+    if (__atomic_load_n(&FSM_EXT(fsm)->latency, __ATOMIC_RELAXED)) event->enqueued = fsm_trace_cycles();
+#endif
+}
+
+static inline int fsm_dispatch_enqueue(fsm_t *fsm, struct fsm_events_t *event, uint32_t prio) {
+    int status = fsm_queue_put_prio(fsm, event, prio);
+    if (status < FSM_DISPATCH_OK) fsm_event_drop(fsm, event);
+
+    fsm_stats_count(fsm, status);
+    if (status >= FSM_DISPATCH_OK) fsm_stats_watermark(fsm, fsm_queue_num(fsm));
+
+    return status;
+}
+
+static inline int fsm_dispatch_put(fsm_t *fsm, struct fsm_events_t *event, uint32_t prio) {
+    int status = fsm_dispatch_enqueue(fsm, event, prio);
+
+    if (status >= FSM_DISPATCH_OK) fsm_notify(fsm);
+
+    return status;
+}
+
+static inline int fsm_dispatch_lane(fsm_t *fsm, uint32_t event, void *data, uint32_t prio) {
+
+    if(!fsm_has_queue(fsm)) return FSM_DISPATCH_INVALID;
+
+    struct fsm_events_t new_event = {event, data};
+    fsm_event_stamp(fsm, &new_event);
+
+    if ((FSM_EXT(fsm)->num_coalesce > 0) && (fsm_coalesce_mark(fsm, &new_event) == FSM_DISPATCH_COALESCED)) return FSM_DISPATCH_COALESCED;
+
+    return fsm_dispatch_put(fsm, &new_event, prio);
+}
+
+int fsm_dispatch(fsm_t *fsm, uint32_t event, void *data) {
+
+    if(fsm == NULL) return FSM_DISPATCH_INVALID;
+
+    return fsm_dispatch_lane(fsm, event, data, fsm_event_prio(fsm, event));
+}
+
+int fsm_dispatch_prio(fsm_t *fsm, uint32_t event, void *data, uint32_t prio) {
+
+    if(fsm == NULL) return FSM_DISPATCH_INVALID;
+
+    return fsm_dispatch_lane(fsm, event, data, prio);
+}
+
+int fsm_dispatch_copy(fsm_t *fsm, uint32_t event, const void *payload, size_t size) {
+
+    if((fsm == NULL) || !fsm_has_queue(fsm)) return FSM_DISPATCH_INVALID;
+
+#if FSM_INLINE_PAYLOAD > 0
+    struct fsm_events_t new_event = {event, NULL};
+
+    if ((size > FSM_INLINE_PAYLOAD) || ((payload == NULL) && (size > 0))) return FSM_DISPATCH_INVALID;
+
+    new_event.payload_len = (uint32_t)size;
+    if (size > 0) memcpy(new_event.payload, payload, size);
+    fsm_event_stamp(fsm, &new_event);
+
+    return fsm_dispatch_put(fsm, &new_event, fsm_event_prio(fsm, event));
+#else
+    (void)event;
+    (void)payload;
+    (void)size;
+    return FSM_DISPATCH_INVALID;
+#endif
+}
+
+int fsm_dispatch_pooled(fsm_t *fsm, uint32_t event, void *payload) {
+
+    if((fsm == NULL) || !fsm_has_queue(fsm) || (payload == NULL) || (event & (FSM_EV_COALESCED | FSM_EV_POOLED))) return FSM_DISPATCH_INVALID;
+
+    struct fsm_events_t new_event = {event | FSM_EV_POOLED, payload};
+    fsm_event_stamp(fsm, &new_event);
+
+    // The queue holds a reference until the event is handled or dropped
+    fsm_pool_retain(payload);
+    return fsm_dispatch_put(fsm, &new_event, fsm_event_prio(fsm, event));
+}
+
+int fsm_dispatch_many(fsm_t *const *fsms, size_t num, uint32_t event, void *data) {
+#ifdef FSM_EXEC
+    fsm_t *woken[FSM_EVENTS_BATCH];
+    uint32_t num_woken = 0;
+#endif
+    int accepted = 0;
+
+    if((fsms == NULL) && (num > 0)) return FSM_DISPATCH_INVALID;
+
+    for (size_t i = 0; i < num; i++)
+    {
+        fsm_t *fsm = fsms[i];
+        struct fsm_events_t new_event = {event, data};
+
+        if((fsm == NULL) || !fsm_has_queue(fsm)) continue;
+
+        fsm_event_stamp(fsm, &new_event);
+        if ((FSM_EXT(fsm)->num_coalesce > 0) && (fsm_coalesce_mark(fsm, &new_event) == FSM_DISPATCH_COALESCED))
+        {
+            accepted++;
+            continue;
+        }
+        if (fsm_dispatch_enqueue(fsm, &new_event, fsm_event_prio(fsm, event)) < FSM_DISPATCH_OK) continue;
+        accepted++;
+
+        fsm_event_fd_signal(fsm);
+#ifdef FSM_EXEC
+        // The executor gets the runnable fsm together
+        if (FSM_EXT(fsm)->exec == NULL) continue;
+        woken[num_woken++] = fsm;
+        if (num_woken == FSM_EVENTS_BATCH)
+        {
+            fsm_exec_notify_n(woken, num_woken);
+            num_woken = 0;
+        }
+#endif
+    }
+#ifdef FSM_EXEC
+    if (num_woken > 0) fsm_exec_notify_n(woken, num_woken);
+#endif
+
+    return accepted;
+}
+
+int fsm_dispatch_batch(fsm_t *fsm, const struct fsm_events_t *evs, size_t n) {
+    struct fsm_events_t batch[FSM_EVENTS_BATCH];
+    uint32_t num = 0;
+    int accepted = 0;
+    bool rejected = false;
+
+    if((fsm == NULL) || !fsm_has_queue(fsm) || ((evs == NULL) && (n > 0))) return FSM_DISPATCH_INVALID;
+
+#ifdef FSM_LATENCY_STATS
+    // One stamp for the whole batch
+    uint64_t enqueued = __atomic_load_n(&FSM_EXT(fsm)->latency, __ATOMIC_RELAXED) ? fsm_trace_cycles() : 0;
+#endif
+
+    for (size_t i = 0; (i < n) && !rejected; i++)
+    {
+        struct fsm_events_t new_event = {evs[i].event, evs[i].data};
+        uint32_t prio;
+#ifdef FSM_LATENCY_STATS
+        new_event.enqueued = enqueued;
+#endif
+#if FSM_INLINE_PAYLOAD > 0
+        if (evs[i].payload_len > FSM_INLINE_PAYLOAD)
+        {
+            fsm_stats_count(fsm, FSM_DISPATCH_REJECTED);
+            break;
+        }
+        new_event.payload_len = evs[i].payload_len;
+        memcpy(new_event.payload, evs[i].payload, new_event.payload_len);
+#endif
+        prio = fsm_event_prio(fsm, evs[i].event);
+
+        // A merge can not be undone, the events before it are queued first.
+        // The priority lanes are not batched, the same goes for them
+        if ((num > 0) && ((prio > FSM_PRIO_NORMAL) || ((FSM_EXT(fsm)->num_coalesce > 0) && fsm_coalesce_has(fsm, new_event.event))))
+        {
+            uint32_t put = fsm_queue_put_n(fsm, batch, num);
+
+            accepted += put;
+            rejected = (put < num);
+            num = 0;
+            if (rejected) break;
+        }
+
+        if ((FSM_EXT(fsm)->num_coalesce > 0) && !fsm_event_has_payload(&new_event) && (fsm_coalesce_mark(fsm, &new_event) == FSM_DISPATCH_COALESCED))
+        {
+            accepted++;
+            continue;
+        }
+        if (prio > FSM_PRIO_NORMAL)
+        {
+            int status = fsm_queue_put_prio(fsm, &new_event, prio);
+
+            fsm_stats_count(fsm, status);
+            if (status < FSM_DISPATCH_OK)
+            {
+                fsm_event_drop(fsm, &new_event);
+                break;
+            }
+            accepted++;
+            continue;
+        }
+
+        batch[num++] = new_event;
+        if (num == FSM_EVENTS_BATCH)
+        {
+            uint32_t put = fsm_queue_put_n(fsm, batch, num);
+
+            accepted += put;
+            rejected = (put < num);
+            num = 0;
+        }
+    }
+    if (!rejected) accepted += fsm_queue_put_n(fsm, batch, num);
+
+    // A single wake up for the whole batch
+    if (accepted > 0)
+    {
+        fsm_stats_watermark(fsm, fsm_queue_num(fsm));
+        fsm_notify(fsm);
+    }
+
+    return accepted;
+}
+
+int fsm_stats_get(fsm_t *fsm, fsm_stats_t *stats)
+{
+    if(fsm == NULL || stats == NULL) return -1;
+
+    stats->processed      = __atomic_load_n(&FSM_EXT(fsm)->stats.processed, __ATOMIC_RELAXED);
+    stats->dropped        = __atomic_load_n(&FSM_EXT(fsm)->stats.dropped, __ATOMIC_RELAXED);
+    stats->overwritten    = __atomic_load_n(&FSM_EXT(fsm)->stats.overwritten, __ATOMIC_RELAXED);
+    stats->spilled        = __atomic_load_n(&FSM_EXT(fsm)->stats.spilled, __ATOMIC_RELAXED);
+    stats->coalesced      = __atomic_load_n(&FSM_EXT(fsm)->stats.coalesced, __ATOMIC_RELAXED);
+    stats->high_watermark = __atomic_load_n(&FSM_EXT(fsm)->stats.high_watermark, __ATOMIC_RELAXED);
+    stats->pending        = fsm_queue_num(fsm);
+
+    return 0;
+}
+
+void fsm_stats_reset(fsm_t *fsm)
+{
+    if(fsm == NULL) return;
+
+    __atomic_store_n(&FSM_EXT(fsm)->stats.processed, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&FSM_EXT(fsm)->stats.dropped, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&FSM_EXT(fsm)->stats.overwritten, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&FSM_EXT(fsm)->stats.spilled, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&FSM_EXT(fsm)->stats.coalesced, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&FSM_EXT(fsm)->stats.high_watermark, 0, __ATOMIC_RELAXED);
+}
+
+// Handles up to max_events, and stops once the clock in ns passes deadline (0 for none)
+// Handles one event taken from the queue
+static void fsm_event_handle(fsm_t *fsm, const struct fsm_events_t *ev) {
+    const fsm_def_t *def = fsm->def;
+    int state_id = FSM_STATE(fsm)->state_id;
+    uint32_t event = ev->event;
+    void *data = ev->data;
+
+    if (event & FSM_EV_COALESCED) event = fsm_coalesce_take(fsm, event, &data);
+    else if (event & FSM_EV_POOLED) event &= ~FSM_EV_POOLED;
+#if FSM_INLINE_PAYLOAD > 0
+    // The copy taken from the queue lives until the batch is done
+    if (ev->payload_len > 0) data = (void *)ev->payload;
+#endif
+
+#ifdef FSM_LATENCY_STATS
+    fsm_latency_t *latency = __atomic_load_n(&FSM_EXT(fsm)->latency, __ATOMIC_ACQUIRE);
+
+    // Events queued before the histograms were attached have no stamp
+    if (latency && ev->enqueued) {
+        fsm_latency_record(latency, event, fsm_trace_cycles() - ev->enqueued);
+    }
+#endif
+    if (def->dispatch)
+    {
+        def->dispatch(fsm, event, data);
+    }else if (event < def->num_event_ids)
+    {
+        fsm_index_t idx = def->dispatch_table[state_id * def->num_event_ids + event];
+        if (idx) fsm_route_fire(fsm, &def->routes[idx], event, data);
+    }
+    FSM_EXT(fsm)->event_count = 1;
+    if (ev->event & FSM_EV_POOLED) fsm_pool_release(data);
+}
+
+#if !defined(FREERTOS_API) && (FSM_PRIO_LANES > 1)
+// Handles the priority events queued while a batch is handled, false when an action terminated the fsm or flushed its queue
+static bool fsm_process_prio(fsm_t *fsm, uint32_t *max_events) {
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+    struct fsm_events_t prio[FSM_EVENTS_BATCH];
+    uint32_t num;
+
+    while ((*max_events > 0) && ((num = fsm_queue_get_prio(fsm, prio, (FSM_EVENTS_BATCH < *max_events) ? FSM_EVENTS_BATCH : *max_events)) > 0)) {
+        fsm_stats_processed(fsm, num);
+        *max_events -= num;
+
+        for (uint32_t i = 0; i < num; i++) {
+            fsm_event_handle(fsm, &prio[i]);
+            if (internal->terminate || internal->flushed) {
+                fsm_events_discard(fsm, &prio[i + 1], num - i - 1);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+#endif
+
+static int fsm_process_events(fsm_t *fsm, uint32_t max_events, uint64_t deadline) {
+    
+    if(fsm == NULL) return -1;
+    if(!fsm_has_queue(fsm)) return -2;
+
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+
+    struct fsm_events_t batch[FSM_EVENTS_BATCH];
+    uint32_t num, num_prio, max = FSM_EVENTS_BATCH;
+
+#ifdef FSM_POSIX_API
+    // The eventfd is drained before the flag is cleared, a producer that still
+    // sees it set queued its event before and the batch below takes it. A failed
+    // read means the write of the producer that set it is still coming, the flag
+    // stays set and the next run drains it
+    if (__atomic_load_n(&FSM_EXT(fsm)->event_signaled, __ATOMIC_ACQUIRE))
+    {
+        uint64_t count;
+
+        if (read(FSM_EXT(fsm)->event_fd, &count, sizeof(count)) == sizeof(count))
+        {
+            // Events dispatched from now on signal the eventfd again
+            __atomic_exchange_n(&FSM_EXT(fsm)->event_signaled, 0, __ATOMIC_SEQ_CST);
+        }
+    }
+#endif
+
+    // Events taken from the queue are handled, with a deadline only one at a time is taken
+    if (deadline) max = 1;
+
+    while ((max_events > 0) && ((num = fsm_queue_get_n(fsm, batch, (max < max_events) ? max : max_events, &num_prio)) > 0)) {
+        internal->flushed = false;
+        max_events -= num;
+
+        for (uint32_t i = 0; i < num; i++) {
+#if !defined(FREERTOS_API) && (FSM_PRIO_LANES > 1)
+            // A priority event queued since the batch was taken goes before its normal events
+            if ((i > 0) && (i >= num_prio) && __atomic_load_n(&FSM_EXT(fsm)->prio_pending, __ATOMIC_RELAXED) && !fsm_process_prio(fsm, &max_events)) {
+                fsm_events_discard(fsm, &batch[i], num - i);
+                if (internal->terminate) return fsm->terminate_val;
+                break;
+            }
+#endif
+            fsm_event_handle(fsm, &batch[i]);
+
+            if (internal->terminate) {
+                fsm_events_discard(fsm, &batch[i + 1], num - i - 1);
+                return fsm->terminate_val;
+            }
+            /* Events of the batch were flushed by an action */
+            if (internal->flushed) {
+                fsm_events_discard(fsm, &batch[i + 1], num - i - 1);
+                break;
+            }
+        }
+        if (deadline && (fsm_trace_ns() >= deadline)) break;
+    }
+    return 0;
+}
+
+int fsm_run(fsm_t *fsm)
+{
+    if(fsm == NULL) return -1;
+
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+
+    /* No need to continue if terminate was set */
+	if (internal->terminate) {
+		return fsm->terminate_val;
+	}
+    
+    fsm_process_events(fsm, UINT32_MAX, 0);
+
+    // Run state
+    if (FSM_STATE(fsm)->run_action) {
+        FSM_STATE(fsm)->run_action(fsm, fsm->current_data);
+    }
+
+    // Actors
+    fsm_actors_notify(fsm, FSM_STATE(fsm)->state_id, ACTION_RUN, fsm->current_data);
+    return 0;
+}
+
+int fsm_run_budget(fsm_t *fsm, uint32_t max_events, uint64_t max_ns)
+{
+    if(fsm == NULL) return -1;
+
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+    uint64_t deadline = 0;
+
+    if (internal->terminate) return 0;
+
+    if (max_ns > 0) deadline = fsm_trace_ns() + max_ns;
+    fsm_process_events(fsm, (max_events > 0) ? max_events : UINT32_MAX, deadline);
+
+    // Run state
+    if (FSM_STATE(fsm)->run_action) {
+        FSM_STATE(fsm)->run_action(fsm, fsm->current_data);
+    }
+
+    // Actors
+    fsm_actors_notify(fsm, FSM_STATE(fsm)->state_id, ACTION_RUN, fsm->current_data);
+
+    if (internal->terminate || !fsm_has_queue(fsm) || (fsm_queue_num(fsm) == 0)) return 0;
+
+    // Left for the next run, the eventfd and the executor see it again
+    fsm_notify(fsm);
+    return 1;
+}
+
+void fsm_deinit(fsm_t *fsm)
+{
+    if(fsm == NULL) return;
+
+#ifdef FSM_EXEC
+    // No worker runs it from now on
+    fsm_exec_remove(fsm);
+#endif
+    fsm_wheel_detach(fsm);
+    // Pooled payloads still queued go back to their pool
+    if (fsm->def) fsm_queue_flush(fsm);
+#ifdef FREERTOS_API
+    if (FSM_EXT(fsm)->event_queue) vQueueDelete(FSM_EXT(fsm)->event_queue);
+    FSM_EXT(fsm)->event_queue = NULL;
+#endif
+#ifdef FSM_POSIX_API
+    if (FSM_EXT(fsm)->event_fd >= 0) close(FSM_EXT(fsm)->event_fd);
+    FSM_EXT(fsm)->event_fd = -1;
+#endif
+    // The definition compiled by fsm_init is freed with its last instance
+    if (fsm->def) fsm_def_put(fsm->def);
+    fsm->def = NULL;
+}
+
+// Snapshot record: version and flags bytes, then LEB128 varints
+#define FSM_SNAP_TERMINATED     0x01
+#define FSM_SNAP_TIMER_ARMED    0x02
+// Low bits of the event keys, the id goes above them
+#define FSM_SNAP_EV_LANE        0x01
+#define FSM_SNAP_EV_PAYLOAD     0x02
+#define FSM_SNAP_EV_SHIFT       2
+
+typedef struct {
+    uint8_t *buff;
+    size_t len;
+    // Bytes needed so far, past len once the record does not fit
+    size_t pos;
+} fsm_snap_writer_t;
+
+typedef struct {
+    const uint8_t *buff;
+    size_t len;
+    size_t pos;
+} fsm_snap_reader_t;
+
+static void fsm_snap_put(fsm_snap_writer_t *w, uint64_t value)
+{
+    do {
+        uint8_t byte = value & 0x7f;
+
+        value >>= 7;
+        if (value) byte |= 0x80;
+        if (w->pos < w->len) w->buff[w->pos] = byte;
+        w->pos++;
+    } while (value);
+}
+
+static void fsm_snap_put_bytes(fsm_snap_writer_t *w, const void *data, size_t n)
+{
+    if (w->pos + n <= w->len) memcpy(&w->buff[w->pos], data, n);
+    w->pos += n;
+}
+
+static int fsm_snap_get(fsm_snap_reader_t *r, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (r->pos >= r->len) return -1;
+
+        uint8_t byte = r->buff[r->pos++];
+
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 0;
+    }
+    return -1;
+}
+
+// Time spent in the current state in the unit of its period, false when no timeout is armed
+static bool fsm_snap_timer(fsm_t *fsm, uint32_t *elapsed)
+{
+    uint32_t period = FSM_STATE(fsm)->t_period;
+    uint64_t remaining = 0;
+
+    if (FSM_EXT(fsm)->timer.wheel)
+    {
+        remaining = fsm_wheel_timer_remaining(&FSM_EXT(fsm)->timer);
+        if (remaining == 0) return false;
+    }else if (FSM_EXT(fsm)->clock)
+    {
+        uint64_t now = FSM_EXT(fsm)->clock();
+
+        if (FSM_EXT(fsm)->deadline == FSM_NO_DEADLINE) return false;
+        // Due but not expired yet, it fires right after the restore
+        if (FSM_EXT(fsm)->deadline > now) remaining = FSM_EXT(fsm)->deadline - now;
+    }else
+    {
+        *elapsed = fsm->t_elapsed;
+        return (period > 0) && (fsm->t_elapsed < period);
+    }
+    *elapsed = (remaining < period) ? period - (uint32_t)remaining : 0;
+    return true;
+}
+
+static void fsm_snap_event(fsm_t *fsm, fsm_snap_writer_t *w, const struct fsm_events_t *event, uint32_t prio)
+{
+    uint32_t id = event->event;
+    uint64_t key;
+
+    // Markers are saved as the event they stand for
+    if (id & FSM_EV_COALESCED) id = FSM_EXT(fsm)->coalesce[id & ~FSM_EV_COALESCED].event;
+    else id &= ~FSM_EV_POOLED;
+
+    key = (uint64_t)id << FSM_SNAP_EV_SHIFT;
+    if (prio > FSM_PRIO_NORMAL) key |= FSM_SNAP_EV_LANE;
+    if (fsm_event_has_payload(event)) key |= FSM_SNAP_EV_PAYLOAD;
+
+    fsm_snap_put(w, key);
+    if (prio > FSM_PRIO_NORMAL) fsm_snap_put(w, prio);
+#if FSM_INLINE_PAYLOAD > 0
+    if (event->payload_len > 0)
+    {
+        fsm_snap_put(w, event->payload_len);
+        fsm_snap_put_bytes(w, event->payload, event->payload_len);
+    }
+#endif
+}
+
+#ifndef FREERTOS_API
+static void fsm_snap_lane(fsm_t *fsm, fsm_snap_writer_t *w, struct ringbuff *ring, struct mpsc_queue *mpsc, uint32_t prio)
+{
+    if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC)
+    {
+        struct fsm_events_t event;
+
+        for (uint32_t i = 0; mpsc_queue_peek(mpsc, i, &event) == 0; i++) fsm_snap_event(fsm, w, &event, prio);
+    }else
+    {
+        const struct fsm_events_t *event;
+
+        for (uint32_t i = 0; (event = fsm_ring_peek(ring, i)) != NULL; i++) fsm_snap_event(fsm, w, event, prio);
+    }
+}
+#endif
+
+// Pending events in the order fsm_run takes them, the queue is left as it is
+static void fsm_snap_queue(fsm_t *fsm, fsm_snap_writer_t *w)
+{
+#ifdef FREERTOS_API
+    struct fsm_events_t event;
+    UBaseType_t num;
+
+    // Every event goes back to the end, the queue ends up in the same order
+    vTaskSuspendAll();
+    num = uxQueueMessagesWaiting(FSM_EXT(fsm)->event_queue);
+    for (UBaseType_t i = 0; (i < num) && (xQueueReceive(FSM_EXT(fsm)->event_queue, &event, 0) == pdTRUE); i++)
+    {
+        fsm_snap_event(fsm, w, &event, FSM_PRIO_NORMAL);
+        xQueueSend(FSM_EXT(fsm)->event_queue, &event, 0);
+    }
+    xTaskResumeAll();
+#else
+#if FSM_PRIO_LANES > 1
+    for (uint32_t lane = FSM_EXT(fsm)->prio_lanes; lane-- > 0;)
+    {
+        fsm_snap_lane(fsm, w, &FSM_EXT(fsm)->prio_queue[lane].ring, &FSM_EXT(fsm)->prio_queue[lane].mpsc, lane + 1);
+    }
+#endif
+    if (FSM_EXT(fsm)->queue == FSM_QUEUE_MPSC)
+    {
+        if (__atomic_load_n(&FSM_EXT(fsm)->timeout_pending, __ATOMIC_ACQUIRE))
+        {
+            struct fsm_events_t timeout = {FSM_TIMEOUT_EV, NULL};
+
+            fsm_snap_event(fsm, w, &timeout, FSM_PRIO_NORMAL);
+        }
+        fsm_snap_lane(fsm, w, NULL, &FSM_EXT(fsm)->event_queue.mpsc, FSM_PRIO_NORMAL);
+        return;
+    }
+    fsm_snap_lane(fsm, w, &FSM_EXT(fsm)->event_queue.ring, NULL, FSM_PRIO_NORMAL);
+    if (FSM_EXT(fsm)->spill.len != 0) fsm_snap_lane(fsm, w, &FSM_EXT(fsm)->spill, NULL, FSM_PRIO_NORMAL);
+#endif
+}
+
+int fsm_snapshot(fsm_t *fsm, void *buff, size_t len)
+{
+    if(fsm == NULL || !fsm_has_queue(fsm) || buff == NULL) return -1;
+
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+    fsm_snap_writer_t w = {buff, len, 0};
+    uint32_t elapsed = 0;
+    uint8_t header[2] = {FSM_SNAPSHOT_VERSION, 0};
+
+    if (fsm_snap_timer(fsm, &elapsed)) header[1] |= FSM_SNAP_TIMER_ARMED;
+    if (internal->terminate) header[1] |= FSM_SNAP_TERMINATED;
+
+    fsm_snap_put_bytes(&w, header, sizeof(header));
+    fsm_snap_put(&w, FSM_STATE(fsm)->state_id);
+    fsm_snap_put(&w, elapsed);
+    // Zigzag, small negative values stay short
+    if (internal->terminate) fsm_snap_put(&w, ((uint32_t)fsm->terminate_val << 1) ^ (uint32_t)(fsm->terminate_val >> 31));
+    fsm_snap_queue(fsm, &w);
+
+    if (w.pos > w.len) return -2;
+    return (int)w.pos;
+}
+
+// Queues the events left in the record
+static int fsm_restore_events(fsm_t *fsm, fsm_snap_reader_t *r)
+{
+    while (r->pos < r->len)
+    {
+        struct fsm_events_t event = {0};
+        uint64_t key, prio = FSM_PRIO_NORMAL;
+        int status;
+
+        if (fsm_snap_get(r, &key) != 0) return -1;
+        if ((key >> FSM_SNAP_EV_SHIFT) > UINT32_MAX) return -1;
+
+        event.event = (uint32_t)(key >> FSM_SNAP_EV_SHIFT);
+        if (event.event & (FSM_EV_COALESCED | FSM_EV_POOLED)) return -1;
+        // Timeouts carry the data of the fsm, the pointers of the other events were not saved
+        if (event.event == FSM_TIMEOUT_EV) event.data = fsm->current_data;
+
+        if ((key & FSM_SNAP_EV_LANE) && (fsm_snap_get(r, &prio) != 0)) return -1;
+        if (key & FSM_SNAP_EV_PAYLOAD)
+        {
+#if FSM_INLINE_PAYLOAD > 0
+            uint64_t size;
+
+            if (fsm_snap_get(r, &size) != 0) return -1;
+            if ((size == 0) || (size > FSM_INLINE_PAYLOAD) || (size > r->len - r->pos)) return -1;
+
+            event.payload_len = (uint32_t)size;
+            memcpy(event.payload, &r->buff[r->pos], event.payload_len);
+            r->pos += event.payload_len;
+#else
+            return -1;
+#endif
+        }
+
+        // Dispatches from now on merge with it
+        if ((FSM_EXT(fsm)->num_coalesce > 0) && !fsm_event_has_payload(&event) && (fsm_coalesce_mark(fsm, &event) == FSM_DISPATCH_COALESCED)) continue;
+
+        status = fsm_queue_put_prio(fsm, &event, (prio < FSM_PRIO_LANES) ? (uint32_t)prio : FSM_PRIO_HIGHEST);
+        if (status < FSM_DISPATCH_OK) fsm_event_drop(fsm, &event);
+        fsm_stats_count(fsm, status);
+    }
+    return 0;
+}
+
+int fsm_restore(fsm_t *fsm, const fsm_def_t *def, uint32_t time_period_ticks, void *initial_data, const fsm_config_t *config, const void *buff, size_t len)
+{
+    fsm_snap_reader_t r = {buff, len, 2};
+    uint64_t state_id, elapsed, terminate_val = 0;
+    uint32_t period;
+    uint8_t flags;
+    int ret;
+
+    if(fsm == NULL || def == NULL || buff == NULL) return -1;
+    if((len < 2) || (r.buff[0] != FSM_SNAPSHOT_VERSION)) return -6;
+
+    flags = r.buff[1];
+    if (fsm_snap_get(&r, &state_id) != 0 || fsm_snap_get(&r, &elapsed) != 0) return -6;
+    if ((flags & FSM_SNAP_TERMINATED) && (fsm_snap_get(&r, &terminate_val) != 0)) return -6;
+
+    // Only leaf states stay active
+    if ((state_id < FSM_ST_FIRST) || (state_id >= def->num_states)) return -6;
+    if ((def->states[state_id].state_id != (int)state_id) || (def->states[state_id].default_substate != NULL)) return -6;
+
+    ret = fsm_instance_init(fsm, def, time_period_ticks, initial_data, config);
+    if (ret != 0) return ret;
+    // Released by fsm_deinit, as the reference of fsm_init
+    fsm_def_retain(def);
+
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+
+    fsm->state_id = (fsm_state_id_t)state_id;
+    period = FSM_STATE(fsm)->t_period;
+
+    // An armed timeout fires on the next tick at the latest, fsm_wheel_attach takes the ticks left
+    if (!(flags & FSM_SNAP_TIMER_ARMED)) fsm->t_elapsed = period;
+    else fsm->t_elapsed = (elapsed < period) ? (uint32_t)elapsed : period - 1;
+    if (period == 0) fsm->t_elapsed = 0;
+
+    if (FSM_EXT(fsm)->clock)
+    {
+        FSM_EXT(fsm)->deadline = (fsm->t_elapsed < period) ? FSM_EXT(fsm)->clock() + period - fsm->t_elapsed : FSM_NO_DEADLINE;
+        fsm->t_elapsed = 0;
+    }
+
+    if (flags & FSM_SNAP_TERMINATED)
+    {
+        internal->terminate = true;
+        fsm->terminate_val  = (int)((uint32_t)(terminate_val >> 1) ^ -(uint32_t)(terminate_val & 1));
+    }
+
+    if (fsm_restore_events(fsm, &r) != 0)
+    {
+        fsm_deinit(fsm);
+        return -6;
+    }
+    if (fsm_queue_num(fsm) > 0) fsm_event_fd_signal(fsm);
+
+    return 0;
+}
+
+#ifdef FSM_POSIX_API
+int fsm_run_wait(fsm_t *fsm, int timeout_ms)
+{
+    if(fsm == NULL) return -1;
+
+    if (fsm_queue_num(fsm) == 0)
+    {
+        struct pollfd pfd = {.fd = FSM_EXT(fsm)->event_fd, .events = POLLIN};
+        int wait = timeout_ms;
+
+        // Wakes up for the state timeout, the default clock is in ms
+        if ((FSM_EXT(fsm)->clock == FSM_CLOCK_DEFAULT) && (FSM_EXT(fsm)->deadline != FSM_NO_DEADLINE))
+        {
+            uint64_t now = FSM_EXT(fsm)->clock();
+            uint64_t remaining = (FSM_EXT(fsm)->deadline > now) ? FSM_EXT(fsm)->deadline - now : 0;
+
+            if ((wait < 0) || (remaining < (uint64_t)wait)) wait = (int)remaining;
+        }
+        poll(&pfd, 1, wait);
+    }
+    if (FSM_EXT(fsm)->clock) fsm_expire(&fsm, 1, FSM_EXT(fsm)->clock());
+
+    return fsm_run(fsm);
+}
+
+int fsm_event_fd(fsm_t *fsm)
+{
+    if(fsm == NULL) return -1;
+
+    return FSM_EXT(fsm)->event_fd;
+}
+
+int fsm_tick_fd_create(uint32_t period_ms)
+{
+    struct itimerspec spec = {
+        .it_interval = {.tv_sec = period_ms / 1000, .tv_nsec = (period_ms % 1000) * 1000000L},
+        .it_value    = {.tv_sec = period_ms / 1000, .tv_nsec = (period_ms % 1000) * 1000000L},
+    };
+    int fd;
+
+    if (period_ms == 0) return -1;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) return -1;
+
+    if (timerfd_settime(fd, 0, &spec, NULL) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+uint32_t fsm_tick_fd_read(int fd)
+{
+    uint64_t ticks = 0;
+
+    if (read(fd, &ticks, sizeof(ticks)) != sizeof(ticks)) return 0;
+
+    return (uint32_t)ticks;
+}
+#endif
+
+uint32_t fsm_event_count(fsm_t *fsm)
+{
+    if(fsm == NULL) return 0;
+
+    return FSM_EXT(fsm)->event_count;
+}
+
+int fsm_state_get(fsm_t *fsm)
+{
+    if(fsm == NULL) return FSM_ST_NONE;
+
+    return FSM_STATE(fsm)->state_id;
+}
+
+void fsm_terminate(fsm_t *fsm, int val)
+{
+    if(fsm == NULL) return;
+
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+
+    internal->terminate = true;
+    fsm->terminate_val = val;  
+}
+
+int fsm_has_pending_events(fsm_t *fsm) {
+    if(fsm == NULL) return -1;
+    if(!fsm_has_queue(fsm)) return 0;
+
+    return fsm_queue_num(fsm) > 0;
+}
+
+void fsm_flush_events(fsm_t *fsm) {
+    
+    if(fsm == NULL || !fsm_has_queue(fsm)) return;
+
+    struct internal_ctx *const internal = (void *)&fsm->internal;
+
+    fsm_queue_flush(fsm);
+    internal->flushed = true;
+}
+
+void fsm_ticks_hook(fsm_t *fsm)
+{
+    // Timeouts come from the wheel or the deadlines
+    if (FSM_EXT(fsm)->timer.wheel || FSM_EXT(fsm)->clock) return;
+
+    uint32_t period = FSM_STATE(fsm)->t_period;
+
+    if((period > 0) && (fsm->t_elapsed < period))
+    {
+        fsm->t_elapsed++;
+        if(fsm->t_elapsed == period) 
+        {
+            fsm_timeout_dispatch(fsm);
+        }
+    }
+}
+
+uint64_t fsm_next_deadline(fsm_t *fsm)
+{
+    if(fsm == NULL) return FSM_NO_DEADLINE;
+
+    return FSM_EXT(fsm)->deadline;
+}
+
+uint64_t fsm_next_deadline_n(fsm_t *const *fsms, size_t num)
+{
+    uint64_t next = FSM_NO_DEADLINE;
+
+    if(fsms == NULL) return next;
+
+    for (size_t i = 0; i < num; i++)
+    {
+        uint64_t deadline = fsm_next_deadline(fsms[i]);
+
+        if (deadline < next) next = deadline;
+    }
+    return next;
+}
+
+int fsm_expire(fsm_t *const *fsms, size_t num, uint64_t now)
+{
+    int expired = 0;
+
+    if(fsms == NULL) return 0;
+
+    for (size_t i = 0; i < num; i++)
+    {
+        fsm_t *fsm = fsms[i];
+
+        if ((fsm == NULL) || (FSM_EXT(fsm)->deadline > now)) continue;
+
+        // Fires once, the next transition arms it again
+        FSM_EXT(fsm)->deadline = FSM_NO_DEADLINE;
+        fsm_timeout_dispatch(fsm);
+        expired++;
+    }
+    return expired;
+}
+
+void fsm_compiled_exit(fsm_t *fsm, int exit_actor_id, uint32_t num_exited, void *data)
+{
+    if (num_exited) fsm->t_elapsed = 0;
+    fsm_actors_notify(fsm, exit_actor_id, ACTION_EXIT, data);
+}
+
+void fsm_compiled_enter(fsm_t *fsm, int entry_actor_id, int target_leaf, uint32_t num_exited, void *data)
+{
+    fsm_actors_notify(fsm, entry_actor_id, ACTION_ENTRY, data);
+
+    fsm->state_id = target_leaf;
+
+    // The state timer restarts with the period of the new state
+    if (num_exited) {
+        if (FSM_EXT(fsm)->timer.wheel) fsm_wheel_timer_arm(&FSM_EXT(fsm)->timer, FSM_STATE(fsm)->t_period);
+        if (FSM_EXT(fsm)->clock) fsm_deadline_arm(fsm);
+    }
+}
+
+void fsm_timeout_dispatch(fsm_t *fsm)
+{
+    if(fsm == NULL) return;
+
+    struct fsm_events_t new_event = {FSM_TIMEOUT_EV, fsm->current_data};
+#ifdef FSM_LATENCY_STATS
+    if (__atomic_load_n(&FSM_EXT(fsm)->latency, __ATOMIC_RELAXED)) new_event.enqueued = fsm_trace_cycles();
+#endif
+
+    fsm_stats_count(fsm, fsm_queue_put_first(fsm, &new_event));
+
+    fsm_notify(fsm);
+
+#ifdef FSM_EXEC
+    // A worker runs it
+    if (FSM_EXT(fsm)->exec) return;
+#endif
+#ifdef CONFIG_RUN_ON_TIMER_HOOK            
+    // The owner thread drains a MPSC queue
+    if (FSM_EXT(fsm)->queue != FSM_QUEUE_MPSC) fsm_run(fsm);
+#endif            
 }
\ No newline at end of file
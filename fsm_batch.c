@@ -0,0 +1,259 @@
+/**
+ * @file fsm_batch.c
+ * @author Mauro Medina
+ * @brief Batch engine running many instances of one machine, stored as arrays
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "fsm.h"
+#include "fsm_batch.h"
+
+_Static_assert(FSM_BATCH_WAVE <= UINT16_MAX, "FSM_BATCH_WAVE does not fit in the group offsets");
+
+#define BATCH_FROM_PROXY(self)  ((fsm_batch_t *)((uint8_t *)(self) - offsetof(fsm_batch_t, proxy)))
+
+// Starts a wave, the instances marked with an older one take events again
+static uint32_t batch_wave_next(fsm_batch_t *batch)
+{
+    if (++batch->wave_id == 0)
+    {
+        memset(batch->wave, 0, batch->num * sizeof(batch->wave[0]));
+        batch->wave_id = 1;
+    }
+    return batch->wave_id;
+}
+
+// Calls each action for all the instances, in the state they are in
+static void batch_call(fsm_batch_t *batch, const fsm_action_t *actions, uint32_t num_actions, const uint32_t *insts, uint32_t n)
+{
+    for (uint32_t k = 0; k < num_actions; k++)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            batch->instance = insts[i];
+            batch->proxy.state_id = (fsm_state_id_t)batch->state[insts[i]];
+            actions[k](&batch->proxy, batch->proxy.current_data);
+        }
+    }
+}
+
+// Same steps as fsm_route_fire, for all the instances taking the route
+static void batch_fire(fsm_batch_t *batch, const fsm_route_t *route, const uint32_t *insts, uint32_t n)
+{
+    const fsm_action_t *action = &batch->def->route_actions[route->actions];
+    uint32_t target = route->target_leaf->state_id;
+
+    batch_call(batch, action, route->num_exit, insts, n);
+    if (route->transition_action) batch_call(batch, &route->transition_action, 1, insts, n);
+    batch_call(batch, &action[route->num_exit], route->num_entry, insts, n);
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        batch->state[insts[i]] = target;
+        if (route->num_exited) batch->t_elapsed[insts[i]] = 0;
+    }
+}
+
+// Route of every (instance, event), 0 when there is no transition or the instance is out of range
+static void batch_gather(fsm_batch_t *batch, const uint32_t *insts, const uint32_t *events, uint32_t n, uint32_t *routes)
+{
+    const fsm_def_t *def = batch->def;
+    uint32_t i = 0;
+
+#ifdef __AVX2__
+    const __m256i num_events = _mm256_set1_epi32(def->num_event_ids);
+    const __m256i max_event  = _mm256_set1_epi32(def->num_event_ids - 1);
+    const __m256i max_inst   = _mm256_set1_epi32(batch->num - 1);
+    const __m256i index_mask = _mm256_set1_epi32((int)((1ull << (8 * sizeof(fsm_index_t))) - 1));
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i inst  = _mm256_loadu_si256((const __m256i *)&insts[i]);
+        __m256i event = _mm256_loadu_si256((const __m256i *)&events[i]);
+        // Only the instances in range are read, unsigned compares
+        __m256i known = _mm256_cmpeq_epi32(_mm256_min_epu32(inst, max_inst), inst);
+        __m256i state = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)batch->state, inst, known, 4);
+        __m256i cell  = _mm256_add_epi32(_mm256_mullo_epi32(state, num_events), event);
+        // Ids past the table have no route
+        __m256i valid = _mm256_and_si256(known, _mm256_cmpeq_epi32(_mm256_min_epu32(event, max_event), event));
+        // 4 bytes are read for every index, FSM_DISPATCH_PAD keeps the last one in the table
+        __m256i route = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)def->dispatch_table, cell, valid, sizeof(fsm_index_t));
+
+        _mm256_storeu_si256((__m256i *)&routes[i], _mm256_and_si256(route, index_mask));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        bool valid = (insts[i] < batch->num) && (events[i] < def->num_event_ids);
+
+        routes[i] = valid ? def->dispatch_table[batch->state[insts[i]] * def->num_event_ids + events[i]] : 0;
+    }
+}
+
+// Handles events of different instances, returns the transitions taken
+static int batch_wave(fsm_batch_t *batch, const uint32_t *insts, const uint32_t *events, uint32_t n)
+{
+    const fsm_def_t *def = batch->def;
+    uint32_t routes[FSM_BATCH_WAVE], order[FSM_BATCH_WAVE];
+    uint16_t end[FSM_MAX_ROUTES];
+    uint32_t begin = 0, offset = 0;
+
+    batch_gather(batch, insts, events, n, routes);
+
+    // Counting sort of the instances by route, route 0 is no transition
+    memset(end, 0, def->num_routes * sizeof(end[0]));
+    for (uint32_t i = 0; i < n; i++)
+    {
+        end[routes[i]]++;
+    }
+    int fired = n - end[0];
+    for (uint32_t r = 1; r < def->num_routes; r++)
+    {
+        uint32_t num = end[r];
+
+        end[r] = offset;
+        offset += num;
+    }
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (routes[i]) order[end[routes[i]]++] = insts[i];
+    }
+
+    // Every action runs for its whole group before the next one
+    for (uint32_t r = 1; r < def->num_routes; r++)
+    {
+        if (end[r] > begin) batch_fire(batch, &def->routes[r], &order[begin], end[r] - begin);
+        begin = end[r];
+    }
+    return fired;
+}
+
+int fsm_batch_init(fsm_batch_t *batch, const fsm_def_t *def, uint32_t num, void *buff, void *data)
+{
+    uint32_t insts[FSM_BATCH_WAVE];
+
+    if (batch == NULL || def == NULL || (buff == NULL && num > 0)) return -1;
+    if (def->num_transitions == 0) return -1;
+
+    memset(&batch->proxy, 0, sizeof(batch->proxy));
+#ifdef FSM_COMPACT
+    memset(&batch->proxy_ext, 0, sizeof(batch->proxy_ext));
+    batch->proxy.ext          = &batch->proxy_ext;
+#endif
+    batch->proxy.def          = def;
+    batch->proxy.current_data = data;
+    FSM_EXT(&batch->proxy)->deadline = FSM_NO_DEADLINE;
+    // Instances have no queue, dispatches to the proxy are rejected
+    FSM_EXT(&batch->proxy)->queue    = FSM_QUEUE_NONE;
+    batch->def       = def;
+    batch->num       = num;
+    batch->state     = (uint32_t *)buff;
+    batch->t_elapsed = batch->state + num;
+    batch->wave      = batch->t_elapsed + num;
+    batch->wave_id   = 0;
+    batch->instance  = 0;
+
+    memset(batch->t_elapsed, 0, 2 * (size_t)num * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num; i++)
+    {
+        batch->state[i] = def->initial_state->state_id;
+    }
+
+    // Route 0 enters the initial state
+    for (uint32_t first = 0; first < num; first += FSM_BATCH_WAVE)
+    {
+        uint32_t n = ((num - first) < FSM_BATCH_WAVE) ? (num - first) : FSM_BATCH_WAVE;
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            insts[i] = first + i;
+        }
+        batch_fire(batch, &def->routes[0], insts, n);
+    }
+    return 0;
+}
+
+int fsm_batch_process(fsm_batch_t *batch, const fsm_batch_event_t *evs, size_t n)
+{
+    uint32_t insts[FSM_BATCH_WAVE], events[FSM_BATCH_WAVE];
+    size_t pos = 0;
+    int fired = 0;
+
+    if (batch == NULL || batch->def == NULL || (evs == NULL && n > 0)) return -1;
+
+    while (pos < n)
+    {
+        uint32_t wave = batch_wave_next(batch);
+        uint32_t num = 0;
+
+        // An instance takes one event per wave, its next event starts a new wave
+        for (; (pos < n) && (num < FSM_BATCH_WAVE); pos++)
+        {
+            uint32_t inst = evs[pos].instance;
+
+            if (inst >= batch->num) continue;
+            if (batch->wave[inst] == wave) break;
+
+            batch->wave[inst] = wave;
+            insts[num]  = inst;
+            events[num] = evs[pos].event;
+            num++;
+        }
+        fired += batch_wave(batch, insts, events, num);
+    }
+    return fired;
+}
+
+int fsm_batch_tick(fsm_batch_t *batch)
+{
+    uint32_t insts[FSM_BATCH_WAVE], events[FSM_BATCH_WAVE];
+    uint32_t num = 0;
+    int expired = 0;
+
+    if (batch == NULL || batch->def == NULL) return -1;
+
+    for (uint32_t i = 0; i < batch->num; i++)
+    {
+        uint32_t period = batch->def->states[batch->state[i]].t_period;
+
+        if ((period == 0) || (batch->t_elapsed[i] >= period)) continue;
+        if (++batch->t_elapsed[i] < period) continue;
+
+        // Each instance times out once, they all fit in the same wave
+        insts[num]  = i;
+        events[num] = FSM_TIMEOUT_EV;
+        expired++;
+        if (++num == FSM_BATCH_WAVE)
+        {
+            batch_wave(batch, insts, events, num);
+            num = 0;
+        }
+    }
+    if (num > 0) batch_wave(batch, insts, events, num);
+
+    return expired;
+}
+
+uint32_t fsm_batch_instance(fsm_t *self)
+{
+    if (self == NULL) return 0;
+
+    return BATCH_FROM_PROXY(self)->instance;
+}
+
+int fsm_batch_state_get(fsm_batch_t *batch, uint32_t instance)
+{
+    if (batch == NULL || instance >= batch->num) return FSM_ST_NONE;
+
+    return batch->state[instance];
+}
@@ -0,0 +1,124 @@
+/**
+ * @file fsm_bus.c
+ * @author Mauro Medina
+ * @brief Publish/subscribe bus delivering events to the interested state machines
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_bus.h"
+
+_Static_assert(FSM_BUS_MAX_SUBS <= UINT16_MAX, "FSM_BUS_MAX_SUBS does not fit in the list offsets");
+
+// An event is handled when some state has a route for it
+static bool bus_event_handled(const fsm_def_t *def, uint32_t event)
+{
+    if (event >= def->num_event_ids) return false;
+
+    for (uint32_t state = FSM_ST_FIRST; state < def->num_states; state++)
+    {
+        if (def->dispatch_table[state * def->num_event_ids + event]) return true;
+    }
+    return false;
+}
+
+static bool bus_subscribed(fsm_bus_t *bus, uint32_t event, fsm_t *fsm)
+{
+    for (uint32_t i = bus->first[event]; i < bus->first[event + 1]; i++)
+    {
+        if (bus->subs[i] == fsm) return true;
+    }
+    return false;
+}
+
+// Inserts the fsm after the last subscriber of the same executor
+static void bus_insert(fsm_bus_t *bus, uint32_t event, fsm_t *fsm)
+{
+    uint32_t pos = bus->first[event + 1];
+
+#ifdef FSM_EXEC
+    for (uint32_t i = bus->first[event]; i < bus->first[event + 1]; i++)
+    {
+        if (FSM_EXT(bus->subs[i])->exec == FSM_EXT(fsm)->exec) pos = i + 1;
+    }
+#endif
+
+    memmove(&bus->subs[pos + 1], &bus->subs[pos], (bus->num_subs - pos) * sizeof(bus->subs[0]));
+    bus->subs[pos] = fsm;
+    bus->num_subs++;
+    for (uint32_t e = event + 1; e <= FSM_BUS_EVENTS; e++)
+    {
+        bus->first[e]++;
+    }
+}
+
+int fsm_bus_init(fsm_bus_t *bus)
+{
+    if (bus == NULL) return -1;
+
+    memset(bus, 0, sizeof(*bus));
+    return 0;
+}
+
+int fsm_bus_subscribe(fsm_bus_t *bus, fsm_t *fsm)
+{
+    uint32_t needed = 0;
+
+    if (bus == NULL || fsm == NULL || fsm->def == NULL) return -1;
+
+    for (uint32_t event = FSM_EV_FIRST; event < FSM_BUS_EVENTS; event++)
+    {
+        if (bus_event_handled(fsm->def, event) && !bus_subscribed(bus, event, fsm)) needed++;
+    }
+    if (bus->num_subs + needed > FSM_BUS_MAX_SUBS) return -2;
+
+    for (uint32_t event = FSM_EV_FIRST; event < FSM_BUS_EVENTS; event++)
+    {
+        if (bus_event_handled(fsm->def, event) && !bus_subscribed(bus, event, fsm)) bus_insert(bus, event, fsm);
+    }
+    return 0;
+}
+
+int fsm_bus_unsubscribe(fsm_bus_t *bus, fsm_t *fsm)
+{
+    uint32_t num = 0;
+
+    if (bus == NULL || fsm == NULL) return -1;
+
+    // Compacts the lists, every offset moves back by the entries removed before it
+    for (uint32_t event = 0; event < FSM_BUS_EVENTS; event++)
+    {
+        uint32_t first = bus->first[event], last = bus->first[event + 1];
+
+        bus->first[event] = num;
+        for (uint32_t i = first; i < last; i++)
+        {
+            if (bus->subs[i] != fsm) bus->subs[num++] = bus->subs[i];
+        }
+    }
+    bus->first[FSM_BUS_EVENTS] = num;
+    bus->num_subs = num;
+    return 0;
+}
+
+int fsm_bus_publish(fsm_bus_t *bus, uint32_t event, void *data)
+{
+    if (bus == NULL) return -1;
+    if (event >= FSM_BUS_EVENTS) return 0;
+
+    return fsm_dispatch_many(&bus->subs[bus->first[event]], bus->first[event + 1] - bus->first[event], event, data);
+}
+
+uint32_t fsm_bus_subscribers(fsm_bus_t *bus, uint32_t event)
+{
+    if (bus == NULL || event >= FSM_BUS_EVENTS) return 0;
+
+    return bus->first[event + 1] - bus->first[event];
+}
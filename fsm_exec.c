@@ -0,0 +1,359 @@
+/**
+ * @file fsm_exec.c
+ * @author Mauro Medina
+ * @brief Multi-threaded executor running many state machines
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+// Built with FSM_EXEC only, the workers are pthreads
+#ifdef FSM_EXEC
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fsm.h"
+#include "fsm_exec.h"
+
+// Set in exec_pending by fsm_exec_remove, notifications no longer queue the fsm
+#define FSM_EXEC_REMOVED    0x80000000u
+// Set in exec_pending by the worker letting go of a removed fsm
+#define FSM_EXEC_RELEASED   0x40000000u
+#define FSM_EXEC_FLAGS      (FSM_EXEC_REMOVED | FSM_EXEC_RELEASED)
+
+// Worker of the calling thread, NULL outside the executor
+static __thread fsm_exec_worker_t *current_worker;
+
+// Appends a list of num fsm linked through exec_next
+static void fsm_exec_push_list(fsm_exec_worker_t *worker, fsm_t *head, fsm_t *tail, uint32_t num)
+{
+    fsm_exec_t *exec = worker->exec;
+
+    FSM_EXT(tail)->exec_next = NULL;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail) FSM_EXT(worker->tail)->exec_next = head;
+    else __atomic_store_n(&worker->head, head, __ATOMIC_RELAXED);
+    worker->tail = tail;
+    pthread_mutex_unlock(&worker->lock);
+
+    __atomic_fetch_add(&exec->num_runnable, num, __ATOMIC_SEQ_CST);
+
+    // Wakes up idle workers, they steal the fsm if its owner is busy
+    if (__atomic_load_n(&exec->num_sleeping, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&exec->idle_lock);
+        if (num > 1) pthread_cond_broadcast(&exec->idle);
+        else pthread_cond_signal(&exec->idle);
+        pthread_mutex_unlock(&exec->idle_lock);
+    }
+}
+
+static void fsm_exec_push(fsm_exec_worker_t *worker, fsm_t *fsm)
+{
+    fsm_exec_push_list(worker, fsm, fsm, 1);
+}
+
+static fsm_exec_worker_t *fsm_exec_worker_get(fsm_exec_t *exec)
+{
+    fsm_exec_worker_t *worker = current_worker;
+
+    // Dispatched from an action stays on the same worker
+    if ((worker == NULL) || (worker->exec != exec))
+    {
+        uint32_t next = __atomic_fetch_add(&exec->next_worker, 1, __ATOMIC_RELAXED);
+        worker = &exec->workers[next % exec->num_workers];
+    }
+    return worker;
+}
+
+static fsm_t *fsm_exec_pop(fsm_exec_worker_t *worker)
+{
+    fsm_t *fsm;
+
+    // Cheap check before taking the lock
+    if (__atomic_load_n(&worker->head, __ATOMIC_RELAXED) == NULL) return NULL;
+
+    pthread_mutex_lock(&worker->lock);
+    fsm = worker->head;
+    if (fsm)
+    {
+        __atomic_store_n(&worker->head, FSM_EXT(fsm)->exec_next, __ATOMIC_RELAXED);
+        if (worker->head == NULL) worker->tail = NULL;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    if (fsm) __atomic_fetch_sub(&worker->exec->num_runnable, 1, __ATOMIC_SEQ_CST);
+    return fsm;
+}
+
+// Takes a queued fsm out of the worker, wherever it is in the list
+static bool fsm_exec_unlink(fsm_exec_worker_t *worker, fsm_t *fsm)
+{
+    fsm_t *prev = NULL;
+    bool found = false;
+
+    pthread_mutex_lock(&worker->lock);
+    for (fsm_t *it = worker->head; it != NULL; prev = it, it = FSM_EXT(it)->exec_next)
+    {
+        if (it != fsm) continue;
+
+        if (prev) FSM_EXT(prev)->exec_next = FSM_EXT(it)->exec_next;
+        else __atomic_store_n(&worker->head, FSM_EXT(it)->exec_next, __ATOMIC_RELAXED);
+        if (worker->tail == it) worker->tail = prev;
+        found = true;
+        break;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    if (found) __atomic_fetch_sub(&worker->exec->num_runnable, 1, __ATOMIC_SEQ_CST);
+    return found;
+}
+
+static fsm_t *fsm_exec_steal(fsm_exec_worker_t *worker)
+{
+    fsm_exec_t *exec = worker->exec;
+
+    // Visits the other workers starting by the next one
+    for (uint32_t i = 1; i < exec->num_workers; i++)
+    {
+        fsm_t *fsm = fsm_exec_pop(&exec->workers[(worker->id + i) % exec->num_workers]);
+
+        if (fsm)
+        {
+            __atomic_fetch_add(&worker->steals, 1, __ATOMIC_RELAXED);
+            return fsm;
+        }
+    }
+    return NULL;
+}
+
+static void fsm_exec_wait(fsm_exec_t *exec)
+{
+    pthread_mutex_lock(&exec->idle_lock);
+    __atomic_fetch_add(&exec->num_sleeping, 1, __ATOMIC_SEQ_CST);
+    while ((__atomic_load_n(&exec->num_runnable, __ATOMIC_SEQ_CST) == 0) && !__atomic_load_n(&exec->stop, __ATOMIC_RELAXED))
+    {
+        pthread_cond_wait(&exec->idle, &exec->idle_lock);
+    }
+    __atomic_fetch_sub(&exec->num_sleeping, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&exec->idle_lock);
+}
+
+static void fsm_exec_run(fsm_exec_worker_t *worker, fsm_t *fsm)
+{
+    // Everything notified up to here is processed by this run
+    uint32_t pending = __atomic_load_n(&FSM_EXT(fsm)->exec_pending, __ATOMIC_ACQUIRE);
+    uint32_t left;
+
+    // The last access to a removed fsm, fsm_exec_remove waits for it
+    if (pending & FSM_EXEC_REMOVED)
+    {
+        __atomic_fetch_or(&FSM_EXT(fsm)->exec_pending, FSM_EXEC_RELEASED, __ATOMIC_RELEASE);
+        return;
+    }
+
+    worker->running = fsm;
+    fsm_run(fsm);
+    worker->running = NULL;
+    __atomic_fetch_add(&worker->runs, 1, __ATOMIC_RELAXED);
+
+    left = __atomic_sub_fetch(&FSM_EXT(fsm)->exec_pending, pending, __ATOMIC_ACQ_REL);
+    if (left & FSM_EXEC_REMOVED)
+    {
+        __atomic_fetch_or(&FSM_EXT(fsm)->exec_pending, FSM_EXEC_RELEASED, __ATOMIC_RELEASE);
+    }else if (left != 0)
+    {
+        // Notified while running, it goes back to the queue to be fair with the others
+        fsm_exec_push(worker, fsm);
+    }
+}
+
+static void *fsm_exec_worker(void *arg)
+{
+    fsm_exec_worker_t *worker = arg;
+    fsm_exec_t *exec = worker->exec;
+
+    current_worker = worker;
+
+    while (!__atomic_load_n(&exec->stop, __ATOMIC_RELAXED))
+    {
+        fsm_t *fsm = fsm_exec_pop(worker);
+
+        if (fsm == NULL) fsm = fsm_exec_steal(worker);
+        if (fsm == NULL)
+        {
+            fsm_exec_wait(exec);
+            continue;
+        }
+        fsm_exec_run(worker, fsm);
+    }
+    return NULL;
+}
+
+int fsm_exec_init(fsm_exec_t *exec, uint32_t num_workers)
+{
+    if (exec == NULL) return -1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    if (num_workers == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = (cpus > 0) ? (uint32_t)cpus : 1;
+    }
+#endif
+    if (num_workers == 0) num_workers = 1;
+    if (num_workers > FSM_EXEC_MAX_WORKERS) num_workers = FSM_EXEC_MAX_WORKERS;
+
+    memset(exec, 0, sizeof(*exec));
+    exec->num_workers = num_workers;
+    pthread_mutex_init(&exec->idle_lock, NULL);
+    pthread_cond_init(&exec->idle, NULL);
+
+    for (uint32_t i = 0; i < num_workers; i++)
+    {
+        exec->workers[i].exec = exec;
+        exec->workers[i].id = i;
+        pthread_mutex_init(&exec->workers[i].lock, NULL);
+    }
+    for (uint32_t i = 0; i < num_workers; i++)
+    {
+        if (pthread_create(&exec->workers[i].thread, NULL, fsm_exec_worker, &exec->workers[i]) != 0)
+        {
+            // Only the threads already created are joined
+            exec->num_workers = i;
+            fsm_exec_stop(exec);
+            return -2;
+        }
+    }
+    return 0;
+}
+
+int fsm_exec_add(fsm_exec_t *exec, fsm_t *fsm)
+{
+    if (exec == NULL || fsm == NULL) return -1;
+
+#ifndef FREERTOS_API
+    if (FSM_EXT(fsm)->queue != FSM_QUEUE_MPSC) return -2;
+#endif
+
+    FSM_EXT(fsm)->exec_next = NULL;
+    __atomic_store_n(&FSM_EXT(fsm)->exec_pending, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&FSM_EXT(fsm)->exec, exec, __ATOMIC_RELEASE);
+
+    // Events dispatched before joining the executor
+    if (fsm_has_pending_events(fsm) > 0) fsm_exec_notify(fsm);
+    return 0;
+}
+
+int fsm_exec_remove(fsm_t *fsm)
+{
+    fsm_exec_t *exec;
+
+    if (fsm == NULL) return -1;
+
+    // Its own worker can not wait for the run to end
+    if ((current_worker != NULL) && (current_worker->running == fsm)) return -2;
+
+    exec = __atomic_exchange_n(&FSM_EXT(fsm)->exec, NULL, __ATOMIC_ACQ_REL);
+    if (exec == NULL) return 0;
+
+    // Notifications from now on do not queue it, it was neither queued nor running
+    if ((__atomic_fetch_or(&FSM_EXT(fsm)->exec_pending, FSM_EXEC_REMOVED, __ATOMIC_ACQ_REL) & ~FSM_EXEC_FLAGS) == 0) return 0;
+
+    for (uint32_t i = 0; i < exec->num_workers; i++)
+    {
+        if (fsm_exec_unlink(&exec->workers[i], fsm)) return 0;
+    }
+
+    // Running, or about to be queued by a dispatch, the worker lets it go
+    while (!(__atomic_load_n(&FSM_EXT(fsm)->exec_pending, __ATOMIC_ACQUIRE) & FSM_EXEC_RELEASED))
+    {
+        if (__atomic_load_n(&exec->stopped, __ATOMIC_ACQUIRE)) break;
+        sched_yield();
+    }
+    return 0;
+}
+
+void fsm_exec_notify(fsm_t *fsm)
+{
+    fsm_exec_t *exec = __atomic_load_n(&FSM_EXT(fsm)->exec, __ATOMIC_ACQUIRE);
+
+    if (exec == NULL) return;
+
+    // Already queued or running, the worker sees the new events
+    if (__atomic_fetch_add(&FSM_EXT(fsm)->exec_pending, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    fsm_exec_push(fsm_exec_worker_get(exec), fsm);
+}
+
+void fsm_exec_notify_n(fsm_t *const *fsms, uint32_t num)
+{
+    fsm_exec_t *exec = NULL;
+    fsm_t *head = NULL, *tail = NULL;
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < num; i++)
+    {
+        fsm_t *fsm = fsms[i];
+        fsm_exec_t *fsm_exec = __atomic_load_n(&FSM_EXT(fsm)->exec, __ATOMIC_ACQUIRE);
+
+        if (fsm_exec == NULL) continue;
+        if (__atomic_fetch_add(&FSM_EXT(fsm)->exec_pending, 1, __ATOMIC_ACQ_REL) != 0) continue;
+
+        // One list per executor, consecutive fsm of the same one go together
+        if ((fsm_exec != exec) && (head != NULL))
+        {
+            fsm_exec_push_list(fsm_exec_worker_get(exec), head, tail, count);
+            head = NULL;
+        }
+        if (head == NULL)
+        {
+            exec = fsm_exec;
+            head = fsm;
+            count = 0;
+        }else
+        {
+            FSM_EXT(tail)->exec_next = fsm;
+        }
+        tail = fsm;
+        count++;
+    }
+    if (head != NULL) fsm_exec_push_list(fsm_exec_worker_get(exec), head, tail, count);
+}
+
+int fsm_exec_stats_get(fsm_exec_t *exec, fsm_exec_stats_t *stats)
+{
+    if (exec == NULL || stats == NULL) return -1;
+
+    memset(stats, 0, sizeof(*stats));
+    for (uint32_t i = 0; i < exec->num_workers; i++)
+    {
+        stats->runs += __atomic_load_n(&exec->workers[i].runs, __ATOMIC_RELAXED);
+        stats->steals += __atomic_load_n(&exec->workers[i].steals, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+void fsm_exec_stop(fsm_exec_t *exec)
+{
+    if (exec == NULL) return;
+
+    pthread_mutex_lock(&exec->idle_lock);
+    __atomic_store_n(&exec->stop, 1, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&exec->idle);
+    pthread_mutex_unlock(&exec->idle_lock);
+
+    for (uint32_t i = 0; i < exec->num_workers; i++)
+    {
+        pthread_join(exec->workers[i].thread, NULL);
+    }
+    __atomic_store_n(&exec->stopped, 1, __ATOMIC_RELEASE);
+}
+
+#endif /* FSM_EXEC */
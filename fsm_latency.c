@@ -0,0 +1,159 @@
+/**
+ * @file fsm_latency.c
+ * @author Mauro Medina
+ * @brief Histograms of the time events wait in the queue
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_latency.h"
+
+#define LATENCY_SUB         (1u << FSM_LATENCY_SUB_BITS)
+
+static uint32_t latency_bucket(uint64_t cycles)
+{
+    int msb, shift;
+
+    // Exact below the first power of 2
+    if (cycles < LATENCY_SUB) return (uint32_t)cycles;
+
+    msb = 63 - __builtin_clzll(cycles);
+    if (msb >= FSM_LATENCY_BITS) return FSM_LATENCY_BUCKETS - 1;
+
+    shift = msb - FSM_LATENCY_SUB_BITS;
+    return ((uint32_t)(shift + 1) << FSM_LATENCY_SUB_BITS) + (uint32_t)((cycles >> shift) & (LATENCY_SUB - 1));
+}
+
+// Highest value counted in the bucket
+static uint64_t latency_bucket_max(uint32_t bucket)
+{
+    int shift;
+
+    if (bucket < LATENCY_SUB) return bucket;
+
+    shift = (int)(bucket >> FSM_LATENCY_SUB_BITS) - 1;
+    return (((uint64_t)LATENCY_SUB + (bucket & (LATENCY_SUB - 1)) + 1) << shift) - 1;
+}
+
+static uint32_t latency_count(fsm_latency_t *latency, uint32_t first, uint32_t last, uint32_t bucket)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = first; i < last; i++) {
+        count += __atomic_load_n(&latency->hists[i].count[bucket], __ATOMIC_RELAXED);
+    }
+    return count;
+}
+
+static uint64_t latency_percentile(fsm_latency_t *latency, uint32_t first, uint32_t last, uint32_t total, uint32_t per_mil)
+{
+    // Rank of the measure, rounded up
+    uint64_t rank = ((uint64_t)total * per_mil + 999) / 1000;
+    uint64_t seen = 0;
+
+    if (rank == 0) rank = 1;
+    for (uint32_t b = 0; b < FSM_LATENCY_BUCKETS; b++) {
+        seen += latency_count(latency, first, last, b);
+        if (seen >= rank) return latency_bucket_max(b);
+    }
+    return latency_bucket_max(FSM_LATENCY_BUCKETS - 1);
+}
+
+int fsm_latency_init(fsm_latency_t *latency, fsm_latency_hist_t *hists, uint32_t num)
+{
+    if (latency == NULL || hists == NULL || num == 0) return -1;
+
+    memset(hists, 0, num * sizeof(*hists));
+    latency->hists = hists;
+    latency->num = num;
+    latency->start_ns = fsm_trace_ns();
+    latency->start_cycles = fsm_trace_cycles();
+    return 0;
+}
+
+int fsm_latency_attach(fsm_t *fsm, fsm_latency_t *latency)
+{
+    if (fsm == NULL) return -1;
+
+#ifdef FSM_LATENCY_STATS
+    __atomic_store_n(&FSM_EXT(fsm)->latency, latency, __ATOMIC_RELEASE);
+    return 0;
+#else
+    return -2;
+#endif
+}
+
+void fsm_latency_record(fsm_latency_t *latency, uint32_t event, uint64_t cycles)
+{
+    fsm_latency_hist_t *hist;
+    uint32_t bucket;
+
+    if (event >= latency->num) return;
+
+    // Atomic updates, the fsm sharing the histograms may run on other threads
+    hist = &latency->hists[event];
+    bucket = latency_bucket(cycles);
+    __atomic_fetch_add(&hist->count[bucket], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while ((cycles > max) && !__atomic_compare_exchange_n(&hist->max, &max, cycles, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+int fsm_latency_get(fsm_latency_t *latency, uint32_t event, fsm_latency_summary_t *summary)
+{
+    uint32_t first = event, last = event + 1;
+    uint64_t ns, cycles;
+
+    if (latency == NULL || summary == NULL) return -1;
+    if (event == FSM_LATENCY_ALL) {
+        first = 0;
+        last = latency->num;
+    }
+    if (last > latency->num) return -1;
+
+    memset(summary, 0, sizeof(*summary));
+    for (uint32_t b = 0; b < FSM_LATENCY_BUCKETS; b++) {
+        summary->count += latency_count(latency, first, last, b);
+    }
+    if (summary->count == 0) return 0;
+
+    summary->p50 = latency_percentile(latency, first, last, summary->count, 500);
+    summary->p99 = latency_percentile(latency, first, last, summary->count, 990);
+    summary->p999 = latency_percentile(latency, first, last, summary->count, 999);
+    for (uint32_t i = first; i < last; i++) {
+        uint64_t max = __atomic_load_n(&latency->hists[i].max, __ATOMIC_RELAXED);
+        if (max > summary->max) summary->max = max;
+    }
+
+    // Cycles to ns, with the frequency measured since init
+    ns = fsm_trace_ns() - latency->start_ns;
+    cycles = fsm_trace_cycles() - latency->start_cycles;
+    if (latency->start_ns != 0 && ns > 0 && cycles > 0) {
+        double ns_per_cycle = (double)ns / (double)cycles;
+
+        summary->p50 = (uint64_t)(summary->p50 * ns_per_cycle);
+        summary->p99 = (uint64_t)(summary->p99 * ns_per_cycle);
+        summary->p999 = (uint64_t)(summary->p999 * ns_per_cycle);
+        summary->max = (uint64_t)(summary->max * ns_per_cycle);
+    }
+    return 0;
+}
+
+void fsm_latency_reset(fsm_latency_t *latency)
+{
+    if (latency == NULL) return;
+
+    for (uint32_t i = 0; i < latency->num; i++) {
+        for (uint32_t b = 0; b < FSM_LATENCY_BUCKETS; b++) {
+            __atomic_store_n(&latency->hists[i].count[b], 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&latency->hists[i].max, 0, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,98 @@
+/**
+ * @file fsm_pool.c
+ * @author Mauro Medina
+ * @brief Lock-free pool of reference counted payloads
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "fsm_pool.h"
+
+#define POOL_BLOCK_GET(pool, idx)   ((fsm_pool_block_t *)((pool)->buff + (size_t)(idx) * (pool)->stride))
+#define POOL_HEAD(tag, idx)         (((uint64_t)(tag) << 32) | (uint32_t)(idx))
+
+static void pool_push(fsm_pool_t *pool, fsm_pool_block_t *block)
+{
+    uint32_t idx = (uint32_t)(((uint8_t *)block - pool->buff) / pool->stride);
+    uint64_t head = __atomic_load_n(&pool->head, __ATOMIC_RELAXED);
+
+    do {
+        __atomic_store_n(&block->next, (uint32_t)head, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&pool->head, &head, POOL_HEAD((head >> 32) + 1, idx + 1), true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    __atomic_fetch_add(&pool->num_free, 1, __ATOMIC_RELAXED);
+}
+
+int fsm_pool_init(fsm_pool_t *pool, void *buff, uint32_t block_size, uint32_t num)
+{
+    if (pool == NULL || buff == NULL || num == 0) return -1;
+    if (((uintptr_t)buff & 7u) != 0) return -1;
+
+    pool->buff = buff;
+    pool->stride = FSM_POOL_BLOCK_SIZE(block_size);
+    pool->num = num;
+
+    // Block i links to i + 1, the last one ends the list
+    for (uint32_t i = 0; i < num; i++)
+    {
+        fsm_pool_block_t *block = POOL_BLOCK_GET(pool, i);
+
+        block->pool = pool;
+        block->refs = 0;
+        block->next = (i + 1 < num) ? i + 2 : 0;
+    }
+    __atomic_store_n(&pool->num_free, num, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->head, POOL_HEAD(0, 1), __ATOMIC_RELEASE);
+    return 0;
+}
+
+void *fsm_pool_acquire(fsm_pool_t *pool)
+{
+    fsm_pool_block_t *block;
+    uint64_t head;
+
+    if (pool == NULL) return NULL;
+
+    head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+    do {
+        if ((uint32_t)head == 0) return NULL;
+
+        // Stale when another thread took the block first, then the tag makes the swap fail
+        block = POOL_BLOCK_GET(pool, (uint32_t)head - 1);
+    } while (!__atomic_compare_exchange_n(&pool->head, &head, POOL_HEAD((head >> 32) + 1, __atomic_load_n(&block->next, __ATOMIC_RELAXED)),
+                                          true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    __atomic_fetch_sub(&pool->num_free, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&block->refs, 1, __ATOMIC_RELAXED);
+    return block + 1;
+}
+
+void fsm_pool_retain(void *payload)
+{
+    fsm_pool_block_t *block = (fsm_pool_block_t *)payload - 1;
+
+    __atomic_fetch_add(&block->refs, 1, __ATOMIC_RELAXED);
+}
+
+void fsm_pool_release(void *payload)
+{
+    fsm_pool_block_t *block = (fsm_pool_block_t *)payload - 1;
+
+    // The last user sees every write made to the payload before it goes back
+    if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        pool_push(block->pool, block);
+    }
+}
+
+uint32_t fsm_pool_available(fsm_pool_t *pool)
+{
+    if (pool == NULL) return 0;
+
+    return __atomic_load_n(&pool->num_free, __ATOMIC_RELAXED);
+}
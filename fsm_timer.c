@@ -0,0 +1,197 @@
+/**
+ * @file fsm_timer.c
+ * @author Mauro Medina
+ * @brief Hierarchical timer wheel shared by many state machines
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stddef.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_timer.h"
+
+#define WHEEL_MASK              (FSM_WHEEL_SLOTS - 1)
+#define WHEEL_SHIFT(level)      (FSM_WHEEL_BITS * (level))
+#define WHEEL_RANGE(level)      ((uint64_t)1 << WHEEL_SHIFT((level) + 1))
+
+
+static void wheel_lock(fsm_wheel_t *wheel)
+{
+    while (__atomic_exchange_n(&wheel->lock, 1, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+static void wheel_unlock(fsm_wheel_t *wheel)
+{
+    __atomic_store_n(&wheel->lock, 0, __ATOMIC_RELEASE);
+}
+
+static void timer_link(fsm_timer_t **head, fsm_timer_t *timer)
+{
+    timer->next = *head;
+    if (*head) (*head)->pprev = &timer->next;
+    *head = timer;
+    timer->pprev = head;
+}
+
+static void timer_unlink(fsm_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+static void wheel_insert(fsm_wheel_t *wheel, fsm_timer_t *timer)
+{
+    uint32_t delta = timer->expires - wheel->now;
+    uint32_t slot;
+    int level;
+
+    // The closest level whose range covers the timer
+    for (level = 0; level < FSM_WHEEL_LEVELS - 1; level++) {
+        if (delta < WHEEL_RANGE(level)) break;
+    }
+
+    if (delta < WHEEL_RANGE(level)) {
+        slot = (timer->expires >> WHEEL_SHIFT(level)) & WHEEL_MASK;
+    } else {
+        // Out of range: park it in the last slot to cascade, it is placed again then
+        slot = ((wheel->now >> WHEEL_SHIFT(level)) - 1) & WHEEL_MASK;
+    }
+    timer_link(&wheel->slots[level][slot], timer);
+}
+
+static void wheel_cascade(fsm_wheel_t *wheel, int level)
+{
+    uint32_t slot = (wheel->now >> WHEEL_SHIFT(level)) & WHEEL_MASK;
+    fsm_timer_t *timer = wheel->slots[level][slot];
+
+    wheel->slots[level][slot] = NULL;
+
+    // Moves every timer down, closer to its expiration
+    while (timer != NULL) {
+        fsm_timer_t *next = timer->next;
+
+        timer->next = NULL;
+        timer->pprev = NULL;
+        wheel_insert(wheel, timer);
+        timer = next;
+    }
+}
+
+void fsm_wheel_init(fsm_wheel_t *wheel)
+{
+    if (wheel == NULL) return;
+
+    memset(wheel, 0, sizeof(*wheel));
+}
+
+int fsm_wheel_attach(fsm_wheel_t *wheel, fsm_t *fsm)
+{
+    if (wheel == NULL || fsm == NULL) return -1;
+
+    fsm_wheel_detach(fsm);
+
+    FSM_EXT(fsm)->timer.wheel = wheel;
+    FSM_EXT(fsm)->timer.fsm   = fsm;
+    if (fsm->def != NULL) {
+        uint32_t period = FSM_STATE(fsm)->t_period;
+
+        // Already expired in this state, the next transition arms it
+        if (fsm->t_elapsed < period) fsm_wheel_timer_arm(&FSM_EXT(fsm)->timer, period - fsm->t_elapsed);
+        fsm->t_elapsed = 0;
+    }
+    return 0;
+}
+
+void fsm_wheel_detach(fsm_t *fsm)
+{
+    if (fsm == NULL || FSM_EXT(fsm)->timer.wheel == NULL) return;
+
+    fsm_wheel_timer_cancel(&FSM_EXT(fsm)->timer);
+    FSM_EXT(fsm)->timer.wheel = NULL;
+}
+
+void fsm_wheel_timer_arm(fsm_timer_t *timer, uint32_t ticks)
+{
+    fsm_wheel_t *wheel = timer->wheel;
+
+    if (wheel == NULL) return;
+
+    wheel_lock(wheel);
+    if (timer->pprev != NULL) timer_unlink(timer);
+    // No period, no timer
+    if (ticks > 0) {
+        timer->expires = wheel->now + ticks;
+        wheel_insert(wheel, timer);
+    }
+    wheel_unlock(wheel);
+}
+
+uint32_t fsm_wheel_timer_remaining(fsm_timer_t *timer)
+{
+    fsm_wheel_t *wheel = timer->wheel;
+    uint32_t remaining = 0;
+
+    if (wheel == NULL) return 0;
+
+    wheel_lock(wheel);
+    if (timer->pprev != NULL) remaining = timer->expires - wheel->now;
+    wheel_unlock(wheel);
+
+    return remaining;
+}
+
+void fsm_wheel_timer_cancel(fsm_timer_t *timer)
+{
+    fsm_wheel_t *wheel = timer->wheel;
+
+    if (wheel == NULL) return;
+
+    wheel_lock(wheel);
+    if (timer->pprev != NULL) timer_unlink(timer);
+    wheel_unlock(wheel);
+}
+
+void fsm_wheel_tick(fsm_wheel_t *wheel)
+{
+    fsm_timer_t **slot;
+
+    if (wheel == NULL) return;
+
+    wheel_lock(wheel);
+
+    wheel->now++;
+
+    // Upper levels cascade when the level below wraps
+    for (int level = 1; level < FSM_WHEEL_LEVELS; level++) {
+        if ((wheel->now & ((1u << WHEEL_SHIFT(level)) - 1)) != 0) break;
+        wheel_cascade(wheel, level);
+    }
+
+    // Everything in the current slot expires now
+    slot = &wheel->slots[0][wheel->now & WHEEL_MASK];
+    while (*slot != NULL) {
+        fsm_timer_t *timer = *slot;
+
+        timer_unlink(timer);
+        timer_link(&wheel->expired, timer);
+    }
+
+    // Delivered without the lock, the fsm may re-arm its timer
+    while (wheel->expired != NULL) {
+        fsm_timer_t *timer = wheel->expired;
+
+        timer_unlink(timer);
+        wheel_unlock(wheel);
+        fsm_timeout_dispatch(timer->fsm);
+        wheel_lock(wheel);
+    }
+
+    wheel_unlock(wheel);
+}
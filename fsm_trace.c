@@ -0,0 +1,131 @@
+/**
+ * @file fsm_trace.c
+ * @author Mauro Medina
+ * @brief Transition trace records with cycle counts
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stddef.h>
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#endif
+
+#include "fsm.h"
+#include "fsm_trace.h"
+
+_Static_assert(sizeof(fsm_trace_record_t) == 32, "fsm_trace_record_t is read by tools/fsm_trace_decode.py");
+
+uint64_t fsm_trace_ns(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+// Field by field, a reader may copy the record while it is written
+static void trace_record_copy(fsm_trace_record_t *dst, const fsm_trace_record_t *src)
+{
+    __atomic_store_n(&dst->timestamp, __atomic_load_n(&src->timestamp, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->fsm_id, __atomic_load_n(&src->fsm_id, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->event, __atomic_load_n(&src->event, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->source, __atomic_load_n(&src->source, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->target, __atomic_load_n(&src->target, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->exit_cycles, __atomic_load_n(&src->exit_cycles, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->transition_cycles, __atomic_load_n(&src->transition_cycles, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&dst->entry_cycles, __atomic_load_n(&src->entry_cycles, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+int fsm_trace_init(fsm_trace_t *trace, fsm_trace_record_t *records, uint32_t len)
+{
+    if (trace == NULL || records == NULL || len == 0) return -1;
+    if ((len & (len - 1)) != 0) return -2;
+
+    memset(records, 0, len * sizeof(*records));
+    trace->records = records;
+    trace->len = len;
+    trace->head = 0;
+    trace->start_ns = fsm_trace_ns();
+    trace->start_cycles = fsm_trace_cycles();
+    return 0;
+}
+
+int fsm_trace_attach(fsm_t *fsm, fsm_trace_t *trace, uint32_t id)
+{
+    if (fsm == NULL) return -1;
+
+#ifdef FSM_TRACE
+    FSM_EXT(fsm)->trace_id = id;
+    __atomic_store_n(&FSM_EXT(fsm)->trace, trace, __ATOMIC_RELEASE);
+    return 0;
+#else
+    return -2;
+#endif
+}
+
+void fsm_trace_write(fsm_trace_t *trace, const fsm_trace_record_t *record)
+{
+    // Many writers, each one owns the slot it takes
+    uint32_t idx = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+    fsm_trace_record_t *slot = &trace->records[idx & (trace->len - 1)];
+
+    // Readers skip the slot until seq is set again
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    trace_record_copy(slot, record);
+    __atomic_store_n(&slot->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t fsm_trace_read(fsm_trace_t *trace, fsm_trace_record_t *records, uint32_t max)
+{
+    uint32_t head, first, num = 0;
+
+    if (trace == NULL || records == NULL) return 0;
+
+    head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    first = (head > trace->len) ? head - trace->len : 0;
+    if (head - first > max) first = head - max;
+
+    for (uint32_t i = first; i != head; i++) {
+        const fsm_trace_record_t *slot = &trace->records[i & (trace->len - 1)];
+        fsm_trace_record_t *record = &records[num];
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != i + 1) continue;
+        trace_record_copy(record, slot);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // Overwritten while copying
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != i + 1) continue;
+
+        record->seq = i + 1;
+        num++;
+    }
+    return num;
+}
+
+void fsm_trace_header_get(fsm_trace_t *trace, fsm_trace_header_t *header, uint32_t num)
+{
+    uint64_t ns, cycles;
+
+    if (trace == NULL || header == NULL) return;
+
+    memset(header, 0, sizeof(*header));
+    header->magic = FSM_TRACE_MAGIC;
+    header->version = FSM_TRACE_VERSION;
+    header->record_size = sizeof(fsm_trace_record_t);
+    header->num = num;
+
+    // Frequency measured since init
+    ns = fsm_trace_ns() - trace->start_ns;
+    cycles = fsm_trace_cycles() - trace->start_cycles;
+    if (ns > 0 && trace->start_ns != 0) {
+        header->cycles_hz = (uint64_t)((double)cycles * 1e9 / (double)ns);
+    }
+}
@@ -1,391 +1,1175 @@
-/**
- * @file fsm.h
- * @author Mauro Medina 
- * @brief 
- * @version 1.0.1
- * @date 2024-07-17
- * 
- * @copyright Copyright (c) 2024
- * 
- */
-#ifndef FSM_H_
-#define FSM_H_
-
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-#include <stddef.h>
-#include <stdint.h>
-
-#ifdef CONFIG_FREERTOS_PORT
-// #define FREERTOS_API
-#endif
-
-#ifdef FREERTOS_API
-#include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
-#else
-#include "ring_buff.h"
-#endif 
-
-//----------------------------------------------------------------------
-//	CONFIGS
-//----------------------------------------------------------------------
-#define CONFIG_RUN_ON_TIMER_HOOK 1              // Runs the fsm inside the timed hook when a timout is triggered
-
-//----------------------------------------------------------------------
-//	DEFINES
-//----------------------------------------------------------------------
-
-#ifndef FSM_MAX_EVENTS
-#define FSM_MAX_EVENTS 64
-#endif
-
-#ifndef MAX_HIERARCHY_DEPTH 
-#define MAX_HIERARCHY_DEPTH  8
-#endif
-
-#ifndef FSM_MAX_ACTORS 
-#define FSM_MAX_ACTORS  10
-#endif 
-
-#ifndef FSM_MAX_TRANSITIONS
-// Max number of transitions for an event
-#define FSM_MAX_TRANSITIONS 8
-#endif
-//----------------------------------------------------------------------
-//	DEFINITIONS
-//----------------------------------------------------------------------
-/**
- * @brief FSM NULL STATE
- * 
- */
-#define FSM_ST_NONE 0
-
-/**
- * @brief FSM FIRST STATE
- * 
- */
-#define FSM_ST_FIRST 1
-
-/**
- * @brief FSM FIRST EVENT
- * 
- */
-#define FSM_EV_FIRST 2
-
-/**
- * @brief FSM FIRST ACTOR
- * 
- */
-#define FSM_ACTOR_FIRST 1
-
-/**
- * @brief FSM TIMED EVENT
- * 
- */
-#define FSM_TIMEOUT_EV 1
-
-//----------------------------------------------------------------------
-//	MACROS
-//----------------------------------------------------------------------
-
-// States table definition
-#define FSM_STATES_INIT(name)    static fsm_state_t name##_states[] = { [0] = {0},
-#define FSM_STATES_END()        };
-
-/**
- * @brief Create a states array for the FSM
- * 
- * @param _name Should be the same as used in FSM_STATES_INIT(name)
- * @param _id Should be in order starting from 1
- * @param _parent ID of the parent state, or 0 if no parent
- * @param _sub ID of the default substate, or 0 if no default substate
- * @param _entry Entry action function pointer
- * @param _run Run action function pointer
- * @param _exit Exit action function pointer
- * 
- */
-#define FSM_CREATE_STATE(_name, _id, _parent, _sub, _entry, _run, _exit)    \
-[_id] = {                                                                   \
-    .state_id = _id,                                                        \
-    .parent = (_parent == 0) ? (fsm_state_t*)_parent : (fsm_state_t*)&_name##_states[_parent],       \
-    .default_substate = (_sub == 0) ? (fsm_state_t*)_sub : (fsm_state_t*)&_name##_states[_sub],      \
-    .entry_action = _entry,                                                 \
-    .exit_action = _exit,                                                   \
-    .run_action = _run                                                      \
-},
-
-// Transition table definition
-#define FSM_TRANSITIONS_INIT(name) static const fsm_transition_t name##_transitions[] = { [0] = {0},
-#define FSM_TRANSITIONS_END()   };
-
-/**
- * @brief Internal helper macro to create a transition (used by other macros)
- */
-#define FSM_TRANSITION_GENERAL_CREATE(_name, _source_id, _event, _target_id, _work) \
-{                                                                                   \
-    .source_state = (fsm_state_t*)&_name##_states[_source_id],                      \
-    .event = _event,                                                                \
-    .target_state = (fsm_state_t*)&_name##_states[_target_id],                      \
-    .transition_action = (_work),                                                   \
-},
-
-/**
- * @brief Create a transitions array for the FSM
- * 
- * @param _name Should be the same as used in FSM_STATES_INIT(name)
- * @param _source_id Source state ID
- * @param event Event of the transition
- * @param _target_id Target state ID
- * 
- */
-#define FSM_TRANSITION_CREATE(_name, _source_id, _event, _target_id) \
-    FSM_TRANSITION_GENERAL_CREATE(_name, _source_id, _event, _target_id, NULL)
-
-/**
- * @brief Create a transitions array for the FSM with work to be done
- * 
- * @param _name Should be the same as used in FSM_STATES_INIT(name)
- * @param _source_id Source state ID
- * @param event Event of the transition
- * @param _target_id Target state ID
- * @param _work Pointer to the work function of the transition 
- * 
- */
-#define FSM_TRANSITION_WORK_CREATE(_name, _source_id, _event, _target_id, _work) \
-    FSM_TRANSITION_GENERAL_CREATE(_name, _source_id, _event, _target_id, _work)
-
-// Gets the number of ticks from time value in ms
-#define FSM_MS_2_TICKS(fsm, ms) (fsm.fsm_ms_ticks*ms)
-
-// actor table definition
-#define FSM_ACTOR_INIT(name) static struct fsm_actor_t name##_actor[] = { [0] = {0},
-#define FSM_ACTOR_END()   };
-
-/**
- * @brief Create an actor array for the FSM
- * 
- * @param _source_id Source state ID
- * @param _entry Entry action function pointer
- * @param _run Run action function pointer
- * @param _exit Exit action function pointer
- * 
- */
-#define FSM_ACTOR_CREATE(_source_id, _entry, _run, _exit)    \
-{                                                            \
-    .state_id       = _source_id,                            \
-    .entry_action   = _entry,                                \
-    .exit_action    = _exit,                                 \
-    .run_action     = _run,                                  \
-},    
-
-#define FSM_TRANSITIONS_GET(name) name##_transitions
-#define FSM_TRANSITIONS_SIZE(name) ((sizeof(name##_transitions)/sizeof(name##_transitions[0])-1))
-
-#define FSM_STATE_GET(name, id)   name##_states[id]
-
-#define FSM_ACTOR_GET(name)   name##_actor
-#define FSM_ACTOR_SIZE(name) ((sizeof(name##_actor)/sizeof(name##_actor[0])))
-
-//----------------------------------------------------------------------
-//	DECLARATIONS
-//----------------------------------------------------------------------
-enum fsm_action_e
-{
-    ACTION_ENTRY = 0,
-    ACTION_RUN,
-    ACTION_EXIT
-};
-
-typedef struct fsm_state_t fsm_state_t;
-typedef struct fsm_t fsm_t;
-typedef void (*fsm_action_t)(fsm_t* self, void* data);
-
-struct fsm_state_t {
-    
-    int state_id;
-    
-    uint32_t t_period;
-    uint32_t t_count;
-    
-    fsm_state_t* parent;
-    fsm_state_t* default_substate;
-    
-    fsm_action_t entry_action;
-    fsm_action_t exit_action;
-    fsm_action_t run_action;
-};
-
-typedef struct {
-    fsm_state_t* source_state;
-    uint32_t event;
-    fsm_state_t* target_state;
-    fsm_action_t transition_action;
-} fsm_transition_t;
-
-typedef struct {
-    fsm_state_t* source_state[FSM_MAX_TRANSITIONS+1];
-    fsm_action_t transition_action[FSM_MAX_TRANSITIONS+1];
-    fsm_state_t* target_state[FSM_MAX_TRANSITIONS+1];
-} fsm_smt_events_t;
-
-struct fsm_events_t
-{
-    uint32_t event;
-    void *data;
-};
-
-struct fsm_actor_t {
-    // State relevant to actor
-    int state_id;
-    // Work to be done
-    fsm_action_t entry_action;
-    fsm_action_t exit_action;
-    fsm_action_t run_action;
-} ;
-
-typedef struct {
-    // Actor
-    struct fsm_actor_t* actor;
-    // Actor's number of states
-    int len;
-} fsm_actors_net_t;
-
-
-struct fsm_t {
-    // States transutions table
-    const fsm_transition_t *transitions;
-    // Total number of transitions
-    size_t num_transitions;
-    // Total number of events
-    size_t num_events;
-    // Events ring buffer
-#ifdef FREERTOS_API
-    QueueHandle_t event_queue;
-#else
-    struct ringbuff event_queue;
-#endif 
-    struct fsm_events_t events_buff[FSM_MAX_EVENTS];
-    // Events table
-    fsm_smt_events_t smart_event[FSM_MAX_EVENTS+FSM_EV_FIRST];
-    // Current state running
-    fsm_state_t* current_state;
-    // Actors
-    fsm_actors_net_t actors_table[FSM_MAX_ACTORS];
-    // Current data
-    void* current_data;
-    // Terminate value
-    int terminate_val;
-    // Timer hook period (ticks / ms)
-    uint32_t fsm_ms_ticks;
-    // Internal info
-    uint32_t internal;
-};
-
-//----------------------------------------------------------------------
-//	FUNCTIONS
-//----------------------------------------------------------------------
-
-/**
- * @brief Inits the state machine object.
- * 
- * @param fsm               fsm pointer
- * @param transitions       Transitions table pointer
- * @param num_transitions   Number of transitions in the table
- * @param num_events        Number of events in the fsm
- * @param time_period_ticks Timer hook period (ticks / ms), can be 0
- * @param initial_state     Default first state
- * @param initial_data      User custom data struct pointer
- */
-int fsm_init(fsm_t *fsm, 
-            const fsm_transition_t *transitions, 
-            size_t num_transitions, 
-            size_t num_events, 
-            uint32_t time_period_ticks,
-            fsm_state_t* initial_state, 
-            void *initial_data);
-
-/**
- * @brief Links an actor to a fsm
- * 
- * @param fsm 
- * @param actor 
- * @param size 
- * @return int 
- */
-int fsm_actor_link(fsm_t *fsm, struct fsm_actor_t *actor, int size);
-
-/**
- * @brief Sets the period in tick of a state's transition
- * 
- * @param state State where the timed transition is
- * @param ticks Ticks to wait for the trigger
- * @return int 
- */
-int fsm_timed_event_set(fsm_state_t *state, uint32_t ticks);
-
-/**
- * @brief Dispatches an event to the state machine. It will be process when fsm_run is called.
- * 
- * @param fsm 
- * @param event 
- * @param data 
- */
-void fsm_dispatch(fsm_t *fsm, uint32_t event, void *data);
-
-/**
- * @brief Runs the state machine.
- * 
- * @details Process ALL pending events and then runs the current state once per call.
- * 
- * @param fsm 
- * @return int 
- */
-int fsm_run(fsm_t *fsm);
-
-/**
- * @brief Gets the current active state ID.
- * 
- * @param fsm 
- * @return int 
- */
-int fsm_state_get(fsm_t *fsm);
-
-/**
- * @brief Terminates the state machine.
- * 
- * @param fsm 
- * @param val 
- */
-void fsm_terminate(fsm_t *fsm, int val);
-
-/**
- * @brief Gets the number of pending events in the fsm
- * 
- * @param fsm 
- * @return int 
- */
-int fsm_has_pending_events(fsm_t *fsm);
-
-/**
- * @brief Fluches all pending events. 
- * 
- * @param fsm 
- */
-void fsm_flush_events(fsm_t *fsm);
-
-/**
- * @brief Updates timed events.
- * 
- * @param fsm 
- * @param data 
- */
-void fsm_ticks_hook(fsm_t *fsm);
-
-#ifdef __cplusplus
-}
-#endif
-
-#endif /* FSM_H_ */
+/**
+ * @file fsm.h
+ * @author Mauro Medina 
+ * @brief 
+ * @version 1.0.1
+ * @date 2024-07-17
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+#ifndef FSM_H_
+#define FSM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef CONFIG_FREERTOS_PORT
+// #define FREERTOS_API
+#endif
+
+// #define FSM_POSIX_API                        // Linux hosts: thread safe queue, eventfd per fsm and timerfd ticks
+
+#ifdef FREERTOS_API
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#else
+#include "ring_buff.h"
+#include "mpsc_queue.h"
+#endif 
+#include "fsm_timer.h"
+#include "fsm_trace.h"
+#include "fsm_latency.h"
+#include "fsm_pool.h"
+
+struct fsm_exec_t;
+
+//----------------------------------------------------------------------
+//	CONFIGS
+//----------------------------------------------------------------------
+#define CONFIG_RUN_ON_TIMER_HOOK 1              // Runs the fsm inside the timed hook when a timout is triggered
+// FSM_COMPACT                                  // Small fsm_t, the runtime, event queue and actors are given in fsm_config_t
+                                                // Sizes the queues padding too: pass -DFSM_COMPACT to every source
+// #define FSM_TRACE                            // Transitions recorded with their cycle counts, see fsm_trace.h
+// #define FSM_LATENCY_STATS                    // Events stamped when queued, waiting time histograms, see fsm_latency.h
+// #define FSM_EXEC                             // Executor running fsm on pthread workers, see fsm_exec.h
+
+//----------------------------------------------------------------------
+//	DEFINES
+//----------------------------------------------------------------------
+
+#ifndef FSM_MAX_EVENTS
+// Size of the events queue, power of 2
+#define FSM_MAX_EVENTS 64
+#endif
+
+#ifndef FSM_EVENTS_BATCH
+// Number of events taken from the queue at once by fsm_run
+#define FSM_EVENTS_BATCH 8
+#endif
+
+#ifndef MAX_HIERARCHY_DEPTH 
+#define MAX_HIERARCHY_DEPTH  8
+#endif
+
+#ifndef FSM_MAX_ACTORS 
+#define FSM_MAX_ACTORS  10
+#endif 
+
+#ifndef FSM_MAX_ACTOR_ACTIONS
+// Max number of actor actions indexed by state
+#define FSM_MAX_ACTOR_ACTIONS 64
+#endif
+
+#ifndef FSM_MAX_STATES
+// Max state id of a fsm, sizes the dispatch table
+#define FSM_MAX_STATES 32
+#endif
+
+#ifndef FSM_MAX_ROUTES
+// Max number of (state, event) pairs that trigger a transition
+#define FSM_MAX_ROUTES 128
+#endif
+
+#ifndef FSM_MAX_ROUTE_ACTIONS
+// Max number of exit/entry actions stored for all the routes
+#define FSM_MAX_ROUTE_ACTIONS 512
+#endif
+
+#ifndef FSM_DEF_ALLOC
+// Memory of the definitions compiled by fsm_init, one per transitions table in use.
+// Without a heap define FSM_DEF_ALLOC(size) as NULL and use fsm_def_init
+#define FSM_DEF_ALLOC(size) malloc(size)
+#define FSM_DEF_FREE(ptr)   free(ptr)
+#endif
+
+#ifndef FSM_MAX_COALESCE
+// Max number of event ids coalesced by a fsm
+#define FSM_MAX_COALESCE 4
+#endif
+
+#ifndef FSM_PRIO_LANES
+// Event queue lanes, fsm_run drains the highest priority first. 1 disables the priorities
+#define FSM_PRIO_LANES 2
+#endif
+
+#ifndef FSM_PRIO_EVENTS
+// Size of each lane above FSM_PRIO_NORMAL, power of 2
+#define FSM_PRIO_EVENTS 8
+#endif
+
+#ifndef FSM_INLINE_PAYLOAD
+// Bytes of payload copied in every event slot by fsm_dispatch_copy, 0 disables it
+#define FSM_INLINE_PAYLOAD 0
+#endif
+
+// Format of the records written by fsm_snapshot
+#define FSM_SNAPSHOT_VERSION 1
+
+// Max bytes of a snapshot with up to events pending events
+#define FSM_SNAPSHOT_SIZE(events) (17 + (events) * (15 + FSM_INLINE_PAYLOAD))
+//----------------------------------------------------------------------
+//	DEFINITIONS
+//----------------------------------------------------------------------
+/**
+ * @brief FSM NULL STATE
+ * 
+ */
+#define FSM_ST_NONE 0
+
+/**
+ * @brief FSM FIRST STATE
+ * 
+ */
+#define FSM_ST_FIRST 1
+
+/**
+ * @brief FSM FIRST EVENT
+ * 
+ */
+#define FSM_EV_FIRST 2
+
+/**
+ * @brief Event priorities, lanes of the event queue
+ * 
+ */
+#define FSM_PRIO_NORMAL 0
+#define FSM_PRIO_HIGHEST (FSM_PRIO_LANES - 1)
+
+/**
+ * @brief FSM FIRST ACTOR
+ * 
+ */
+#define FSM_ACTOR_FIRST 1
+
+/**
+ * @brief FSM TIMED EVENT
+ * 
+ */
+#define FSM_TIMEOUT_EV 1
+
+//----------------------------------------------------------------------
+//	MACROS
+//----------------------------------------------------------------------
+
+// States table definition
+#define FSM_STATES_INIT(name)    static fsm_state_t name##_states[] = { [0] = {0},
+#define FSM_STATES_END()        };
+
+/**
+ * @brief Create a states array for the FSM
+ * 
+ * @param _name Should be the same as used in FSM_STATES_INIT(name)
+ * @param _id Should be in order starting from 1
+ * @param _parent ID of the parent state, or 0 if no parent
+ * @param _sub ID of the default substate, or 0 if no default substate
+ * @param _entry Entry action function pointer
+ * @param _run Run action function pointer
+ * @param _exit Exit action function pointer
+ * 
+ */
+#define FSM_CREATE_STATE(_name, _id, _parent, _sub, _entry, _run, _exit)    \
+[_id] = {                                                                   \
+    .state_id = _id,                                                        \
+    .parent = (_parent == 0) ? (fsm_state_t*)_parent : (fsm_state_t*)&_name##_states[_parent],       \
+    .default_substate = (_sub == 0) ? (fsm_state_t*)_sub : (fsm_state_t*)&_name##_states[_sub],      \
+    .entry_action = _entry,                                                 \
+    .exit_action = _exit,                                                   \
+    .run_action = _run                                                      \
+},
+
+// Transition table definition
+#define FSM_TRANSITIONS_INIT(name) static const fsm_transition_t name##_transitions[] = { [0] = {0},
+#define FSM_TRANSITIONS_END()   };
+
+/**
+ * @brief Internal helper macro to create a transition (used by other macros)
+ */
+#define FSM_TRANSITION_GENERAL_CREATE(_name, _source_id, _event, _target_id, _work) \
+{                                                                                   \
+    .source_state = (fsm_state_t*)&_name##_states[_source_id],                      \
+    .event = _event,                                                                \
+    .target_state = (fsm_state_t*)&_name##_states[_target_id],                      \
+    .transition_action = (_work),                                                   \
+},
+
+/**
+ * @brief Create a transitions array for the FSM
+ * 
+ * @param _name Should be the same as used in FSM_STATES_INIT(name)
+ * @param _source_id Source state ID
+ * @param event Event of the transition
+ * @param _target_id Target state ID
+ * 
+ */
+#define FSM_TRANSITION_CREATE(_name, _source_id, _event, _target_id) \
+    FSM_TRANSITION_GENERAL_CREATE(_name, _source_id, _event, _target_id, NULL)
+
+/**
+ * @brief Create a transitions array for the FSM with work to be done
+ * 
+ * @param _name Should be the same as used in FSM_STATES_INIT(name)
+ * @param _source_id Source state ID
+ * @param event Event of the transition
+ * @param _target_id Target state ID
+ * @param _work Pointer to the work function of the transition 
+ * 
+ */
+#define FSM_TRANSITION_WORK_CREATE(_name, _source_id, _event, _target_id, _work) \
+    FSM_TRANSITION_GENERAL_CREATE(_name, _source_id, _event, _target_id, _work)
+
+// Gets the number of ticks from time value in ms
+#define FSM_MS_2_TICKS(fsm, ms) (fsm.fsm_ms_ticks*ms)
+
+// actor table definition
+#define FSM_ACTOR_INIT(name) static struct fsm_actor_t name##_actor[] = { [0] = {0},
+#define FSM_ACTOR_END()   };
+
+/**
+ * @brief Create an actor array for the FSM
+ * 
+ * @param _source_id Source state ID
+ * @param _entry Entry action function pointer
+ * @param _run Run action function pointer
+ * @param _exit Exit action function pointer
+ * 
+ */
+#define FSM_ACTOR_CREATE(_source_id, _entry, _run, _exit)    \
+{                                                            \
+    .state_id       = _source_id,                            \
+    .entry_action   = _entry,                                \
+    .exit_action    = _exit,                                 \
+    .run_action     = _run,                                  \
+},    
+
+#define FSM_TRANSITIONS_GET(name) name##_transitions
+#define FSM_TRANSITIONS_SIZE(name) ((sizeof(name##_transitions)/sizeof(name##_transitions[0])-1))
+
+#define FSM_STATE_GET(name, id)   name##_states[id]
+
+#define FSM_ACTOR_GET(name)   name##_actor
+#define FSM_ACTOR_SIZE(name) ((sizeof(name##_actor)/sizeof(name##_actor[0])))
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+enum fsm_action_e
+{
+    ACTION_ENTRY = 0,
+    ACTION_RUN,
+    ACTION_EXIT
+};
+
+typedef struct fsm_state_t fsm_state_t;
+typedef struct fsm_t fsm_t;
+typedef void (*fsm_action_t)(fsm_t* self, void* data);
+
+struct fsm_state_t {
+    
+    int state_id;
+    
+    uint32_t t_period;
+    
+    fsm_state_t* parent;
+    fsm_state_t* default_substate;
+    
+    fsm_action_t entry_action;
+    fsm_action_t exit_action;
+    fsm_action_t run_action;
+};
+
+typedef struct {
+    fsm_state_t* source_state;
+    uint32_t event;
+    fsm_state_t* target_state;
+    fsm_action_t transition_action;
+} fsm_transition_t;
+
+// Index into the routes table, 0 means no transition
+#ifdef FSM_COMPACT
+typedef uint8_t fsm_index_t;
+#else
+typedef uint16_t fsm_index_t;
+#endif
+
+// Indexes after the dispatch table, the 4 byte gathers of fsm_batch read the last one in bounds
+#define FSM_DISPATCH_PAD (sizeof(uint32_t) / sizeof(fsm_index_t) - 1)
+
+typedef struct {
+    // Leaf state active after the transition
+    fsm_state_t* target_leaf;
+    // Work to be done between exit and entry actions
+    fsm_action_t transition_action;
+    // First action in the route actions pool
+    uint16_t actions;
+    // Exit actions followed by entry actions
+    uint8_t num_exit;
+    uint8_t num_entry;
+    // Number of states left, with or without exit action
+    uint8_t num_exited;
+    // States whose actors are notified
+    uint16_t exit_actor_id;
+    uint16_t entry_actor_id;
+} fsm_route_t;
+
+struct fsm_events_t
+{
+    uint32_t event;
+    void *data;
+#ifdef FSM_LATENCY_STATS
+    // Cycle counter when queued, 0 when not measured
+    uint64_t enqueued;
+#endif
+#if FSM_INLINE_PAYLOAD > 0
+    // Bytes used in payload, 0 when the event carries data
+    uint32_t payload_len;
+    uint8_t payload[FSM_INLINE_PAYLOAD] __attribute__((aligned(8)));
+#endif
+};
+
+struct fsm_actor_t {
+    // State relevant to actor
+    int state_id;
+    // Work to be done
+    fsm_action_t entry_action;
+    fsm_action_t exit_action;
+    fsm_action_t run_action;
+} ;
+
+/**
+ * @brief Event queue backends, FREERTOS_API always uses a FreeRTOS queue
+ * 
+ */
+enum fsm_queue_e
+{
+    // Ring buffer, fsm_dispatch and fsm_run on the same thread
+    FSM_QUEUE_RING = 0,
+    // Lock-free queue, fsm_dispatch from any thread, fsm_run on the owner thread
+    FSM_QUEUE_MPSC,
+    // No queue, the proxy fsm_t of a batch: dispatches are rejected, not valid in fsm_config_t
+    FSM_QUEUE_NONE,
+};
+
+/**
+ * @brief Source of the state timeouts
+ * 
+ */
+enum fsm_timer_e
+{
+    // fsm_ticks_hook called every tick, or a timer wheel
+    FSM_TIMER_TICKS = 0,
+    // Absolute deadlines, expired by fsm_expire
+    FSM_TIMER_DEADLINE,
+};
+
+// No state timeout armed
+#define FSM_NO_DEADLINE UINT64_MAX
+
+// Monotonic clock for FSM_TIMER_DEADLINE, in the unit of the state periods
+typedef uint64_t (*fsm_clock_t)(void);
+
+/**
+ * @brief What fsm_dispatch does when the event queue is full
+ * 
+ */
+enum fsm_overflow_e
+{
+    // Drops the oldest event, the MPSC queue rejects the new one instead
+    FSM_OVERFLOW_DROP_OLDEST = 0,
+    // Rejects the new event
+    FSM_OVERFLOW_REJECT,
+    // Waits up to block_timeout_ms for free space (FreeRTOS and MPSC queues)
+    FSM_OVERFLOW_BLOCK,
+    // Puts the event in the spill buffer (ring buffer queue)
+    FSM_OVERFLOW_SPILL,
+};
+
+/**
+ * @brief fsm_dispatch results, negative values mean the event was dropped
+ * 
+ */
+enum fsm_dispatch_e
+{
+    FSM_DISPATCH_OK = 0,
+    // Queued, the oldest event was dropped
+    FSM_DISPATCH_OVERWRITE = 1,
+    // Queued in the spill buffer
+    FSM_DISPATCH_SPILLED = 2,
+    // Merged with the same event still pending
+    FSM_DISPATCH_COALESCED = 3,
+    // Queue full
+    FSM_DISPATCH_REJECTED = -1,
+    // Queue still full after blocking
+    FSM_DISPATCH_TIMEOUT = -2,
+    // Invalid fsm
+    FSM_DISPATCH_INVALID = -3,
+};
+
+/**
+ * @brief Merging of an event dispatched again while it is still pending
+ * 
+ */
+enum fsm_coalesce_e
+{
+    // Handled once with the data of the last dispatch
+    FSM_COALESCE_LATEST = 0,
+    // Handled once with the data of the first dispatch
+    FSM_COALESCE_COUNT,
+};
+
+typedef struct {
+    uint32_t event;
+    enum fsm_coalesce_e mode;
+} fsm_coalesce_t;
+
+typedef struct {
+    // Event queue backend
+    enum fsm_queue_e queue;
+    // Queue full policy
+    enum fsm_overflow_e overflow;
+    // Max time blocked by fsm_dispatch with FSM_OVERFLOW_BLOCK (ms)
+    uint32_t block_timeout_ms;
+    // Spill buffer for FSM_OVERFLOW_SPILL, spill_len has to be a power of 2
+    struct fsm_events_t *spill_buff;
+    uint32_t spill_len;
+    // Event queue storage, FSM_EVENTS_BUFF_SIZE(events_len) bytes, events_len has to be a power of 2.
+    // NULL for the FSM_MAX_EVENTS embedded in fsm_t, required with FSM_COMPACT
+    void *events_buff;
+    uint32_t events_len;
+    // Actors storage with FSM_COMPACT, NULL when no actor is linked
+    struct fsm_actors_t *actors;
+    // Runtime storage with FSM_COMPACT, one per fsm, required
+    struct fsm_ext_t *ext;
+    // State timeouts source
+    enum fsm_timer_e timer;
+    // Clock for FSM_TIMER_DEADLINE, NULL for the system monotonic clock in ms
+    fsm_clock_t clock;
+    // Lane of each event id used by fsm_dispatch, FSM_PRIO_NORMAL for the ids not in the table
+    const uint8_t *priorities;
+    uint32_t num_priorities;
+    // Priority lanes storage, FSM_PRIO_LANES-1 blocks of FSM_EVENTS_BUFF_SIZE(prio_len) bytes, prio_len has to be a power of 2.
+    // NULL for the FSM_PRIO_EVENTS embedded in fsm_t, without lanes with FSM_COMPACT
+    void *prio_buff;
+    uint32_t prio_len;
+    // Event ids queued once while pending, up to FSM_MAX_COALESCE
+    const fsm_coalesce_t *coalesce;
+    uint32_t num_coalesce;
+} fsm_config_t;
+
+typedef struct {
+    // Events taken from the queue
+    uint32_t processed;
+    // Events lost because the queue was full, or taken from it and left by a terminate or a flush
+    uint32_t dropped;
+    // Old events lost to make room for new ones
+    uint32_t overwritten;
+    // Events queued in the spill buffer
+    uint32_t spilled;
+    // Events merged with the same event still pending
+    uint32_t coalesced;
+    // Max number of pending events seen by fsm_dispatch
+    uint32_t high_watermark;
+    // Pending events
+    uint32_t pending;
+} fsm_stats_t;
+
+// Dispatcher generated by tools/fsm_2_c.py, returns 1 when a transition was taken
+typedef int (*fsm_dispatch_fn_t)(fsm_t *fsm, uint32_t event, void *data);
+
+/**
+ * @brief Immutable machine definition, shared by all its fsm instances
+ * 
+ */
+typedef struct {
+    // States transutions table
+    const fsm_transition_t *transitions;
+    // Total number of transitions
+    size_t num_transitions;
+    // Total number of events
+    size_t num_events;
+    // Default first state
+    fsm_state_t* initial_state;
+    // States table base, indexed by state id
+    fsm_state_t* states;
+    // Dispatch table rows (states) and columns (events)
+    uint16_t num_states;
+    uint16_t num_event_ids;
+    // Flattened [state][event] table, inherited transitions included
+    fsm_index_t dispatch_table[(FSM_MAX_STATES+1)*(FSM_MAX_EVENTS+FSM_EV_FIRST) + FSM_DISPATCH_PAD];
+    // Precomputed transitions, [0] enters the initial state
+    fsm_route_t routes[FSM_MAX_ROUTES];
+    uint16_t num_routes;
+    // Exit and entry actions of all the routes
+    fsm_action_t route_actions[FSM_MAX_ROUTE_ACTIONS];
+    uint16_t num_route_actions;
+    // Generated dispatcher used instead of the table, NULL when not compiled
+    fsm_dispatch_fn_t dispatch;
+} fsm_def_t;
+
+typedef struct {
+    // Actor
+    struct fsm_actor_t* actor;
+    // Actor's number of states
+    int len;
+} fsm_actors_net_t;
+
+typedef struct {
+    // First action in the actor actions pool
+    uint16_t first;
+    // Number of entry, run and exit actions
+    uint16_t num[ACTION_EXIT+1];
+} fsm_actor_index_t;
+
+typedef struct fsm_actors_t {
+    // Actors
+    fsm_actors_net_t table[FSM_MAX_ACTORS];
+    // Actor actions indexed by state id
+    fsm_actor_index_t index[FSM_MAX_STATES+1];
+    fsm_action_t actions[FSM_MAX_ACTOR_ACTIONS];
+} fsm_actors_t;
+
+// Bytes of event queue storage for len events, fits both queue backends
+#define FSM_EVENTS_BUFF_SIZE(len) MPSC_QUEUE_BUF_SIZE(len, sizeof(struct fsm_events_t))
+
+
+/**
+ * @brief Runtime of a fsm beside its current state: event queue, statistics,
+ * timers and executor links. Embedded in fsm_t, given in fsm_config_t with FSM_COMPACT
+ * 
+ */
+typedef struct fsm_ext_t {
+    // Events queue
+#ifdef FREERTOS_API
+    QueueHandle_t event_queue;
+#else
+    union {
+        struct ringbuff ring;
+        struct mpsc_queue mpsc;
+    } event_queue;
+#ifndef FSM_COMPACT
+    union {
+        struct fsm_events_t ring[FSM_MAX_EVENTS];
+        uint8_t mpsc[FSM_EVENTS_BUFF_SIZE(FSM_MAX_EVENTS)];
+    } events_buff;
+#endif
+    struct ringbuff spill;
+#if FSM_PRIO_LANES > 1
+    // Lanes above FSM_PRIO_NORMAL, same backend as event_queue
+    union {
+        struct ringbuff ring;
+        struct mpsc_queue mpsc;
+    } prio_queue[FSM_PRIO_LANES - 1];
+#ifndef FSM_COMPACT
+    union {
+        struct fsm_events_t ring[FSM_PRIO_EVENTS];
+        uint8_t mpsc[FSM_EVENTS_BUFF_SIZE(FSM_PRIO_EVENTS)];
+    } prio_buff[FSM_PRIO_LANES - 1];
+#endif
+    // Lanes in use above FSM_PRIO_NORMAL, 0 without storage
+    uint32_t prio_lanes;
+    // Bit per lane that may hold events, set by the producers
+    uint32_t prio_pending;
+#endif
+#endif
+#if FSM_PRIO_LANES > 1
+    // Lane of each event id, NULL when all are FSM_PRIO_NORMAL
+    const uint8_t *priorities;
+    uint32_t num_priorities;
+#endif
+    // Event queue backend
+    enum fsm_queue_e queue;
+    // Queue full policy
+    enum fsm_overflow_e overflow;
+    uint32_t block_timeout_ms;
+    // Timeout waiting to be processed (MPSC queue)
+    uint32_t timeout_pending;
+    // Queue statistics, updated atomically
+    fsm_stats_t stats;
+    // Event ids merged while pending
+    struct {
+        uint32_t event;
+        uint32_t mode;
+        // Dispatches merged in the queued event, 0 when not queued
+        uint32_t count;
+        void *data;
+    } coalesce[FSM_MAX_COALESCE];
+    uint32_t num_coalesce;
+    // Dispatches merged in the event being handled
+    uint32_t event_count;
+    // State timeout, when attached to a timer wheel
+    fsm_timer_t timer;
+    // Clock of the deadline mode, NULL in ticks mode
+    fsm_clock_t clock;
+    // Absolute time of the state timeout, FSM_NO_DEADLINE when not armed
+    uint64_t deadline;
+#ifdef FSM_EXEC
+    // Executor running the fsm, NULL when run by the user
+    struct fsm_exec_t *exec;
+    // Next fsm in the executor run queue
+    fsm_t *exec_next;
+    // Notifications not yet seen by a worker, the fsm is queued or running while not 0
+    uint32_t exec_pending;
+#endif
+#ifdef FSM_POSIX_API
+    // Readable while events are pending
+    int event_fd;
+    // Set once event_fd was written, cleared by fsm_run
+    uint32_t event_signaled;
+#endif
+#ifdef FSM_LATENCY_STATS
+    // Waiting time histograms, NULL when not measured
+    fsm_latency_t *latency;
+    // Queued time of the flagged timeout (MPSC queue)
+    uint64_t timeout_enqueued;
+#endif
+#ifdef FSM_TRACE
+    // Ring recording the transitions, NULL when not traced
+    fsm_trace_t *trace;
+    uint32_t trace_id;
+#endif
+} fsm_ext_t;
+
+// Id of the current state, index in the states of the definition
+#ifdef FSM_COMPACT
+typedef uint8_t fsm_state_id_t;
+#else
+typedef uint16_t fsm_state_id_t;
+#endif
+
+struct fsm_t {
+    // Machine definition
+    const fsm_def_t *def;
+    // Event queue, statistics, timers and executor links
+#ifdef FSM_COMPACT
+    fsm_ext_t *ext;
+#else
+    fsm_ext_t ext;
+#endif
+    // Actors
+#ifdef FSM_COMPACT
+    fsm_actors_t *actors;
+#else
+    fsm_actors_t actors;
+#endif
+    // Current data
+    void* current_data;
+    // Ticks elapsed in the current state
+    uint32_t t_elapsed;
+    // Timer hook period (ticks / ms)
+    uint32_t fsm_ms_ticks;
+    // Terminate value
+    int terminate_val;
+    // Current state running
+    fsm_state_id_t state_id;
+    // Internal info
+    uint8_t internal;
+};
+
+// Runtime of a fsm
+#ifdef FSM_COMPACT
+#define FSM_EXT(fsm)        ((fsm)->ext)
+#else
+#define FSM_EXT(fsm)        (&(fsm)->ext)
+#endif
+
+// Current state of a fsm
+#define FSM_STATE(fsm)      (&(fsm)->def->states[(fsm)->state_id])
+
+//----------------------------------------------------------------------
+//	FUNCTIONS
+//----------------------------------------------------------------------
+
+/**
+ * @brief Inits the state machine object.
+ * 
+ * @param fsm               fsm pointer
+ * @param transitions       Transitions table pointer
+ * @param num_transitions   Number of transitions in the table
+ * @param num_events        Number of events in the fsm
+ * @param time_period_ticks Timer hook period (ticks / ms), can be 0
+ * @param initial_state     Default first state
+ * @param initial_data      User custom data struct pointer
+ * @return int 0 on success, -4 if the fsm does not fit in the dispatch table
+ * (see fsm_def_init) or FSM_DEF_ALLOC has no memory for its definition
+ */
+int fsm_init(fsm_t *fsm, 
+            const fsm_transition_t *transitions, 
+            size_t num_transitions, 
+            size_t num_events, 
+            uint32_t time_period_ticks,
+            fsm_state_t* initial_state, 
+            void *initial_data);
+
+/**
+ * @brief Inits the state machine object with a custom configuration.
+ * 
+ * @param fsm               fsm pointer
+ * @param transitions       Transitions table pointer
+ * @param num_transitions   Number of transitions in the table
+ * @param num_events        Number of events in the fsm
+ * @param time_period_ticks Timer hook period (ticks / ms), can be 0
+ * @param initial_state     Default first state
+ * @param initial_data      User custom data struct pointer
+ * @param config            Configuration, NULL for the defaults of fsm_init
+ * @return int 0 on success, -3 if the queue can not be created or FSM_COMPACT has no ext in the config, -4 if the fsm does not fit in the dispatch table
+ * (see fsm_def_init) or FSM_DEF_ALLOC has no memory for its definition, -5 if FSM_TIMER_DEADLINE has no clock
+ */
+int fsm_init_ex(fsm_t *fsm, 
+            const fsm_transition_t *transitions, 
+            size_t num_transitions, 
+            size_t num_events, 
+            uint32_t time_period_ticks,
+            fsm_state_t* initial_state, 
+            void *initial_data,
+            const fsm_config_t *config);
+
+/**
+ * @brief Compiles a machine definition, it can back any number of fsm instances.
+ * 
+ * @details fsm_init and fsm_init_ex compile one with FSM_DEF_ALLOC, shared
+ * by every fsm initialized with the same transitions table and freed by
+ * fsm_deinit of the last one. Builds without a heap compile their own with
+ * this function and fsm_init_def.
+ * 
+ * @param def               Definition to compile
+ * @param transitions       Transitions table pointer
+ * @param num_transitions   Number of transitions in the table
+ * @param num_events        Number of events in the fsm
+ * @param initial_state     Default first state
+ * @return int 0 on success, -1 on invalid arguments, -2 without transitions,
+ * -4 if the fsm does not fit in the dispatch table: a state id above
+ * FSM_MAX_STATES, an event id from FSM_MAX_EVENTS+FSM_EV_FIRST up, more than
+ * FSM_MAX_ROUTES (state, event) pairs with a transition, or more than
+ * FSM_MAX_ROUTE_ACTIONS exit and entry actions in all of them
+ */
+int fsm_def_init(fsm_def_t *def, 
+            const fsm_transition_t *transitions, 
+            size_t num_transitions, 
+            size_t num_events, 
+            fsm_state_t* initial_state);
+
+/**
+ * @brief Inits a state machine instance from a compiled definition.
+ * 
+ * @details Only the current state, the state timer and the event queue belong
+ * to the instance, the definition is never modified. The def of a fsm
+ * initialized by fsm_init can be given too, it stays compiled until
+ * fsm_deinit of every instance using it.
+ * 
+ * @param fsm               fsm pointer
+ * @param def               Definition compiled by fsm_def_init, or the def of another fsm
+ * @param time_period_ticks Timer hook period (ticks / ms), can be 0
+ * @param initial_data      User custom data struct pointer
+ * @param config            Configuration, NULL for the defaults of fsm_init
+ * @return int 0 on success, -3 if the queue can not be created or FSM_COMPACT has no ext in the config,
+ * -5 if FSM_TIMER_DEADLINE has no clock
+ */
+int fsm_init_def(fsm_t *fsm, 
+            const fsm_def_t *def, 
+            uint32_t time_period_ticks,
+            void *initial_data,
+            const fsm_config_t *config);
+
+/**
+ * @brief Links an actor to a fsm
+ * 
+ * @details The actor actions are indexed by state, so only the actors of the
+ * active state are called.
+ * 
+ * @param fsm 
+ * @param actor 
+ * @param size 
+ * @return int 0 on success, -2 if no free actor slot, -3 if the index is full
+ */
+int fsm_actor_link(fsm_t *fsm, struct fsm_actor_t *actor, int size);
+
+/**
+ * @brief Sets the period in tick of a state's transition
+ * 
+ * @details The period is part of the definition, shared by every instance.
+ * Instances keep the ticks already elapsed in the state, a fsm attached to a
+ * timer wheel or in FSM_TIMER_DEADLINE mode picks the new period the next
+ * time the state is entered.
+ * 
+ * @param state State where the timed transition is
+ * @param ticks Ticks to wait for the trigger
+ * @return int 
+ */
+int fsm_timed_event_set(fsm_state_t *state, uint32_t ticks);
+
+/**
+ * @brief Dispatches an event to the state machine. It will be process when fsm_run is called.
+ * 
+ * @details With the FSM_QUEUE_MPSC backend it can be called from any thread.
+ * When the queue is full the overflow policy set in fsm_init_ex applies.
+ * The event goes to the priority lane set for its id in fsm_config_t.
+ * A fsm added to an executor becomes runnable.
+ * 
+ * @param fsm 
+ * @param event 
+ * @param data 
+ * @return int FSM_DISPATCH_OK, or a fsm_dispatch_e value when the queue is full
+ */
+int fsm_dispatch(fsm_t *fsm, uint32_t event, void *data);
+
+/**
+ * @brief Dispatches an event in a priority lane, ahead of the events with
+ * lower priority still in the queue.
+ * 
+ * @details Events of the same lane keep their order. The lanes have no
+ * overflow policy, a full lane rejects the event. With FreeRTOS the event
+ * is sent to the front of the queue.
+ * 
+ * @param fsm 
+ * @param event 
+ * @param data 
+ * @param prio FSM_PRIO_NORMAL up to FSM_PRIO_HIGHEST, higher values are FSM_PRIO_HIGHEST
+ * @return int FSM_DISPATCH_OK, or a fsm_dispatch_e value when the lane is full
+ */
+int fsm_dispatch_prio(fsm_t *fsm, uint32_t event, void *data, uint32_t prio);
+
+/**
+ * @brief Dispatches an event with a payload copied in the event slot, the
+ * action gets a pointer to the copy and the producer keeps its buffer.
+ * 
+ * @details Needs FSM_INLINE_PAYLOAD, the size of the payload area of every
+ * slot. Bigger payloads are not copied, dispatch a pointer to them with
+ * fsm_dispatch. The copy is valid until the action returns. Events with
+ * a payload are not coalesced.
+ * 
+ * @param fsm 
+ * @param event 
+ * @param payload 
+ * @param size  Bytes to copy, up to FSM_INLINE_PAYLOAD
+ * @return int FSM_DISPATCH_OK, a fsm_dispatch_e value when the queue is full,
+ * or FSM_DISPATCH_INVALID when the payload does not fit
+ */
+int fsm_dispatch_copy(fsm_t *fsm, uint32_t event, const void *payload, size_t size);
+
+/**
+ * @brief Dispatches an event with a payload taken from a fsm_pool_t, shared
+ * by all the fsm it is sent to.
+ * 
+ * @details The event holds a reference to the payload from now on, and
+ * releases it once its transition is done, or when it is dropped or
+ * flushed. The caller keeps its own reference, release it with
+ * fsm_pool_release after the last dispatch. Pooled events are not coalesced.
+ * 
+ * @param fsm 
+ * @param event 
+ * @param payload Given by fsm_pool_acquire
+ * @return int FSM_DISPATCH_OK, or a fsm_dispatch_e value when the queue is full
+ */
+int fsm_dispatch_pooled(fsm_t *fsm, uint32_t event, void *payload);
+
+/**
+ * @brief Dispatches the same event to many state machines.
+ * 
+ * @details Same as calling fsm_dispatch for each fsm, but the fsm run by
+ * an executor are made runnable together, with a single wake up of its
+ * idle workers. Used by fsm_bus_publish.
+ * 
+ * @param fsms 
+ * @param num   Number of fsm
+ * @param event 
+ * @param data  Shared by all the fsm
+ * @return int Number of fsm that accepted the event, coalesced ones included, or FSM_DISPATCH_INVALID
+ */
+int fsm_dispatch_many(fsm_t *const *fsms, size_t num, uint32_t event, void *data);
+
+/**
+ * @brief Dispatches many events at once, with a single wake up of the fsm.
+ * 
+ * @details Same as calling fsm_dispatch for each event, in order, but the
+ * MPSC queue claims the space for up to FSM_EVENTS_BATCH events with one
+ * atomic operation, and FreeRTOS sends them with the scheduler suspended.
+ * With FSM_INLINE_PAYLOAD the payload of the events with a payload_len is
+ * copied too, as fsm_dispatch_copy does.
+ * It stops at the first event rejected, that one and the ones after it are
+ * not queued, so evs[accepted] onwards can be dispatched again later. The
+ * enqueued field of the events is not used.
+ * 
+ * @param fsm 
+ * @param evs   Events to dispatch
+ * @param n     Number of events
+ * @return int Number of events accepted, the first ones of evs, coalesced ones included, or FSM_DISPATCH_INVALID
+ */
+int fsm_dispatch_batch(fsm_t *fsm, const struct fsm_events_t *evs, size_t n);
+
+/**
+ * @brief Gets the event queue statistics.
+ * 
+ * @param fsm 
+ * @param stats Filled with the counters since init or the last reset
+ * @return int 
+ */
+int fsm_stats_get(fsm_t *fsm, fsm_stats_t *stats);
+
+/**
+ * @brief Resets the event queue statistics.
+ * 
+ * @param fsm 
+ */
+void fsm_stats_reset(fsm_t *fsm);
+
+/**
+ * @brief Runs the state machine.
+ * 
+ * @details Process ALL pending events and then runs the current state once per call.
+ * 
+ * @param fsm 
+ * @return int 
+ */
+int fsm_run(fsm_t *fsm);
+
+/**
+ * @brief Runs the state machine with a budget, so a fsm with a backlog does
+ * not starve the others sharing the thread.
+ * 
+ * @details Processes pending events until max_events were handled or max_ns
+ * elapsed, then runs the current state once. Each event runs to completion,
+ * the time is checked between events. With a time budget events are taken
+ * from the queue one at a time. Without a monotonic clock (fsm_trace_ns
+ * returns 0) only max_events applies.
+ * 
+ * @param fsm 
+ * @param max_events Max events handled, 0 for no limit
+ * @param max_ns     Max time spent on events in ns, 0 for no limit
+ * @return int 1 when events are still pending, 0 when the queue is drained
+ * or the fsm terminated, -1 on invalid arguments
+ */
+int fsm_run_budget(fsm_t *fsm, uint32_t max_events, uint64_t max_ns);
+
+/**
+ * @brief Frees the resources of the event queue (FreeRTOS queue, eventfd).
+ * 
+ * @details With FSM_EXEC, a fsm run by an executor is taken out of it
+ * first, see fsm_exec_remove. The definition compiled by fsm_init is freed with its
+ * last instance.
+ * 
+ * @param fsm 
+ */
+void fsm_deinit(fsm_t *fsm);
+
+/**
+ * @brief Writes the state of a fsm in a compact binary record, to bring it
+ * back with fsm_restore after a restart.
+ * 
+ * @details The record holds the current state, the time elapsed in it, the
+ * terminate status and the pending events, in the order they would be
+ * handled. Events keep their id, lane and inline payload, their data
+ * pointers are not saved. The queue is read without taking the events out,
+ * call it from the thread running the fsm, with no dispatch going on.
+ * 
+ * @param fsm 
+ * @param buff 
+ * @param len   FSM_SNAPSHOT_SIZE of the pending events is always enough
+ * @return int Bytes written, -1 on invalid arguments, -2 if the record does not fit in len
+ */
+int fsm_snapshot(fsm_t *fsm, void *buff, size_t len);
+
+/**
+ * @brief Inits a fsm from a record written by fsm_snapshot, straight in the
+ * saved state.
+ * 
+ * @details Same as fsm_init_def, but no entry action runs. The timeout of
+ * the state keeps the time left when the snapshot was taken, attach the fsm
+ * to its timer wheel afterwards. Restored events carry no data, the
+ * timeouts get initial_data. Events that no longer fit in the queue are
+ * counted as dropped.
+ * 
+ * @param fsm               fsm pointer
+ * @param def               Definition of the fsm saved
+ * @param time_period_ticks Timer hook period (ticks / ms), can be 0
+ * @param initial_data      User custom data struct pointer
+ * @param config            Configuration, NULL for the defaults of fsm_init
+ * @param buff              Record
+ * @param len               Bytes of the record
+ * @return int 0 on success, same errors as fsm_init_def, -6 if the record is
+ * not valid for this definition or has another FSM_SNAPSHOT_VERSION
+ */
+int fsm_restore(fsm_t *fsm, 
+            const fsm_def_t *def, 
+            uint32_t time_period_ticks,
+            void *initial_data,
+            const fsm_config_t *config,
+            const void *buff,
+            size_t len);
+
+#ifdef FSM_POSIX_API
+/**
+ * @brief Waits until an event is pending or the state times out, then runs the fsm.
+ * 
+ * @details The state timeout is only waited for in FSM_TIMER_DEADLINE mode
+ * with a clock in ms.
+ * 
+ * @param fsm 
+ * @param timeout_ms Max time to wait, -1 waits forever
+ * @return int Same as fsm_run
+ */
+int fsm_run_wait(fsm_t *fsm, int timeout_ms);
+
+/**
+ * @brief Gets the eventfd of the fsm, readable while events are pending.
+ * 
+ * @details Meant for epoll loops, call fsm_run once it is readable.
+ * 
+ * @param fsm 
+ * @return int File descriptor, or -1
+ */
+int fsm_event_fd(fsm_t *fsm);
+
+/**
+ * @brief Creates a timerfd expiring every period_ms, a tick source for
+ * fsm_ticks_hook or fsm_wheel_tick.
+ * 
+ * @param period_ms 
+ * @return int File descriptor, or -1 on error
+ */
+int fsm_tick_fd_create(uint32_t period_ms);
+
+/**
+ * @brief Reads a tick source.
+ * 
+ * @param fd 
+ * @return uint32_t Ticks elapsed since the last read
+ */
+uint32_t fsm_tick_fd_read(int fd);
+#endif
+
+/**
+ * @brief Gets the number of dispatches merged in the event being handled,
+ * to be called from an action.
+ * 
+ * @param fsm 
+ * @return uint32_t 1 when the event was not coalesced
+ */
+uint32_t fsm_event_count(fsm_t *fsm);
+
+/**
+ * @brief Gets the current active state ID.
+ * 
+ * @param fsm 
+ * @return int 
+ */
+int fsm_state_get(fsm_t *fsm);
+
+/**
+ * @brief Terminates the state machine.
+ * 
+ * @details Called from an action, the events of the batch being handled
+ * are dropped and counted in fsm_stats_t.dropped.
+ * 
+ * @param fsm 
+ * @param val 
+ */
+void fsm_terminate(fsm_t *fsm, int val);
+
+/**
+ * @brief Gets the number of pending events in the fsm
+ * 
+ * @param fsm 
+ * @return int 
+ */
+int fsm_has_pending_events(fsm_t *fsm);
+
+/**
+ * @brief Fluches all pending events. 
+ * 
+ * @details Called from an action, the events of the batch being handled
+ * are dropped too and counted in fsm_stats_t.dropped.
+ * 
+ * @param fsm 
+ */
+void fsm_flush_events(fsm_t *fsm);
+
+/**
+ * @brief Updates timed events.
+ * 
+ * @details Does nothing when the fsm is attached to a timer wheel or runs
+ * in FSM_TIMER_DEADLINE mode.
+ * 
+ * @param fsm 
+ * @param data 
+ */
+void fsm_ticks_hook(fsm_t *fsm);
+
+/**
+ * @brief Gets the time when the current state times out (FSM_TIMER_DEADLINE).
+ * 
+ * @param fsm 
+ * @return uint64_t Absolute time, or FSM_NO_DEADLINE if no timeout is armed
+ */
+uint64_t fsm_next_deadline(fsm_t *fsm);
+
+/**
+ * @brief Gets the earliest state timeout of a group of fsm.
+ * 
+ * @param fsms 
+ * @param num 
+ * @return uint64_t Absolute time, or FSM_NO_DEADLINE if no timeout is armed
+ */
+uint64_t fsm_next_deadline_n(fsm_t *const *fsms, size_t num);
+
+/**
+ * @brief Delivers FSM_TIMEOUT_EV to every fsm of the group whose deadline is due.
+ * 
+ * @details Meant to be called by an event loop once it wakes up at the time
+ * returned by fsm_next_deadline_n.
+ * 
+ * @param fsms 
+ * @param num 
+ * @param now Current time of the fsm clock
+ * @return int Number of timeouts delivered
+ */
+int fsm_expire(fsm_t *const *fsms, size_t num, uint64_t now);
+
+/**
+ * @brief Ends the exit half of a transition, called by the dispatchers
+ * generated by tools/fsm_2_c.py after the exit actions.
+ * 
+ * @param fsm 
+ * @param exit_actor_id Common parent of the source and target states, its exit actors run
+ * @param num_exited    States left
+ * @param data 
+ */
+void fsm_compiled_exit(fsm_t *fsm, int exit_actor_id, uint32_t num_exited, void *data);
+
+/**
+ * @brief Ends a transition, called by the dispatchers generated by
+ * tools/fsm_2_c.py after the entry actions.
+ * 
+ * @param fsm 
+ * @param entry_actor_id Target state, its entry actors run
+ * @param target_leaf    State active from now on
+ * @param num_exited     States left, the state timer restarts when not 0
+ * @param data 
+ */
+void fsm_compiled_enter(fsm_t *fsm, int entry_actor_id, int target_leaf, uint32_t num_exited, void *data);
+
+/**
+ * @brief Delivers the timeout of the current state, called when its period expires.
+ * 
+ * @param fsm 
+ */
+void fsm_timeout_dispatch(fsm_t *fsm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM_H_ */
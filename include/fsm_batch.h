@@ -0,0 +1,139 @@
+/**
+ * @file fsm_batch.h
+ * @author Mauro Medina
+ * @brief Batch engine running many instances of one machine, stored as arrays
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef FSM_BATCH_H_
+#define FSM_BATCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fsm.h"
+
+//----------------------------------------------------------------------
+//	DEFINES
+//----------------------------------------------------------------------
+
+#ifndef FSM_BATCH_WAVE
+// Max events whose routes are looked up and grouped at once
+#define FSM_BATCH_WAVE 256
+#endif
+
+// Bytes of storage for num instances
+#define FSM_BATCH_BUFF_SIZE(num) ((size_t)(num) * 3 * sizeof(uint32_t))
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+
+typedef struct {
+    uint32_t instance;
+    uint32_t event;
+} fsm_batch_event_t;
+
+typedef struct {
+    // Machine definition of every instance
+    const fsm_def_t *def;
+    // Number of instances
+    uint32_t num;
+    // State id of every instance
+    uint32_t *state;
+    // Ticks elapsed in the state of every instance
+    uint32_t *t_elapsed;
+    // Last wave that took an event of every instance
+    uint32_t *wave;
+    uint32_t wave_id;
+    // Instance whose actions are running
+    uint32_t instance;
+    // Given to the actions as self, in the state of that instance
+    fsm_t proxy;
+#ifdef FSM_COMPACT
+    fsm_ext_t proxy_ext;
+#endif
+} fsm_batch_t;
+
+//----------------------------------------------------------------------
+//	FUNCTIONS
+//----------------------------------------------------------------------
+
+/**
+ * @brief Inits num instances of a definition in their initial state.
+ *
+ * @details The entry actions of the initial state run for every instance.
+ * Meant for simple machines: there are no actors, run actions, event queue
+ * or terminate, events are handled by fsm_batch_process right away.
+ *
+ * @param batch
+ * @param def   Definition compiled by fsm_def_init
+ * @param num   Number of instances
+ * @param buff  FSM_BATCH_BUFF_SIZE(num) bytes, 4 bytes aligned
+ * @param data  Data given to all the actions
+ * @return int 0 on success, -1 on invalid arguments
+ */
+int fsm_batch_init(fsm_batch_t *batch, const fsm_def_t *def, uint32_t num, void *buff, void *data);
+
+/**
+ * @brief Handles a vector of events, each one for an instance.
+ *
+ * @details The next states are looked up for many events at once, with
+ * AVX2 gathers when built with it, then the actions run grouped by
+ * transition: each exit, transition and entry action is called for all the
+ * instances taking that transition. Events of the same instance are
+ * handled in order. Events for instances out of range are ignored.
+ *
+ * Actions get the proxy fsm_t of the batch as self, fsm_state_get works on
+ * it and fsm_batch_instance tells the instance. The proxy has no event
+ * queue: fsm_dispatch and the other dispatch functions reject it with
+ * FSM_DISPATCH_INVALID. Events raised by an action go in the next call.
+ *
+ * @param batch
+ * @param evs
+ * @param n     Number of events
+ * @return int Number of transitions taken, or -1 on invalid arguments
+ */
+int fsm_batch_process(fsm_batch_t *batch, const fsm_batch_event_t *evs, size_t n);
+
+/**
+ * @brief Updates the timed events of all the instances, as fsm_ticks_hook
+ * does for one fsm.
+ *
+ * @details The instances whose state times out handle FSM_TIMEOUT_EV
+ * before it returns.
+ *
+ * @param batch
+ * @return int Number of timeouts handled, or -1 on invalid arguments
+ */
+int fsm_batch_tick(fsm_batch_t *batch);
+
+/**
+ * @brief Gets the instance whose action is running.
+ *
+ * @param self  fsm given to the action
+ * @return uint32_t
+ */
+uint32_t fsm_batch_instance(fsm_t *self);
+
+/**
+ * @brief Gets the state id of an instance.
+ *
+ * @param batch
+ * @param instance
+ * @return int FSM_ST_NONE if out of range
+ */
+int fsm_batch_state_get(fsm_batch_t *batch, uint32_t instance);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM_BATCH_H_ */
@@ -0,0 +1,111 @@
+/**
+ * @file fsm_bus.h
+ * @author Mauro Medina
+ * @brief Publish/subscribe bus delivering events to the interested state machines
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef FSM_BUS_H_
+#define FSM_BUS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "fsm.h"
+
+//----------------------------------------------------------------------
+//	DEFINES
+//----------------------------------------------------------------------
+
+#ifndef FSM_BUS_MAX_SUBS
+// Max subscriptions of a bus, one per fsm and event id it has a transition for
+#define FSM_BUS_MAX_SUBS 256
+#endif
+
+// Event ids a bus can publish
+#define FSM_BUS_EVENTS (FSM_MAX_EVENTS + FSM_EV_FIRST)
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+
+typedef struct {
+    // Subscribers of event e are subs[first[e]] up to subs[first[e + 1]], grouped by executor
+    uint16_t first[FSM_BUS_EVENTS + 1];
+    fsm_t* subs[FSM_BUS_MAX_SUBS];
+    uint32_t num_subs;
+} fsm_bus_t;
+
+//----------------------------------------------------------------------
+//	FUNCTIONS
+//----------------------------------------------------------------------
+
+/**
+ * @brief Inits an empty bus.
+ *
+ * @param bus
+ * @return int 0 on success, -1 on invalid arguments
+ */
+int fsm_bus_init(fsm_bus_t *bus);
+
+/**
+ * @brief Subscribes a fsm to every event id found in its transitions.
+ *
+ * @details The lists of subscribers are built here, not while publishing,
+ * so subscribe and unsubscribe must not run with a publish. Subscribe the
+ * fsm after fsm_exec_add, the subscribers of each executor are kept
+ * together. Subscribing twice does nothing.
+ *
+ * The fsm takes one entry per event id, and is subscribed to all of them or
+ * to none: when the entries left are not enough it gets no event from the
+ * bus. Unsubscribe others or build with a larger FSM_BUS_MAX_SUBS.
+ *
+ * @param bus
+ * @param fsm   Initialized fsm
+ * @return int 0 on success, -1 on invalid arguments, -2 if the fsm does not
+ * fit in the FSM_BUS_MAX_SUBS entries left, nothing is subscribed then
+ */
+int fsm_bus_subscribe(fsm_bus_t *bus, fsm_t *fsm);
+
+/**
+ * @brief Removes a fsm from every list of the bus.
+ *
+ * @param bus
+ * @param fsm
+ * @return int 0 on success, -1 on invalid arguments
+ */
+int fsm_bus_unsubscribe(fsm_bus_t *bus, fsm_t *fsm);
+
+/**
+ * @brief Dispatches an event to its subscribers only, with fsm_dispatch_many.
+ *
+ * @details Can run on any thread the subscribers accept fsm_dispatch from,
+ * many publishers at once.
+ *
+ * @param bus
+ * @param event
+ * @param data  Shared by all the subscribers
+ * @return int Number of subscribers that accepted the event, or -1 on invalid arguments
+ */
+int fsm_bus_publish(fsm_bus_t *bus, uint32_t event, void *data);
+
+/**
+ * @brief Gets the number of subscribers of an event id.
+ *
+ * @param bus
+ * @param event
+ * @return uint32_t
+ */
+uint32_t fsm_bus_subscribers(fsm_bus_t *bus, uint32_t event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM_BUS_H_ */
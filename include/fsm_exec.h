@@ -0,0 +1,153 @@
+/**
+ * @file fsm_exec.h
+ * @author Mauro Medina
+ * @brief Multi-threaded executor running many state machines
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef FSM_EXEC_H_
+#define FSM_EXEC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+
+//----------------------------------------------------------------------
+//	DEFINES
+//----------------------------------------------------------------------
+
+#ifndef FSM_EXEC_MAX_WORKERS
+// Max number of worker threads of an executor
+#define FSM_EXEC_MAX_WORKERS 16
+#endif
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+struct fsm_t;
+typedef struct fsm_exec_t fsm_exec_t;
+
+typedef struct {
+    // Runnable fsm, linked through fsm_t
+    struct fsm_t* head;
+    struct fsm_t* tail;
+    pthread_mutex_t lock;
+    pthread_t thread;
+    fsm_exec_t* exec;
+    uint32_t id;
+    // fsm being run, NULL between runs
+    struct fsm_t* running;
+    // fsm run by this worker, and taken from other workers
+    uint32_t runs;
+    uint32_t steals;
+} fsm_exec_worker_t;
+
+struct fsm_exec_t {
+    fsm_exec_worker_t workers[FSM_EXEC_MAX_WORKERS];
+    uint32_t num_workers;
+    // Worker receiving the fsm made runnable outside the executor
+    uint32_t next_worker;
+    // fsm waiting in the run queues
+    uint32_t num_runnable;
+    // Idle workers sleep here
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle;
+    uint32_t num_sleeping;
+    uint32_t stop;
+    // Set once all the workers are joined
+    uint32_t stopped;
+};
+
+typedef struct {
+    // fsm run, and taken from another worker queue
+    uint32_t runs;
+    uint32_t steals;
+} fsm_exec_stats_t;
+
+//----------------------------------------------------------------------
+//	FUNCTIONS
+//----------------------------------------------------------------------
+
+/**
+ * @brief Inits an executor and starts its workers.
+ *
+ * @details Needs FSM_EXEC for every source of the build, fsm_t only has
+ * the executor links with it.
+ *
+ * @param exec
+ * @param num_workers Worker threads, 0 for one per online CPU
+ * @return int 0 on success, -1 on invalid arguments, -2 if a thread can not be created
+ */
+int fsm_exec_init(fsm_exec_t *exec, uint32_t num_workers);
+
+/**
+ * @brief Hands a fsm to the executor, its workers run it from now on.
+ *
+ * @details The fsm becomes runnable every time fsm_dispatch queues an event
+ * or a timeout expires, and it is run by one worker at a time, so actions
+ * still run to completion. Its event queue has to be FSM_QUEUE_MPSC, events
+ * come from any thread.
+ *
+ * @param exec
+ * @param fsm
+ * @return int 0 on success, -1 on invalid arguments, -2 if the queue is not FSM_QUEUE_MPSC
+ */
+int fsm_exec_add(fsm_exec_t *exec, struct fsm_t *fsm);
+
+/**
+ * @brief Takes a fsm out of its executor, its workers do not touch it any more.
+ *
+ * @details A queued fsm is unlinked from its worker, a running one is waited
+ * for until the run ends, events left in its queue stay there. Called by
+ * fsm_deinit. Dispatches to the fsm must be over, and it can not be called
+ * from an action of the fsm itself.
+ *
+ * @param fsm
+ * @return int 0 on success, also when it is not in an executor, -1 on invalid arguments,
+ * -2 if called while its worker runs it
+ */
+int fsm_exec_remove(struct fsm_t *fsm);
+
+/**
+ * @brief Makes a fsm runnable, called by fsm_dispatch.
+ *
+ * @param fsm
+ */
+void fsm_exec_notify(struct fsm_t *fsm);
+
+/**
+ * @brief Makes many fsm runnable, the ones of the same executor are handed
+ * to one worker at once, with a single wake up of the idle workers.
+ *
+ * @param fsms
+ * @param num
+ */
+void fsm_exec_notify_n(struct fsm_t *const *fsms, uint32_t num);
+
+/**
+ * @brief Gets the runs and steals of all the workers.
+ *
+ * @param exec
+ * @param stats
+ * @return int
+ */
+int fsm_exec_stats_get(fsm_exec_t *exec, fsm_exec_stats_t *stats);
+
+/**
+ * @brief Stops the workers and waits for them, fsm still runnable are not run.
+ *
+ * @param exec
+ */
+void fsm_exec_stop(fsm_exec_t *exec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM_EXEC_H_ */
@@ -0,0 +1,129 @@
+/**
+ * @file fsm_latency.h
+ * @author Mauro Medina
+ * @brief Histograms of the time events wait in the queue
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef FSM_LATENCY_H_
+#define FSM_LATENCY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+//----------------------------------------------------------------------
+//	DEFINES
+//----------------------------------------------------------------------
+
+#ifndef FSM_LATENCY_SUB_BITS
+// Linear buckets per power of 2 = 2^FSM_LATENCY_SUB_BITS, 12% resolution with 3
+#define FSM_LATENCY_SUB_BITS 3
+#endif
+
+#ifndef FSM_LATENCY_BITS
+// Latencies up to 2^FSM_LATENCY_BITS cycles, longer ones go to the last bucket
+#define FSM_LATENCY_BITS 40
+#endif
+
+#define FSM_LATENCY_BUCKETS ((FSM_LATENCY_BITS - FSM_LATENCY_SUB_BITS + 1) << FSM_LATENCY_SUB_BITS)
+
+// fsm_latency_get merges the histograms of all the events
+#define FSM_LATENCY_ALL UINT32_MAX
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+struct fsm_t;
+
+// Log-linear histogram of one event id, in cycles
+typedef struct {
+    uint32_t count[FSM_LATENCY_BUCKETS];
+    uint64_t max;
+} fsm_latency_hist_t;
+
+typedef struct {
+    // One histogram per event id
+    fsm_latency_hist_t* hists;
+    uint32_t num;
+    // Clock and cycle counter at init, to convert cycles to ns
+    uint64_t start_ns;
+    uint64_t start_cycles;
+} fsm_latency_t;
+
+typedef struct {
+    // Events measured
+    uint32_t count;
+    // ns, or cycles when the counter frequency is unknown
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} fsm_latency_summary_t;
+
+//----------------------------------------------------------------------
+//	FUNCTIONS
+//----------------------------------------------------------------------
+
+/**
+ * @brief Inits the latency histograms of a fsm.
+ *
+ * @param latency
+ * @param hists Histograms buffer, one per event id
+ * @param num   Number of histograms, events with a bigger id are not measured
+ * @return int 0 on success, -1 on invalid arguments
+ */
+int fsm_latency_init(fsm_latency_t *latency, fsm_latency_hist_t *hists, uint32_t num);
+
+/**
+ * @brief Measures the time every event of the fsm waits in its queue, from
+ * fsm_dispatch (or the timeout) until fsm_run handles it.
+ *
+ * @details Needs FSM_LATENCY_STATS, otherwise nothing is measured. Many fsm
+ * can share one fsm_latency_t, also when they run on different threads.
+ * A NULL latency stops the measures.
+ *
+ * @param fsm
+ * @param latency
+ * @return int 0 on success, -1 on invalid arguments, -2 if built without FSM_LATENCY_STATS
+ */
+int fsm_latency_attach(struct fsm_t *fsm, fsm_latency_t *latency);
+
+/**
+ * @brief Adds a measure, called by the fsm for every event handled.
+ *
+ * @param latency
+ * @param event
+ * @param cycles    Time waited in the queue
+ */
+void fsm_latency_record(fsm_latency_t *latency, uint32_t event, uint64_t cycles);
+
+/**
+ * @brief Gets the percentiles of an event, can run while the fsm runs.
+ *
+ * @details Percentiles are the upper bound of their bucket.
+ *
+ * @param latency
+ * @param event     Event id, or FSM_LATENCY_ALL
+ * @param summary
+ * @return int 0 on success, -1 on invalid arguments
+ */
+int fsm_latency_get(fsm_latency_t *latency, uint32_t event, fsm_latency_summary_t *summary);
+
+/**
+ * @brief Clears all the histograms.
+ *
+ * @param latency
+ */
+void fsm_latency_reset(fsm_latency_t *latency);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM_LATENCY_H_ */
@@ -0,0 +1,107 @@
+/**
+ * @file fsm_pool.h
+ * @author Mauro Medina
+ * @brief Lock-free pool of reference counted payloads
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef FSM_POOL_H_
+#define FSM_POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+//----------------------------------------------------------------------
+//	DEFINES
+//----------------------------------------------------------------------
+
+// Space taken by one block of block_size bytes, header included
+#define FSM_POOL_BLOCK_SIZE(block_size) (sizeof(fsm_pool_block_t) + (((block_size) + 7u) & ~7u))
+
+// Space needed by fsm_pool_init for num blocks of block_size bytes
+#define FSM_POOL_BUFF_SIZE(block_size, num) ((num) * FSM_POOL_BLOCK_SIZE(block_size))
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+typedef struct fsm_pool_t fsm_pool_t;
+
+// Header in front of every payload
+typedef struct {
+    fsm_pool_t* pool;
+    // References held, 0 while the block is free
+    uint32_t refs;
+    // Next free block + 1, 0 for none
+    uint32_t next;
+} __attribute__((aligned(8))) fsm_pool_block_t;
+
+struct fsm_pool_t {
+    uint8_t* buff;
+    uint32_t stride;
+    uint32_t num;
+    // Free list, a tag against ABA in the high half and the first free block + 1 in the low half
+    uint64_t head;
+    uint32_t num_free;
+};
+
+//----------------------------------------------------------------------
+//	FUNCTIONS
+//----------------------------------------------------------------------
+
+/**
+ * @brief Inits a pool of fixed size blocks.
+ *
+ * @param pool
+ * @param buff       FSM_POOL_BUFF_SIZE(block_size, num) bytes, 8 bytes aligned
+ * @param block_size Payload bytes of every block
+ * @param num        Number of blocks
+ * @return int 0 on success, -1 on invalid arguments
+ */
+int fsm_pool_init(fsm_pool_t *pool, void *buff, uint32_t block_size, uint32_t num);
+
+/**
+ * @brief Takes a free payload from the pool, safe to call from any thread.
+ *
+ * @details The caller holds the only reference, and gives it back with
+ * fsm_pool_release once the payload is dispatched.
+ *
+ * @param pool
+ * @return void* The payload, or NULL when the pool is empty
+ */
+void *fsm_pool_acquire(fsm_pool_t *pool);
+
+/**
+ * @brief Adds a reference to a payload, fsm_dispatch_pooled does it for
+ * every event queued.
+ *
+ * @param payload
+ */
+void fsm_pool_retain(void *payload);
+
+/**
+ * @brief Drops a reference, the payload goes back to its pool with the last one.
+ *
+ * @param payload
+ */
+void fsm_pool_release(void *payload);
+
+/**
+ * @brief Gets the number of free payloads, a snapshot when other threads
+ * use the pool.
+ *
+ * @param pool
+ * @return uint32_t
+ */
+uint32_t fsm_pool_available(fsm_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM_POOL_H_ */
@@ -0,0 +1,137 @@
+/**
+ * @file fsm_timer.h
+ * @author Mauro Medina
+ * @brief Hierarchical timer wheel shared by many state machines
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef FSM_TIMER_H_
+#define FSM_TIMER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+//----------------------------------------------------------------------
+//	DEFINES
+//----------------------------------------------------------------------
+
+#ifndef FSM_WHEEL_BITS
+// Slots per level = 2^FSM_WHEEL_BITS
+#define FSM_WHEEL_BITS 6
+#endif
+
+#ifndef FSM_WHEEL_LEVELS
+// Levels of the wheel, timers up to 2^(FSM_WHEEL_BITS*FSM_WHEEL_LEVELS) ticks
+#define FSM_WHEEL_LEVELS 4
+#endif
+
+#define FSM_WHEEL_SLOTS (1u << FSM_WHEEL_BITS)
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+struct fsm_t;
+typedef struct fsm_wheel_t fsm_wheel_t;
+typedef struct fsm_timer_t fsm_timer_t;
+
+struct fsm_timer_t {
+    // Next timer in the slot
+    fsm_timer_t* next;
+    // Pointer to this timer in the slot, NULL when not armed
+    fsm_timer_t** pprev;
+    // Absolute tick of expiration
+    uint32_t expires;
+    // Wheel the timer belongs to, NULL when not attached
+    fsm_wheel_t* wheel;
+    // fsm whose state times out
+    struct fsm_t* fsm;
+};
+
+struct fsm_wheel_t {
+    // Ticks elapsed
+    uint32_t now;
+    // Spin lock, arming and ticking can run on different threads
+    uint32_t lock;
+    // Timers waiting in each level
+    fsm_timer_t* slots[FSM_WHEEL_LEVELS][FSM_WHEEL_SLOTS];
+    // Timers expired, waiting to be delivered
+    fsm_timer_t* expired;
+};
+
+//----------------------------------------------------------------------
+//	FUNCTIONS
+//----------------------------------------------------------------------
+
+/**
+ * @brief Inits a timer wheel.
+ *
+ * @param wheel
+ */
+void fsm_wheel_init(fsm_wheel_t *wheel);
+
+/**
+ * @brief Attaches a fsm to the wheel, its state timeouts are then driven by
+ * fsm_wheel_tick instead of fsm_ticks_hook.
+ *
+ * @details The timer of the current state is armed with the ticks left of
+ * its period, t_elapsed is only non zero for a fsm restored by fsm_restore
+ * or ticked by fsm_ticks_hook before.
+ *
+ * @param wheel
+ * @param fsm
+ * @return int 0 on success, -1 on invalid arguments
+ */
+int fsm_wheel_attach(fsm_wheel_t *wheel, struct fsm_t *fsm);
+
+/**
+ * @brief Detaches a fsm from its wheel, cancelling its timer.
+ *
+ * @param fsm
+ */
+void fsm_wheel_detach(struct fsm_t *fsm);
+
+/**
+ * @brief Advances the wheel one tick and delivers FSM_TIMEOUT_EV to the fsm
+ * whose timer expired.
+ *
+ * @details Only the timers expiring in this tick are visited, plus the
+ * timers moved down from an upper level once every 2^FSM_WHEEL_BITS ticks.
+ *
+ * @param wheel
+ */
+void fsm_wheel_tick(fsm_wheel_t *wheel);
+
+/**
+ * @brief Arms a timer to expire in ticks from now, re-arming it if needed.
+ *
+ * @param timer Timer attached to a wheel
+ * @param ticks
+ */
+void fsm_wheel_timer_arm(fsm_timer_t *timer, uint32_t ticks);
+
+/**
+ * @brief Gets the ticks left until a timer expires.
+ *
+ * @param timer
+ * @return uint32_t 0 when the timer is not armed
+ */
+uint32_t fsm_wheel_timer_remaining(fsm_timer_t *timer);
+
+/**
+ * @brief Cancels a timer, nothing happens if it is not armed.
+ *
+ * @param timer
+ */
+void fsm_wheel_timer_cancel(fsm_timer_t *timer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM_TIMER_H_ */
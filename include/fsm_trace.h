@@ -0,0 +1,173 @@
+/**
+ * @file fsm_trace.h
+ * @author Mauro Medina
+ * @brief Transition trace records with cycle counts
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef FSM_TRACE_H_
+#define FSM_TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#if !defined(__x86_64__) && !defined(__i386__) && !defined(__aarch64__) && !defined(__XTENSA__) && \
+    (defined(__unix__) || defined(__APPLE__))
+#include <time.h>
+#endif
+
+//----------------------------------------------------------------------
+//	DEFINES
+//----------------------------------------------------------------------
+
+// First bytes of a trace file, "FSMT"
+#define FSM_TRACE_MAGIC     0x544d5346u
+#define FSM_TRACE_VERSION   1
+
+//----------------------------------------------------------------------
+//	DECLARATIONS
+//----------------------------------------------------------------------
+struct fsm_t;
+
+// One transition taken, 32 bytes
+typedef struct {
+    // Cycle counter when the transition started
+    uint64_t timestamp;
+    // Id given by fsm_trace_attach
+    uint32_t fsm_id;
+    uint16_t event;
+    uint8_t source;
+    uint8_t target;
+    // Cycles spent in the exit actions, the transition action and the entry actions
+    uint32_t exit_cycles;
+    uint32_t transition_cycles;
+    uint32_t entry_cycles;
+    // Write index + 1, 0 while the record is being written
+    uint32_t seq;
+} fsm_trace_record_t;
+
+typedef struct {
+    // Records, power of 2
+    fsm_trace_record_t* records;
+    uint32_t len;
+    // Records written since init, the oldest ones are overwritten
+    uint32_t head;
+    // Clock and cycle counter at init, to convert cycles to time
+    uint64_t start_ns;
+    uint64_t start_cycles;
+} fsm_trace_t;
+
+// Header of a trace file, followed by num records
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    // Cycle counter frequency, 0 if unknown
+    uint64_t cycles_hz;
+    uint32_t num;
+    uint32_t reserved;
+} fsm_trace_header_t;
+
+//----------------------------------------------------------------------
+//	FUNCTIONS
+//----------------------------------------------------------------------
+
+/**
+ * @brief Reads the cycle counter of the CPU, a monotonic clock in ns where
+ * there is none.
+ *
+ * @return uint64_t
+ */
+static inline uint64_t fsm_trace_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t val;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+#elif defined(__XTENSA__)
+    uint32_t val;
+    __asm__ volatile("rsr %0, ccount" : "=a"(val));
+    return val;
+#elif defined(__unix__) || defined(__APPLE__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Reads the monotonic clock in ns, 0 where there is none.
+ *
+ * @return uint64_t
+ */
+uint64_t fsm_trace_ns(void);
+
+/**
+ * @brief Inits a trace ring.
+ *
+ * @param trace
+ * @param records   Records buffer
+ * @param len       Number of records, power of 2
+ * @return int 0 on success, -1 on invalid arguments, -2 if len is not a power of 2
+ */
+int fsm_trace_init(fsm_trace_t *trace, fsm_trace_record_t *records, uint32_t len);
+
+/**
+ * @brief Records every transition of the fsm in the trace ring.
+ *
+ * @details Needs FSM_TRACE, otherwise nothing is recorded. Many fsm can
+ * share a ring, also from different threads, the id tells them apart.
+ * A NULL trace stops the recording.
+ *
+ * @param fsm
+ * @param trace
+ * @param id    Written in every record
+ * @return int 0 on success, -1 on invalid arguments, -2 if built without FSM_TRACE
+ */
+int fsm_trace_attach(struct fsm_t *fsm, fsm_trace_t *trace, uint32_t id);
+
+/**
+ * @brief Adds a record to the ring, called by the fsm on every transition.
+ *
+ * @param trace
+ * @param record
+ */
+void fsm_trace_write(fsm_trace_t *trace, const fsm_trace_record_t *record);
+
+/**
+ * @brief Copies the records in the ring, oldest first.
+ *
+ * @details Can run while records are written, the ones overwritten during
+ * the copy are skipped.
+ *
+ * @param trace
+ * @param records   Destination
+ * @param max       Max number of records copied
+ * @return uint32_t Number of records copied
+ */
+uint32_t fsm_trace_read(fsm_trace_t *trace, fsm_trace_record_t *records, uint32_t max);
+
+/**
+ * @brief Fills the header of a trace file, written before the records
+ * given by fsm_trace_read for tools/fsm_trace_decode.py.
+ *
+ * @param trace
+ * @param header
+ * @param num   Number of records following the header
+ */
+void fsm_trace_header_get(fsm_trace_t *trace, fsm_trace_header_t *header, uint32_t num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM_TRACE_H_ */
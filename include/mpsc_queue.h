@@ -0,0 +1,147 @@
+/**
+ * @file mpsc_queue.h
+ * @author Mauro Medina
+ * @brief Lock-free multi-producer single-consumer queue library
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef MPSC_QUEUE_H_
+#define MPSC_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * \addtogroup doc_driver_hal_utils_mpsc_queue
+ *
+ * @{
+ */
+
+#ifndef MPSC_QUEUE_CACHE_LINE
+#ifdef FSM_COMPACT
+/* No false sharing padding in compact builds, the queue lives in the fsm */
+#define MPSC_QUEUE_CACHE_LINE 4
+#else
+#define MPSC_QUEUE_CACHE_LINE 64
+#endif
+#endif
+
+/**
+ * \brief Offset of the data inside a slot, the sequence goes first
+ */
+#define MPSC_QUEUE_DATA_OFFSET 8
+
+/**
+ * \brief Size of one slot for elements of data_size bytes
+ */
+#define MPSC_QUEUE_SLOT_SIZE(data_size) ((MPSC_QUEUE_DATA_OFFSET + (data_size) + 7) & ~7u)
+
+/**
+ * \brief Space needed to store len elements of data_size bytes
+ */
+#define MPSC_QUEUE_BUF_SIZE(len, data_size) ((len) * MPSC_QUEUE_SLOT_SIZE(data_size))
+
+/**
+ * \brief MPSC queue element type
+ *
+ * Every slot carries a sequence number, producers claim a slot by moving
+ * the tail with a compare and swap and publish it by updating its sequence.
+ */
+struct mpsc_queue {
+	uint8_t  *buf;          /** Slots base address */
+	uint32_t len;           /** Number of slots, power of 2 */
+	uint32_t mask;          /** len - 1 */
+	uint32_t data_size;     /** Data size */
+	uint32_t slot_size;     /** Sequence + data size */
+	uint32_t head;          /** Consumer position */
+	uint8_t  pad[MPSC_QUEUE_CACHE_LINE];
+	uint32_t tail;          /** Producers position */
+};
+
+/**
+ * \brief MPSC queue init
+ *
+ * \param[in] q The pointer to a queue structure instance
+ * \param[in] buf Space to store the data, MPSC_QUEUE_BUF_SIZE(len, data_size) bytes
+ * \param[in] len The queue length, must be a power of 2
+ * \param[in] data_size Size of one element
+ *
+ * \return 0 on success, or -1 if len is not a power of 2.
+ */
+int32_t mpsc_queue_init(struct mpsc_queue *const q, void *buf, uint32_t len, uint32_t data_size);
+
+/**
+ * \brief Put one element in the queue, safe to call from any thread
+ *
+ * \param[in] q The pointer to a queue structure instance
+ * \param[in] data Element to be copied into the queue
+ *
+ * \return 0 on success, or -1 if the queue is full.
+ */
+int32_t mpsc_queue_put(struct mpsc_queue *const q, const void *data);
+
+/**
+ * \brief Put up to n elements in the queue with a single claim of the tail,
+ * safe to call from any thread
+ *
+ * \param[in] q The pointer to a queue structure instance
+ * \param[in] data Array of n elements to be copied into the queue
+ * \param[in] n Number of elements
+ *
+ * \return The number of elements put, the first ones of data. Less than n
+ * when the queue is full.
+ */
+uint32_t mpsc_queue_put_n(struct mpsc_queue *const q, const void *data, uint32_t n);
+
+/**
+ * \brief Get one element from the queue, only the consumer thread can call it
+ *
+ * \param[in] q The pointer to a queue structure instance
+ * \param[out] data Space to store the read element
+ *
+ * \return 0 on success, or -1 if the queue is empty.
+ */
+int32_t mpsc_queue_get(struct mpsc_queue *const q, void *data);
+
+/**
+ * \brief Copy an element without taking it out of the queue, only the
+ * consumer thread can call it
+ * \param[in] q The pointer to a queue structure instance
+ * \param[in] i Position of the element, 0 is the next one to get
+ * \param[out] data Space to store the element
+ * \return 0 on success, or -1 if there is no element published at i.
+ */
+int32_t mpsc_queue_peek(const struct mpsc_queue *const q, uint32_t i, void *data);
+
+/**
+ * \brief Return the element number of the queue
+ *
+ * \param[in] q The pointer to a queue structure instance
+ *
+ * \return The number of elements in the queue [0, q->len], a snapshot when
+ * producers are running
+ */
+uint32_t mpsc_queue_num(const struct mpsc_queue *const q);
+
+/**
+ * \brief Flush the queue, only the consumer thread can call it
+ *
+ * \param[in] q The pointer to a queue structure instance
+ *
+ * \return 0
+ */
+uint32_t mpsc_queue_flush(struct mpsc_queue *const q);
+
+/**@}*/
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* MPSC_QUEUE_H_ */
@@ -16,6 +16,8 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 /**
  * \addtogroup doc_driver_hal_utils_ringbuff
  *
@@ -27,10 +29,11 @@ extern "C" {
  */
 struct ringbuff {
 	uint8_t  *buf;           /** Buffer base address */
-	uint32_t len;          /** Buffer len */
+	uint32_t len;          /** Buffer len, power of 2 */
+	uint32_t mask;          /** len - 1 */
 	uint32_t data_size;     /** Data size */
-	uint8_t *p_read;    /** Buffer read index */
-	uint8_t *p_write;   /** Buffer write index */
+	uint32_t read_index;    /** Free running read index */
+	uint32_t write_index;   /** Free running write index */
 };
 
 /**
@@ -39,8 +42,9 @@ struct ringbuff {
  * \param[in] rb The pointer to a ring buffer structure instance
  * \param[in] buf Space to store the data
  * \param[in] len The buffer length, must be aligned with power of 2
+ * \param[in] data_size Size of one element
  *
- * \return ERR_NONE on success, or an error code on failure.
+ * \return ERR_NONE on success, or -1 if len is not a power of 2.
  */
 int32_t ringbuff_init(struct ringbuff *const rb, void *buf, uint32_t len, uint32_t data_size);
 
@@ -77,6 +81,29 @@ int32_t ringbuff_put(struct ringbuff *const rb, void *data);
  */
 int32_t ringbuff_put_first(struct ringbuff *const rb, void *data);
 
+/**
+ * \brief Get up to n elements from ring buffer in one call
+ *
+ * \param[in] rb The pointer to a ring buffer structure instance
+ * \param[out] data Space to store n elements
+ * \param[in] n Max number of elements to read
+ *
+ * \return The number of elements read
+ */
+uint32_t ringbuff_get_n(struct ringbuff *const rb, void *data, uint32_t n);
+
+/**
+ * \brief Put up to n elements to ring buffer in one call, old data is not
+ * overwritten
+ *
+ * \param[in] rb The pointer to a ring buffer structure instance
+ * \param[in] data Elements to be put into ring buffer
+ * \param[in] n Number of elements
+ *
+ * \return The number of elements put, less than n when the buffer is full
+ */
+uint32_t ringbuff_put_n(struct ringbuff *const rb, const void *data, uint32_t n);
+
 /**
  * \brief Return the element number of ring buffer
  *
@@ -96,6 +123,57 @@ uint32_t ringbuff_num(const struct ringbuff *const rb);
  */
 uint32_t ringbuff_flush(struct ringbuff *const rb);
 
+/**
+ * \brief Defines put/get functions for ring buffers of a given type, the
+ * element size is known at compile time so copies are plain assignments
+ *
+ * \param prefix Name prefix of the functions
+ * \param type Element type, sizeof(type) must match the data_size used in ringbuff_init
+ */
+#define RINGBUFF_TYPED_DEFINE(prefix, type)                                                 \
+static inline int32_t prefix##_get(struct ringbuff *const rb, type *data)                   \
+{                                                                                           \
+	if (rb->write_index == rb->read_index) {                                                \
+		return -1;                                                                          \
+	}                                                                                       \
+	*data = ((type *)rb->buf)[rb->read_index++ & rb->mask];                                 \
+	return 0;                                                                               \
+}                                                                                           \
+static inline int32_t prefix##_put(struct ringbuff *const rb, const type *data)             \
+{                                                                                           \
+	((type *)rb->buf)[rb->write_index++ & rb->mask] = *data;                                \
+	if ((rb->write_index - rb->read_index) > rb->len) {                                     \
+		rb->read_index++;                                                                   \
+	}                                                                                       \
+	return 0;                                                                               \
+}                                                                                           \
+static inline type *prefix##_last(struct ringbuff *const rb)                                \
+{                                                                                           \
+	if (rb->write_index == rb->read_index) {                                                \
+		return NULL;                                                                        \
+	}                                                                                       \
+	return &((type *)rb->buf)[(rb->write_index - 1) & rb->mask];                            \
+}                                                                                           \
+static inline uint32_t prefix##_get_n(struct ringbuff *const rb, type *data, uint32_t n)    \
+{                                                                                           \
+	uint32_t num = rb->write_index - rb->read_index;                                        \
+	if (n > num) {                                                                          \
+		n = num;                                                                            \
+	}                                                                                       \
+	for (uint32_t i = 0; i < n; i++) {                                                      \
+		data[i] = ((type *)rb->buf)[(rb->read_index + i) & rb->mask];                       \
+	}                                                                                       \
+	rb->read_index += n;                                                                    \
+	return n;                                                                               \
+}                                                                                           \
+static inline type *prefix##_peek(struct ringbuff *const rb, uint32_t i)                    \
+{                                                                                           \
+	if (i >= rb->write_index - rb->read_index) {                                            \
+		return NULL;                                                                        \
+	}                                                                                       \
+	return &((type *)rb->buf)[(rb->read_index + i) & rb->mask];                             \
+}
+
 /**@}*/
 
 #ifdef __cplusplus
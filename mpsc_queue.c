@@ -0,0 +1,206 @@
+/**
+ * @file mpsc_queue.c
+ * @author Mauro Medina
+ * @brief Lock-free multi-producer single-consumer queue library
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include "mpsc_queue.h"
+
+#define SLOT_GET(q, pos)    ((q)->buf + ((pos) & (q)->mask) * (q)->slot_size)
+#define SLOT_SEQ(slot)      ((uint32_t *)(slot))
+#define SLOT_DATA(slot)     ((slot) + MPSC_QUEUE_DATA_OFFSET)
+
+/**
+ * \brief MPSC queue init
+ */
+int32_t mpsc_queue_init(struct mpsc_queue *const q, void *buf, uint32_t len, uint32_t data_size)
+{
+	assert(q && buf && len);
+
+	if (len & (len - 1)) {
+		return -1;
+	}
+
+	q->buf       = (uint8_t *)buf;
+	q->len       = len;
+	q->mask      = len - 1;
+	q->data_size = data_size;
+	q->slot_size = MPSC_QUEUE_SLOT_SIZE(data_size);
+
+	/* Slot i is free for the producer at position i */
+	for (uint32_t i = 0; i < len; i++) {
+		__atomic_store_n(SLOT_SEQ(SLOT_GET(q, i)), i, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&q->head, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&q->tail, 0, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/**
+ * \brief Put one element in the queue
+ */
+int32_t mpsc_queue_put(struct mpsc_queue *const q, const void *data)
+{
+	assert(q && data);
+
+	uint32_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+	for (;;) {
+		uint8_t *slot = SLOT_GET(q, pos);
+		uint32_t seq  = __atomic_load_n(SLOT_SEQ(slot), __ATOMIC_ACQUIRE);
+		int32_t diff  = (int32_t)(seq - pos);
+
+		if (diff == 0) {
+			/* Slot is free, try to claim it */
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				memcpy(SLOT_DATA(slot), data, q->data_size);
+				__atomic_store_n(SLOT_SEQ(slot), pos + 1, __ATOMIC_RELEASE);
+				return 0;
+			}
+		} else if (diff < 0) {
+			/* Consumer has not released the slot yet: full */
+			return -1;
+		} else {
+			/* Another producer claimed it */
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/**
+ * \brief Put up to n consecutive elements in the queue
+ */
+uint32_t mpsc_queue_put_n(struct mpsc_queue *const q, const void *data, uint32_t n)
+{
+	assert(q && (data || !n));
+
+	uint32_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+	for (;;) {
+		uint32_t num = 0;
+		int32_t diff = 0;
+
+		/* Count the free slots from the tail */
+		while (num < n) {
+			uint32_t seq = __atomic_load_n(SLOT_SEQ(SLOT_GET(q, pos + num)), __ATOMIC_ACQUIRE);
+
+			diff = (int32_t)(seq - (pos + num));
+			if (diff != 0) {
+				break;
+			}
+			num++;
+		}
+
+		if (num == 0) {
+			if (diff < 0 || n == 0) {
+				/* Full */
+				return 0;
+			}
+			/* Another producer claimed it */
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		/* Claim all of them at once */
+		if (__atomic_compare_exchange_n(&q->tail, &pos, pos + num, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			for (uint32_t i = 0; i < num; i++) {
+				uint8_t *slot = SLOT_GET(q, pos + i);
+
+				memcpy(SLOT_DATA(slot), (const uint8_t *)data + i * q->data_size, q->data_size);
+				__atomic_store_n(SLOT_SEQ(slot), pos + i + 1, __ATOMIC_RELEASE);
+			}
+			return num;
+		}
+	}
+}
+
+/**
+ * \brief Get one element from the queue
+ */
+int32_t mpsc_queue_get(struct mpsc_queue *const q, void *data)
+{
+	assert(q && data);
+
+	uint32_t pos  = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	uint8_t *slot = SLOT_GET(q, pos);
+	uint32_t seq  = __atomic_load_n(SLOT_SEQ(slot), __ATOMIC_ACQUIRE);
+
+	/* Empty, or the producer did not publish it yet */
+	if (seq != pos + 1) {
+		return -1;
+	}
+
+	memcpy(data, SLOT_DATA(slot), q->data_size);
+
+	/* Release the slot for the producer one lap ahead */
+	__atomic_store_n(SLOT_SEQ(slot), pos + q->len, __ATOMIC_RELEASE);
+	__atomic_store_n(&q->head, pos + 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/**
+ * \brief Copy an element without taking it out of the queue
+ */
+int32_t mpsc_queue_peek(const struct mpsc_queue *const q, uint32_t i, void *data)
+{
+	assert(q && data);
+
+	uint32_t pos  = __atomic_load_n(&q->head, __ATOMIC_RELAXED) + i;
+	uint8_t *slot = SLOT_GET(q, pos);
+
+	/* Past the tail, or the producer did not publish it yet */
+	if (__atomic_load_n(SLOT_SEQ(slot), __ATOMIC_ACQUIRE) != pos + 1) {
+		return -1;
+	}
+	memcpy(data, SLOT_DATA(slot), q->data_size);
+
+	return 0;
+}
+
+/**
+ * \brief Return the element number of the queue
+ */
+uint32_t mpsc_queue_num(const struct mpsc_queue *const q)
+{
+	assert(q);
+
+	uint32_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	uint32_t num  = tail - head;
+
+	return (num > q->len) ? q->len : num;
+}
+
+/**
+ * \brief Flush the queue
+ */
+uint32_t mpsc_queue_flush(struct mpsc_queue *const q)
+{
+	assert(q);
+
+	uint32_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+
+	/* Release every published slot, like a get without the copy */
+	for (;;) {
+		uint8_t *slot = SLOT_GET(q, pos);
+
+		if (__atomic_load_n(SLOT_SEQ(slot), __ATOMIC_ACQUIRE) != pos + 1) {
+			break;
+		}
+		__atomic_store_n(SLOT_SEQ(slot), pos + q->len, __ATOMIC_RELEASE);
+		pos++;
+	}
+	__atomic_store_n(&q->head, pos, __ATOMIC_RELAXED);
+
+	return 0;
+}
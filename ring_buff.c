@@ -14,6 +14,8 @@
 
 #include "ring_buff.h"
 
+#define RB_SLOT(rb, index)	((rb)->buf + ((index) & (rb)->mask) * (rb)->data_size)
+
 /**
  * \brief Ringbuffer init
  */
@@ -22,10 +24,15 @@ int32_t ringbuff_init(struct ringbuff *const rb, void *buf, uint32_t len, uint32
 	assert(rb && buf && len);
 
 	/* len - 1 is faster in calculation */
+	if (len & (len - 1)) {
+		return -1;
+	}
+
 	rb->len         = len;
+	rb->mask        = len - 1;
 	rb->data_size   = data_size;
-	rb->p_read      = (uint8_t *)buf;
-	rb->p_write     = rb->p_read;
+	rb->read_index  = 0;
+	rb->write_index = 0;
 	rb->buf         = (uint8_t *)buf;
 
 	return 0;
@@ -39,13 +46,9 @@ int32_t ringbuff_get(struct ringbuff *const rb, void *data)
 {
 	assert(rb && data);
 
-	if (rb->p_write != rb->p_read) {
-        memcpy(data, (void*)rb->p_read, rb->data_size);
-		rb->p_read += rb->data_size;
-        if(rb->p_read >= ((uint8_t *)rb->buf + rb->data_size * rb->len))
-        {
-            rb->p_read = (uint8_t *)rb->buf;
-        }
+	if (rb->write_index != rb->read_index) {
+		memcpy(data, RB_SLOT(rb, rb->read_index), rb->data_size);
+		rb->read_index++;
 		return 0;
 	}
 
@@ -60,24 +63,16 @@ int32_t ringbuff_put(struct ringbuff *const rb, void *data)
 {
 	assert(rb);
 
-    memcpy(rb->p_write, data, rb->data_size);
+	memcpy(RB_SLOT(rb, rb->write_index), data, rb->data_size);
+	rb->write_index++;
 
-	rb->p_write += rb->data_size;
 	/*
 	 * buffer full strategy: new data will overwrite the oldest data in
 	 * the buffer
 	 */
-	if (rb->p_write >= ((uint8_t *)rb->buf + rb->data_size * rb->len)) {
-		rb->p_write = (uint8_t *)rb->buf;
+	if ((rb->write_index - rb->read_index) > rb->len) {
+		rb->read_index++;
 	}
-    if(rb->p_write == rb->p_read)
-    {
-        rb->p_read += rb->data_size;
-		if(rb->p_read >= ((uint8_t *)rb->buf + rb->data_size * rb->len))
-		{
-			rb->p_read = (uint8_t *)rb->buf;
-		}
-    }
 	return 0;
 }
 
@@ -89,34 +84,80 @@ int32_t ringbuff_put_first(struct ringbuff *const rb, void *data)
 {
 	assert(rb);
 
-	if(rb->p_read == (uint8_t *)rb->buf)
-	{
-		rb->p_read = ((uint8_t *)rb->buf + rb->data_size * (rb->len-1));
-	}else
-	{
-		rb->p_read -= rb->data_size;
+	/* When full, the front slot is the newest data: drop it */
+	if ((rb->write_index - rb->read_index) == rb->len) {
+		rb->write_index--;
 	}
-
-    memcpy(rb->p_read, data, rb->data_size);
+	rb->read_index--;
+	memcpy(RB_SLOT(rb, rb->read_index), data, rb->data_size);
 
 	return 0;
 }
 
 /**
- * \brief Return the element number of ringbuff
+ * \brief Get up to n elements from ringbuff
  */
-uint32_t ringbuff_num(const struct ringbuff *const rb)
+uint32_t ringbuff_get_n(struct ringbuff *const rb, void *data, uint32_t n)
 {
-	assert(rb);
+	assert(rb && data);
 
-	int32_t len = (int32_t)((rb->p_write - rb->p_read) / rb->data_size);
+	uint32_t num = rb->write_index - rb->read_index;
+	uint32_t offset = rb->read_index & rb->mask;
+	uint32_t first;
 
-	if(len < 0)
-	{
-		len = rb->len - len;
+	if (n > num) {
+		n = num;
 	}
 
-	return len;
+	/* At most two copies, before and after the wrap */
+	first = rb->len - offset;
+	if (first > n) {
+		first = n;
+	}
+	memcpy(data, rb->buf + offset * rb->data_size, first * rb->data_size);
+	memcpy((uint8_t *)data + first * rb->data_size, rb->buf, (n - first) * rb->data_size);
+
+	rb->read_index += n;
+
+	return n;
+}
+
+/**
+ * \brief Put up to n elements to ringbuff
+ */
+uint32_t ringbuff_put_n(struct ringbuff *const rb, const void *data, uint32_t n)
+{
+	assert(rb && data);
+
+	uint32_t space = rb->len - (rb->write_index - rb->read_index);
+	uint32_t offset = rb->write_index & rb->mask;
+	uint32_t first;
+
+	if (n > space) {
+		n = space;
+	}
+
+	/* At most two copies, before and after the wrap */
+	first = rb->len - offset;
+	if (first > n) {
+		first = n;
+	}
+	memcpy(rb->buf + offset * rb->data_size, data, first * rb->data_size);
+	memcpy(rb->buf, (const uint8_t *)data + first * rb->data_size, (n - first) * rb->data_size);
+
+	rb->write_index += n;
+
+	return n;
+}
+
+/**
+ * \brief Return the element number of ringbuff
+ */
+uint32_t ringbuff_num(const struct ringbuff *const rb)
+{
+	assert(rb);
+
+	return rb->write_index - rb->read_index;
 }
 
 /**
@@ -126,7 +167,7 @@ uint32_t ringbuff_flush(struct ringbuff *const rb)
 {
 	assert(rb);
 
-	rb->p_read = rb->p_write;
+	rb->read_index = rb->write_index;
 
 	return 0;
 }
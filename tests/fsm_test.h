@@ -0,0 +1,35 @@
+/**
+ * @file fsm_test.h
+ * @author Mauro Medina
+ * @brief Checks shared by the tests, a failed one exits with its location
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#ifndef FSM_TEST_H_
+#define FSM_TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_CHECK(cond)                                                            \
+    do {                                                                            \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);  \
+            exit(1);                                                                \
+        }                                                                           \
+    } while (0)
+
+#define TEST_EQUAL(a, b)                                                            \
+    do {                                                                            \
+        long long _a = (long long)(a), _b = (long long)(b);                         \
+        if (_a != _b) {                                                             \
+            fprintf(stderr, "%s:%d: %s == %lld, expected %s == %lld\n",             \
+                    __FILE__, __LINE__, #a, _a, #b, _b);                            \
+            exit(1);                                                                \
+        }                                                                           \
+    } while (0)
+
+#endif /* FSM_TEST_H_ */
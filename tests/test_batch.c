@@ -0,0 +1,84 @@
+/**
+ * @file test_batch.c
+ * @author Mauro Medina
+ * @brief Batch engine: routes of every instance, ids past the table, dispatches to the proxy
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdint.h>
+
+#include "fsm.h"
+#include "fsm_batch.h"
+#include "fsm_test.h"
+
+// Not a multiple of the 8 lanes of a gather
+#define NUM_INSTANCES 37
+
+enum { ST_IDLE = FSM_ST_FIRST, ST_RUN };
+enum { EV_GO = FSM_EV_FIRST, EV_STOP, EV_LAST };
+
+static uint32_t started[NUM_INSTANCES];
+
+static void go_work(fsm_t *self, void *data)
+{
+    (void)data;
+    // Instances have no queue, the event is rejected and nothing is pending
+    TEST_EQUAL(fsm_dispatch(self, EV_STOP, NULL), FSM_DISPATCH_INVALID);
+    TEST_EQUAL(fsm_dispatch_prio(self, EV_STOP, NULL, FSM_PRIO_HIGHEST), FSM_DISPATCH_INVALID);
+    TEST_EQUAL(fsm_dispatch_many(&self, 1, EV_STOP, NULL), 0);
+    TEST_EQUAL(fsm_has_pending_events(self), 0);
+    TEST_EQUAL(fsm_state_get(self), ST_IDLE);
+    started[fsm_batch_instance(self)]++;
+}
+
+FSM_STATES_INIT(batch)
+    FSM_CREATE_STATE(batch, ST_IDLE, FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+    FSM_CREATE_STATE(batch, ST_RUN,  FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(batch)
+    FSM_TRANSITION_WORK_CREATE(batch, ST_IDLE, EV_GO,   ST_RUN,  go_work)
+    FSM_TRANSITION_CREATE(batch, ST_RUN,  EV_STOP, ST_IDLE)
+FSM_TRANSITIONS_END()
+
+int main(void)
+{
+    static fsm_def_t def;
+    static uint32_t buff[FSM_BATCH_BUFF_SIZE(NUM_INSTANCES) / sizeof(uint32_t)];
+    static fsm_batch_t batch;
+    fsm_batch_event_t evs[2 * NUM_INSTANCES + 1];
+    uint32_t n = 0;
+
+    TEST_EQUAL(fsm_def_init(&def, FSM_TRANSITIONS_GET(batch), FSM_TRANSITIONS_SIZE(batch), EV_LAST, &FSM_STATE_GET(batch, ST_IDLE)), 0);
+    TEST_EQUAL(fsm_batch_init(&batch, &def, NUM_INSTANCES, buff, NULL), 0);
+
+    // Even instances start, odd ones get an id past the table, one instance is out of range
+    for (uint32_t i = 0; i < NUM_INSTANCES; i++)
+    {
+        evs[n++] = (fsm_batch_event_t){ .instance = i, .event = (i % 2) ? EV_LAST + i : EV_GO };
+    }
+    evs[n++] = (fsm_batch_event_t){ .instance = NUM_INSTANCES, .event = EV_GO };
+    TEST_EQUAL(fsm_batch_process(&batch, evs, n), (NUM_INSTANCES + 1) / 2);
+
+    for (uint32_t i = 0; i < NUM_INSTANCES; i++)
+    {
+        TEST_EQUAL(fsm_batch_state_get(&batch, i), (i % 2) ? ST_IDLE : ST_RUN);
+        TEST_EQUAL(started[i], (i % 2) ? 0 : 1);
+    }
+
+    // The rejected dispatches left nothing behind, the instances stop when told
+    n = 0;
+    for (uint32_t i = 0; i < NUM_INSTANCES; i++)
+    {
+        evs[n++] = (fsm_batch_event_t){ .instance = i, .event = EV_STOP };
+    }
+    TEST_EQUAL(fsm_batch_process(&batch, evs, n), (NUM_INSTANCES + 1) / 2);
+    for (uint32_t i = 0; i < NUM_INSTANCES; i++)
+    {
+        TEST_EQUAL(fsm_batch_state_get(&batch, i), ST_IDLE);
+    }
+    return 0;
+}
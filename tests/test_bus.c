@@ -0,0 +1,99 @@
+/**
+ * @file test_bus.c
+ * @author Mauro Medina
+ * @brief Bus built with FSM_BUS_MAX_SUBS=4, subscriptions past the table
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdint.h>
+
+#include "fsm.h"
+#include "fsm_bus.h"
+#include "fsm_test.h"
+
+_Static_assert(FSM_BUS_MAX_SUBS == 4, "built with FSM_BUS_MAX_SUBS=4");
+
+enum { ST_IDLE = FSM_ST_FIRST };
+enum { EV_A = FSM_EV_FIRST, EV_B, EV_C, EV_LAST };
+
+static uint32_t handled[EV_LAST];
+
+static void a_work(fsm_t *self, void *data) { handled[EV_A]++; }
+static void b_work(fsm_t *self, void *data) { handled[EV_B]++; }
+static void c_work(fsm_t *self, void *data) { handled[EV_C]++; }
+
+// Three event ids, three entries of the bus
+FSM_STATES_INIT(wide)
+    FSM_CREATE_STATE(wide, ST_IDLE, FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(wide)
+    FSM_TRANSITION_WORK_CREATE(wide, ST_IDLE, EV_A, ST_IDLE, a_work)
+    FSM_TRANSITION_WORK_CREATE(wide, ST_IDLE, EV_B, ST_IDLE, b_work)
+    FSM_TRANSITION_WORK_CREATE(wide, ST_IDLE, EV_C, ST_IDLE, c_work)
+FSM_TRANSITIONS_END()
+
+// One event id, one entry
+FSM_STATES_INIT(narrow)
+    FSM_CREATE_STATE(narrow, ST_IDLE, FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(narrow)
+    FSM_TRANSITION_WORK_CREATE(narrow, ST_IDLE, EV_A, ST_IDLE, a_work)
+FSM_TRANSITIONS_END()
+
+int main(void)
+{
+    fsm_bus_t bus;
+    fsm_t wide1, wide2, narrow;
+
+    TEST_EQUAL(fsm_init(&wide1, FSM_TRANSITIONS_GET(wide), FSM_TRANSITIONS_SIZE(wide), EV_LAST, 0, &FSM_STATE_GET(wide, ST_IDLE), NULL), 0);
+    TEST_EQUAL(fsm_init(&wide2, FSM_TRANSITIONS_GET(wide), FSM_TRANSITIONS_SIZE(wide), EV_LAST, 0, &FSM_STATE_GET(wide, ST_IDLE), NULL), 0);
+    TEST_EQUAL(fsm_init(&narrow, FSM_TRANSITIONS_GET(narrow), FSM_TRANSITIONS_SIZE(narrow), EV_LAST, 0, &FSM_STATE_GET(narrow, ST_IDLE), NULL), 0);
+    TEST_EQUAL(fsm_bus_init(&bus), 0);
+
+    TEST_EQUAL(fsm_bus_subscribe(&bus, &wide1), 0);
+    TEST_EQUAL(bus.num_subs, 3);
+    // Subscribing again takes no entry
+    TEST_EQUAL(fsm_bus_subscribe(&bus, &wide1), 0);
+    TEST_EQUAL(bus.num_subs, 3);
+
+    // Three more entries do not fit, none is taken
+    TEST_EQUAL(fsm_bus_subscribe(&bus, &wide2), -2);
+    TEST_EQUAL(bus.num_subs, 3);
+    TEST_EQUAL(fsm_bus_subscribers(&bus, EV_A), 1);
+    TEST_EQUAL(fsm_bus_subscribers(&bus, EV_B), 1);
+    TEST_EQUAL(fsm_bus_subscribers(&bus, EV_C), 1);
+    TEST_EQUAL(fsm_bus_publish(&bus, EV_B, NULL), 1);
+    TEST_EQUAL(fsm_has_pending_events(&wide2), 0);
+
+    // The last entry is still there for a fsm that fits
+    TEST_EQUAL(fsm_bus_subscribe(&bus, &narrow), 0);
+    TEST_EQUAL(bus.num_subs, FSM_BUS_MAX_SUBS);
+    TEST_EQUAL(fsm_bus_publish(&bus, EV_A, NULL), 2);
+
+    // Unsubscribing makes room
+    TEST_EQUAL(fsm_bus_unsubscribe(&bus, &wide1), 0);
+    TEST_EQUAL(bus.num_subs, 1);
+    TEST_EQUAL(fsm_bus_subscribe(&bus, &wide2), 0);
+    TEST_EQUAL(bus.num_subs, FSM_BUS_MAX_SUBS);
+    TEST_EQUAL(fsm_bus_subscribe(&bus, &wide1), -2);
+    TEST_EQUAL(fsm_bus_publish(&bus, EV_C, NULL), 1);
+    TEST_EQUAL(fsm_bus_publish(&bus, EV_A, NULL), 2);
+
+    // wide1 got EV_B and EV_A, wide2 EV_C and EV_A, narrow EV_A twice
+    fsm_run(&wide1);
+    fsm_run(&wide2);
+    fsm_run(&narrow);
+    TEST_EQUAL(handled[EV_A], 4);
+    TEST_EQUAL(handled[EV_B], 1);
+    TEST_EQUAL(handled[EV_C], 1);
+
+    fsm_deinit(&wide1);
+    fsm_deinit(&wide2);
+    fsm_deinit(&narrow);
+    return 0;
+}
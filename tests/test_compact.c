@@ -0,0 +1,101 @@
+/**
+ * @file test_compact.c
+ * @author Mauro Medina
+ * @brief Compact build: size of fsm_t, events through the MPSC queue and its priority lane
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdint.h>
+
+#include "fsm.h"
+#include "fsm_test.h"
+
+enum { ST_IDLE = FSM_ST_FIRST, ST_RUN, ST_ALARM };
+enum { EV_START = FSM_EV_FIRST, EV_STOP, EV_ALARM, EV_LAST };
+
+static int alarms;
+
+static void alarm_entry(fsm_t *self, void *data)
+{
+    (void)self;
+    (void)data;
+    alarms++;
+}
+
+FSM_STATES_INIT(compact)
+    FSM_CREATE_STATE(compact, ST_IDLE,  FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+    FSM_CREATE_STATE(compact, ST_RUN,   FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+    FSM_CREATE_STATE(compact, ST_ALARM, FSM_ST_NONE, FSM_ST_NONE, alarm_entry, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(compact)
+    FSM_TRANSITION_CREATE(compact, ST_IDLE,  EV_START, ST_RUN)
+    FSM_TRANSITION_CREATE(compact, ST_RUN,   EV_STOP,  ST_IDLE)
+    FSM_TRANSITION_CREATE(compact, ST_RUN,   EV_ALARM, ST_ALARM)
+    FSM_TRANSITION_CREATE(compact, ST_ALARM, EV_STOP,  ST_IDLE)
+FSM_TRANSITIONS_END()
+
+#define EVENTS_LEN  8
+#define PRIO_LEN    4
+
+static uint8_t events_buff[FSM_EVENTS_BUFF_SIZE(EVENTS_LEN)] __attribute__((aligned(8)));
+static uint8_t prio_buff[(FSM_PRIO_LANES - 1) * FSM_EVENTS_BUFF_SIZE(PRIO_LEN)] __attribute__((aligned(8)));
+static const uint8_t priorities[EV_LAST] = { [EV_ALARM] = FSM_PRIO_HIGHEST };
+static fsm_ext_t ext;
+
+// Definition, runtime and actors pointers, the current data, 3 counters and the state id
+_Static_assert(sizeof(fsm_t) <= 4 * sizeof(void *) + 16, "compact fsm_t grew");
+
+int main(void)
+{
+    fsm_def_t def;
+    fsm_t fsm;
+    fsm_config_t config = {
+        .queue          = FSM_QUEUE_MPSC,
+        .events_buff    = events_buff,
+        .events_len     = EVENTS_LEN,
+        .prio_buff      = prio_buff,
+        .prio_len       = PRIO_LEN,
+        .priorities     = priorities,
+        .num_priorities = EV_LAST,
+    };
+
+    TEST_EQUAL(fsm_def_init(&def, FSM_TRANSITIONS_GET(compact), FSM_TRANSITIONS_SIZE(compact), EV_LAST, &FSM_STATE_GET(compact, ST_IDLE)), 0);
+    // The runtime has no default storage
+    TEST_EQUAL(fsm_init_def(&fsm, &def, 0, NULL, &config), -3);
+    config.ext = &ext;
+
+    TEST_EQUAL(fsm_init_def(&fsm, &def, 0, NULL, &config), 0);
+    TEST_EQUAL(fsm_state_get(&fsm), ST_IDLE);
+
+    TEST_EQUAL(fsm_dispatch(&fsm, EV_START, NULL), FSM_DISPATCH_OK);
+    fsm_run(&fsm);
+    TEST_EQUAL(fsm_state_get(&fsm), ST_RUN);
+
+    // The alarm goes through the priority lane, ahead of the stop
+    TEST_EQUAL(fsm_dispatch(&fsm, EV_STOP, NULL), FSM_DISPATCH_OK);
+    TEST_EQUAL(fsm_dispatch(&fsm, EV_ALARM, NULL), FSM_DISPATCH_OK);
+    fsm_run(&fsm);
+    TEST_EQUAL(alarms, 1);
+    TEST_EQUAL(fsm_state_get(&fsm), ST_IDLE);
+
+    // The given storage sets the capacity of the normal lane
+    for (int i = 0; i < EVENTS_LEN; i++)
+    {
+        TEST_EQUAL(fsm_dispatch(&fsm, (i & 1) ? EV_STOP : EV_START, NULL), FSM_DISPATCH_OK);
+    }
+    TEST_EQUAL(fsm_dispatch(&fsm, EV_START, NULL), FSM_DISPATCH_REJECTED);
+    fsm_run(&fsm);
+    TEST_EQUAL(fsm_state_get(&fsm), ST_IDLE);
+
+    fsm_stats_t stats;
+    TEST_EQUAL(fsm_stats_get(&fsm, &stats), 0);
+    TEST_EQUAL(stats.processed, 3 + EVENTS_LEN);
+    TEST_EQUAL(stats.dropped, 1);
+
+    fsm_deinit(&fsm);
+    return 0;
+}
@@ -0,0 +1,302 @@
+/**
+ * @file test_def.c
+ * @author Mauro Medina
+ * @brief Definitions shared by fsm_init and the limits of the dispatch table
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_test.h"
+
+#define MAX_TRANSITIONS 256
+
+typedef struct {
+    fsm_state_t states[FSM_MAX_STATES + 2];
+    fsm_transition_t transitions[MAX_TRANSITIONS + 1];
+    size_t num_transitions;
+} machine_t;
+
+static int num_actions;
+
+static void action_count(fsm_t *self, void *data)
+{
+    (void)self;
+    (void)data;
+    __atomic_fetch_add(&num_actions, 1, __ATOMIC_RELAXED);
+}
+
+static void state_add(machine_t *m, int id, int parent)
+{
+    fsm_state_t *s = &m->states[id];
+
+    s->state_id     = id;
+    s->parent       = (parent != FSM_ST_NONE) ? &m->states[parent] : NULL;
+    s->entry_action = action_count;
+    s->exit_action  = action_count;
+    if (s->parent && (s->parent->default_substate == NULL)) s->parent->default_substate = s;
+}
+
+static void transition_add(machine_t *m, int source, uint32_t event, int target)
+{
+    fsm_transition_t *t = &m->transitions[++m->num_transitions];
+
+    t->source_state = &m->states[source];
+    t->event        = event;
+    t->target_state = &m->states[target];
+}
+
+// num_states siblings, event moves each one to the next
+static void ring_build(machine_t *m, int num_states, uint32_t event)
+{
+    memset(m, 0, sizeof(*m));
+    for (int i = FSM_ST_FIRST; i <= num_states; i++)
+    {
+        state_add(m, i, FSM_ST_NONE);
+    }
+    for (int i = FSM_ST_FIRST; i <= num_states; i++)
+    {
+        transition_add(m, i, event, (i % num_states) + 1);
+    }
+}
+
+static int machine_init(fsm_t *fsm, machine_t *m)
+{
+    return fsm_init(fsm, m->transitions, m->num_transitions, FSM_MAX_EVENTS, 0, &m->states[FSM_ST_FIRST], NULL);
+}
+
+static int machine_def_init(fsm_def_t *def, machine_t *m)
+{
+    return fsm_def_init(def, m->transitions, m->num_transitions, FSM_MAX_EVENTS, &m->states[FSM_ST_FIRST]);
+}
+
+static int machine_step(fsm_t *fsm, uint32_t event)
+{
+    fsm_dispatch(fsm, event, NULL);
+    fsm_run(fsm);
+    return fsm_state_get(fsm);
+}
+
+// More tables than the fixed pool of the first versions had
+#define NUM_TABLES      8
+#define NUM_THREADS     4
+#define THREAD_LOOPS    2000
+
+static machine_t machines[NUM_TABLES];
+static fsm_def_t def;
+
+// Every table is compiled once, freed with its last instance
+static void test_pool(void)
+{
+    fsm_t fsms[NUM_TABLES];
+    fsm_t shared;
+
+    for (int i = 0; i < NUM_TABLES; i++)
+    {
+        ring_build(&machines[i], 2 + i, FSM_EV_FIRST);
+    }
+    for (int i = 0; i < NUM_TABLES; i++)
+    {
+        TEST_EQUAL(machine_init(&fsms[i], &machines[i]), 0);
+        for (int j = 0; j < i; j++)
+        {
+            TEST_CHECK(fsms[i].def != fsms[j].def);
+        }
+    }
+    TEST_EQUAL(machine_init(&shared, &machines[0]), 0);
+    TEST_CHECK(shared.def == fsms[0].def);
+
+    fsm_deinit(&fsms[0]);
+    TEST_EQUAL(machine_step(&shared, FSM_EV_FIRST), FSM_ST_FIRST + 1);
+    fsm_deinit(&shared);
+    for (int i = 1; i < NUM_TABLES; i++)
+    {
+        TEST_EQUAL(machine_step(&fsms[i], FSM_EV_FIRST), FSM_ST_FIRST + 1);
+        fsm_deinit(&fsms[i]);
+    }
+
+    // Init and deinit in a loop
+    for (int n = 0; n < 4 * NUM_TABLES; n++)
+    {
+        TEST_EQUAL(machine_init(&fsms[0], &machines[n % NUM_TABLES]), 0);
+        TEST_EQUAL(machine_step(&fsms[0], FSM_EV_FIRST), FSM_ST_FIRST + 1);
+        fsm_deinit(&fsms[0]);
+    }
+}
+
+// Threads sharing and freeing the definitions of the same tables
+static void *pool_thread_run(void *arg)
+{
+    uintptr_t id = (uintptr_t)arg;
+    fsm_t fsm;
+
+    for (int n = 0; n < THREAD_LOOPS; n++)
+    {
+        machine_t *m = &machines[(id + n) % NUM_TABLES];
+
+        TEST_EQUAL(machine_init(&fsm, m), 0);
+        TEST_EQUAL(machine_step(&fsm, FSM_EV_FIRST), FSM_ST_FIRST + 1);
+        fsm_deinit(&fsm);
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    pthread_t threads[NUM_THREADS];
+
+    for (uintptr_t i = 0; i < NUM_THREADS; i++)
+    {
+        TEST_EQUAL(pthread_create(&threads[i], NULL, pool_thread_run, (void *)i), 0);
+    }
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// A different table built in the same memory is compiled again
+static void test_rebuilt(void)
+{
+    machine_t *m = &machines[0];
+    fsm_t fsm, stale;
+
+    ring_build(m, 2, FSM_EV_FIRST);
+    TEST_EQUAL(machine_init(&fsm, m), 0);
+    TEST_EQUAL(machine_step(&fsm, FSM_EV_FIRST), 2);
+    fsm_deinit(&fsm);
+
+    ring_build(m, 3, FSM_EV_FIRST + 1);
+    TEST_EQUAL(machine_init(&fsm, m), 0);
+    TEST_EQUAL(machine_step(&fsm, FSM_EV_FIRST), FSM_ST_FIRST);
+    TEST_EQUAL(machine_step(&fsm, FSM_EV_FIRST + 1), 2);
+    TEST_EQUAL(machine_step(&fsm, FSM_EV_FIRST + 1), 3);
+
+    // Even while an instance of the old contents was never deinit
+    ring_build(m, 2, FSM_EV_FIRST);
+    TEST_EQUAL(machine_init(&stale, m), 0);
+    TEST_CHECK(stale.def != fsm.def);
+    TEST_EQUAL(machine_step(&stale, FSM_EV_FIRST), 2);
+    TEST_EQUAL(machine_step(&stale, FSM_EV_FIRST + 1), 2);
+
+    fsm_deinit(&fsm);
+    fsm_deinit(&stale);
+}
+
+// Instances given the def of another one keep it compiled until they are deinit
+static void test_shared(void)
+{
+    fsm_t a, b, c, others[NUM_TABLES - 1];
+    uint8_t record[FSM_SNAPSHOT_SIZE(0)];
+    int len;
+
+    for (int i = 0; i < NUM_TABLES; i++)
+    {
+        ring_build(&machines[i], 2 + i, FSM_EV_FIRST);
+    }
+    TEST_EQUAL(machine_init(&a, &machines[0]), 0);
+    TEST_EQUAL(fsm_init_def(&b, a.def, 0, NULL, NULL), 0);
+    len = fsm_snapshot(&a, record, sizeof(record));
+    TEST_CHECK(len > 0);
+    TEST_EQUAL(fsm_restore(&c, a.def, 0, NULL, NULL, record, len), 0);
+
+    // The def of a is not freed, nor compiled again for the other tables
+    fsm_deinit(&c);
+    fsm_deinit(&b);
+    for (int i = 0; i < NUM_TABLES - 1; i++)
+    {
+        TEST_EQUAL(machine_init(&others[i], &machines[i + 1]), 0);
+        TEST_CHECK(others[i].def != a.def);
+    }
+    TEST_EQUAL(machine_step(&a, FSM_EV_FIRST), FSM_ST_FIRST + 1);
+    TEST_EQUAL(machine_step(&a, FSM_EV_FIRST), FSM_ST_FIRST);
+
+    // Restored from the last instance, the def outlives it
+    TEST_EQUAL(fsm_restore(&c, a.def, 0, NULL, NULL, record, len), 0);
+    fsm_deinit(&a);
+    TEST_EQUAL(machine_init(&b, &machines[0]), 0);
+    TEST_CHECK(b.def == c.def);
+    TEST_EQUAL(machine_step(&c, FSM_EV_FIRST), FSM_ST_FIRST + 1);
+
+    fsm_deinit(&b);
+    fsm_deinit(&c);
+    for (int i = 0; i < NUM_TABLES - 1; i++)
+    {
+        fsm_deinit(&others[i]);
+    }
+}
+
+// Machines over each limit are rejected by both init paths
+static void test_limits(void)
+{
+    machine_t *m = &machines[0];
+    fsm_t fsm;
+
+    ring_build(m, FSM_MAX_STATES, FSM_EV_FIRST);
+    TEST_EQUAL(machine_def_init(&def, m), 0);
+    ring_build(m, FSM_MAX_STATES + 1, FSM_EV_FIRST);
+    TEST_EQUAL(machine_def_init(&def, m), -4);
+    TEST_EQUAL(machine_init(&fsm, m), -4);
+
+    ring_build(m, 2, FSM_MAX_EVENTS + FSM_EV_FIRST - 1);
+    TEST_EQUAL(machine_def_init(&def, m), 0);
+    ring_build(m, 2, FSM_MAX_EVENTS + FSM_EV_FIRST);
+    TEST_EQUAL(machine_def_init(&def, m), -4);
+    TEST_EQUAL(machine_init(&fsm, m), -4);
+
+    // Every (state, event) pair is a route, route 0 enters the initial state
+    memset(m, 0, sizeof(*m));
+    state_add(m, FSM_ST_FIRST, FSM_ST_NONE);
+    state_add(m, FSM_ST_FIRST + 1, FSM_ST_NONE);
+    for (uint32_t ev = 0; ev < FSM_MAX_ROUTES; ev++)
+    {
+        transition_add(m, FSM_ST_FIRST + (ev & 1), FSM_EV_FIRST + ev / 2, FSM_ST_FIRST + !(ev & 1));
+    }
+    TEST_CHECK(((FSM_MAX_ROUTES - 1) / 2) < FSM_MAX_EVENTS);
+    TEST_EQUAL(machine_def_init(&def, m), -4);
+    TEST_EQUAL(machine_init(&fsm, m), -4);
+    m->num_transitions--;
+    TEST_EQUAL(machine_def_init(&def, m), 0);
+    TEST_EQUAL(def.num_routes, FSM_MAX_ROUTES);
+
+    // Two branches of MAX_HIERARCHY_DEPTH states, each route exits one and enters the other
+    memset(m, 0, sizeof(*m));
+    for (int i = 1; i <= MAX_HIERARCHY_DEPTH; i++)
+    {
+        state_add(m, i, i - 1);
+        state_add(m, MAX_HIERARCHY_DEPTH + i, (i > 1) ? MAX_HIERARCHY_DEPTH + i - 1 : FSM_ST_NONE);
+    }
+    int per_route = 2 * MAX_HIERARCHY_DEPTH;
+    int num_routes = FSM_MAX_ROUTE_ACTIONS / per_route + 1;
+    TEST_CHECK(num_routes < FSM_MAX_EVENTS);
+    for (int ev = 0; ev < num_routes; ev++)
+    {
+        transition_add(m, MAX_HIERARCHY_DEPTH, FSM_EV_FIRST + ev, 2 * MAX_HIERARCHY_DEPTH);
+    }
+    TEST_EQUAL(machine_def_init(&def, m), -4);
+    TEST_EQUAL(machine_init(&fsm, m), -4);
+    m->num_transitions = (FSM_MAX_ROUTE_ACTIONS - MAX_HIERARCHY_DEPTH) / per_route;
+    TEST_EQUAL(machine_def_init(&def, m), 0);
+
+    // A definition that failed is not usable
+    ring_build(m, FSM_MAX_STATES + 1, FSM_EV_FIRST);
+    TEST_EQUAL(machine_def_init(&def, m), -4);
+    TEST_EQUAL(fsm_init_def(&fsm, &def, 0, NULL, NULL), -2);
+}
+
+int main(void)
+{
+    test_pool();
+    test_threads();
+    test_rebuilt();
+    test_shared();
+    test_limits();
+    TEST_CHECK(num_actions > 0);
+    return 0;
+}
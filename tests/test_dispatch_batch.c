@@ -0,0 +1,148 @@
+/**
+ * @file test_dispatch_batch.c
+ * @author Mauro Medina
+ * @brief fsm_dispatch_batch overflowing part way through, on both queue backends
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_test.h"
+
+#define EVENTS_LEN  16
+#define BATCH_LEN   (3 * FSM_EVENTS_BATCH)
+
+enum { ST_IDLE = FSM_ST_FIRST };
+enum { EV_DATA = FSM_EV_FIRST, EV_ALARM, EV_LEVEL, EV_LAST };
+
+static uintptr_t handled[2 * BATCH_LEN];
+static uint32_t num_handled;
+
+static void work_log(fsm_t *self, void *data)
+{
+    (void)self;
+    TEST_CHECK(num_handled < 2 * BATCH_LEN);
+    handled[num_handled++] = (uintptr_t)data;
+}
+
+FSM_STATES_INIT(batch)
+    FSM_CREATE_STATE(batch, ST_IDLE, FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(batch)
+    FSM_TRANSITION_WORK_CREATE(batch, ST_IDLE, EV_DATA,  ST_IDLE, work_log)
+    FSM_TRANSITION_WORK_CREATE(batch, ST_IDLE, EV_ALARM, ST_IDLE, work_log)
+    FSM_TRANSITION_WORK_CREATE(batch, ST_IDLE, EV_LEVEL, ST_IDLE, work_log)
+FSM_TRANSITIONS_END()
+
+static uint8_t events_buff[FSM_EVENTS_BUFF_SIZE(EVENTS_LEN)] __attribute__((aligned(8)));
+static const uint8_t priorities[EV_LAST] = { [EV_ALARM] = FSM_PRIO_HIGHEST };
+static const fsm_coalesce_t coalesce[] = { { EV_LEVEL, FSM_COALESCE_LATEST } };
+
+static void fsm_open(fsm_t *fsm, enum fsm_queue_e queue)
+{
+    fsm_config_t config = {
+        .queue          = queue,
+        .overflow       = FSM_OVERFLOW_REJECT,
+        .events_buff    = events_buff,
+        .events_len     = EVENTS_LEN,
+        .priorities     = priorities,
+        .num_priorities = EV_LAST,
+        .coalesce       = coalesce,
+        .num_coalesce   = 1,
+    };
+
+    TEST_EQUAL(fsm_init_ex(fsm, FSM_TRANSITIONS_GET(batch), FSM_TRANSITIONS_SIZE(batch), EV_LAST, 0, &FSM_STATE_GET(batch, ST_IDLE), NULL, &config), 0);
+    num_handled = 0;
+}
+
+// Larger than a chunk and than the queue, with an alarm after the overflow
+static void test_overflow(enum fsm_queue_e queue)
+{
+    struct fsm_events_t evs[BATCH_LEN + 1];
+    fsm_stats_t stats;
+    fsm_t fsm;
+    int accepted;
+
+    fsm_open(&fsm, queue);
+    memset(evs, 0, sizeof(evs));
+    for (uintptr_t i = 0; i < BATCH_LEN; i++)
+    {
+        evs[i].event = EV_DATA;
+        evs[i].data  = (void *)i;
+    }
+    evs[BATCH_LEN].event = EV_ALARM;
+    evs[BATCH_LEN].data  = (void *)(uintptr_t)BATCH_LEN;
+
+    accepted = fsm_dispatch_batch(&fsm, evs, BATCH_LEN + 1);
+    TEST_EQUAL(accepted, EVENTS_LEN);
+    TEST_EQUAL(fsm_stats_get(&fsm, &stats), 0);
+    TEST_EQUAL(stats.pending, EVENTS_LEN);
+    TEST_EQUAL(stats.dropped, 1);
+
+    // Only the first ones were queued, the alarm did not jump ahead
+    fsm_run(&fsm);
+    TEST_EQUAL(num_handled, EVENTS_LEN);
+    for (uint32_t i = 0; i < num_handled; i++)
+    {
+        TEST_EQUAL(handled[i], i);
+    }
+
+    // The rest goes in with a second call
+    TEST_EQUAL(fsm_dispatch_batch(&fsm, &evs[accepted], BATCH_LEN + 1 - accepted), BATCH_LEN + 1 - accepted);
+    fsm_run(&fsm);
+    TEST_EQUAL(num_handled, BATCH_LEN + 1);
+    TEST_EQUAL(handled[EVENTS_LEN], BATCH_LEN);
+    for (uint32_t i = EVENTS_LEN + 1; i < num_handled; i++)
+    {
+        TEST_EQUAL(handled[i], i - 1);
+    }
+
+    fsm_deinit(&fsm);
+}
+
+// A coalesced event after the rejected one is not merged
+static void test_overflow_coalesced(enum fsm_queue_e queue)
+{
+    struct fsm_events_t evs[EVENTS_LEN + 3];
+    fsm_t fsm;
+    int accepted;
+
+    fsm_open(&fsm, queue);
+    memset(evs, 0, sizeof(evs));
+    for (uintptr_t i = 0; i < EVENTS_LEN + 3; i++)
+    {
+        evs[i].event = EV_DATA;
+        evs[i].data  = (void *)i;
+    }
+    // The first level is the one rejected, the second one would merge with it
+    evs[EVENTS_LEN].event     = EV_LEVEL;
+    evs[EVENTS_LEN + 2].event = EV_LEVEL;
+
+    accepted = fsm_dispatch_batch(&fsm, evs, EVENTS_LEN + 3);
+    TEST_EQUAL(accepted, EVENTS_LEN);
+    fsm_run(&fsm);
+    TEST_EQUAL(num_handled, EVENTS_LEN);
+
+    TEST_EQUAL(fsm_dispatch_batch(&fsm, &evs[accepted], 3), 3);
+    fsm_run(&fsm);
+    TEST_EQUAL(num_handled, EVENTS_LEN + 2);
+    TEST_EQUAL(handled[EVENTS_LEN], EVENTS_LEN + 2);
+    TEST_EQUAL(handled[EVENTS_LEN + 1], EVENTS_LEN + 1);
+
+    fsm_deinit(&fsm);
+}
+
+int main(void)
+{
+    test_overflow(FSM_QUEUE_RING);
+    test_overflow(FSM_QUEUE_MPSC);
+    test_overflow_coalesced(FSM_QUEUE_RING);
+    test_overflow_coalesced(FSM_QUEUE_MPSC);
+    return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file test_event_fd.c
+ * @author Mauro Medina
+ * @brief POSIX port: producers dispatch while the owner blocks on the eventfd
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include "fsm.h"
+#include "fsm_test.h"
+
+#define NUM_PRODUCERS   2
+#define NUM_EVENTS      100000
+// A lost wake up leaves the owner blocked with events pending
+#define WAIT_MS         5000
+
+enum { ST_IDLE = FSM_ST_FIRST };
+enum { EV_PING = FSM_EV_FIRST, EV_LAST };
+
+static uint32_t received[NUM_PRODUCERS];
+static uint32_t handled;
+
+// data is the producer in the high bits and its sequence number below
+static void ping_work(fsm_t *self, void *data)
+{
+    uintptr_t value = (uintptr_t)data;
+    uint32_t producer = (uint32_t)(value >> 24);
+
+    (void)self;
+    TEST_CHECK(producer < NUM_PRODUCERS);
+    TEST_EQUAL(value & 0xffffff, received[producer]);
+    received[producer]++;
+    handled++;
+}
+
+FSM_STATES_INIT(ping)
+    FSM_CREATE_STATE(ping, ST_IDLE, FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(ping)
+    FSM_TRANSITION_WORK_CREATE(ping, ST_IDLE, EV_PING, ST_IDLE, ping_work)
+FSM_TRANSITIONS_END()
+
+static fsm_t fsm;
+
+static void *producer_run(void *arg)
+{
+    uintptr_t producer = (uintptr_t)arg;
+
+    for (uint32_t i = 0; i < NUM_EVENTS; )
+    {
+        if (fsm_dispatch(&fsm, EV_PING, (void *)((producer << 24) | i)) >= FSM_DISPATCH_OK)
+        {
+            i++;
+            // Short bursts, the owner keeps going back to sleep
+            if ((i & 7) == 0) sched_yield();
+        }else
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t producers[NUM_PRODUCERS];
+    struct pollfd pfd = {.events = POLLIN};
+
+    TEST_EQUAL(fsm_init(&fsm, FSM_TRANSITIONS_GET(ping), FSM_TRANSITIONS_SIZE(ping), EV_LAST, 0, &FSM_STATE_GET(ping, ST_IDLE), NULL), 0);
+    pfd.fd = fsm_event_fd(&fsm);
+    TEST_CHECK(pfd.fd >= 0);
+
+    for (uintptr_t i = 0; i < NUM_PRODUCERS; i++)
+    {
+        TEST_EQUAL(pthread_create(&producers[i], NULL, producer_run, (void *)i), 0);
+    }
+
+    while (handled < NUM_PRODUCERS * NUM_EVENTS)
+    {
+        TEST_CHECK(poll(&pfd, 1, WAIT_MS) == 1);
+        fsm_run(&fsm);
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+        TEST_EQUAL(received[i], NUM_EVENTS);
+    }
+
+    // Nothing left, the eventfd is not readable
+    fsm_run(&fsm);
+    TEST_EQUAL(poll(&pfd, 1, 0), 0);
+
+    fsm_deinit(&fsm);
+    return 0;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file test_exec_remove.c
+ * @author Mauro Medina
+ * @brief fsm taken out of a running executor and freed
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_exec.h"
+#include "fsm_test.h"
+
+#define NUM_FSM     8
+#define NUM_ROUNDS  200
+#define NUM_EVENTS  64
+
+enum { ST_IDLE = FSM_ST_FIRST };
+enum { EV_PING = FSM_EV_FIRST, EV_LEAVE, EV_LAST };
+
+typedef struct {
+    // Set once the fsm is deinit, no worker may run it after
+    uint32_t removed;
+    uint32_t pings;
+} fsm_ctx_t;
+
+static void ping_work(fsm_t *self, void *data)
+{
+    fsm_ctx_t *ctx = self->current_data;
+
+    (void)data;
+    TEST_CHECK(!__atomic_load_n(&ctx->removed, __ATOMIC_ACQUIRE));
+    __atomic_fetch_add(&ctx->pings, 1, __ATOMIC_RELAXED);
+    // Long enough to be caught running
+    for (volatile int i = 0; i < 200; i++);
+}
+
+static void leave_work(fsm_t *self, void *data)
+{
+    (void)data;
+    TEST_EQUAL(fsm_exec_remove(self), -2);
+}
+
+FSM_STATES_INIT(node)
+    FSM_CREATE_STATE(node, ST_IDLE, FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(node)
+    FSM_TRANSITION_WORK_CREATE(node, ST_IDLE, EV_PING,  ST_IDLE, ping_work)
+    FSM_TRANSITION_WORK_CREATE(node, ST_IDLE, EV_LEAVE, ST_IDLE, leave_work)
+FSM_TRANSITIONS_END()
+
+static fsm_exec_t exec;
+static const fsm_config_t config = { .queue = FSM_QUEUE_MPSC, .overflow = FSM_OVERFLOW_REJECT };
+
+static fsm_t *node_create(fsm_ctx_t *ctx)
+{
+    fsm_t *fsm = malloc(sizeof(fsm_t));
+
+    TEST_CHECK(fsm != NULL);
+    memset(ctx, 0, sizeof(*ctx));
+    TEST_EQUAL(fsm_init_ex(fsm, FSM_TRANSITIONS_GET(node), FSM_TRANSITIONS_SIZE(node), EV_LAST, 0, &FSM_STATE_GET(node, ST_IDLE), ctx, &config), 0);
+    TEST_EQUAL(fsm_exec_add(&exec, fsm), 0);
+    return fsm;
+}
+
+static void node_free(fsm_t *fsm, fsm_ctx_t *ctx)
+{
+    fsm_deinit(fsm);
+    __atomic_store_n(&ctx->removed, 1, __ATOMIC_RELEASE);
+    // A worker still holding it would run garbage
+    memset(fsm, 0xa5, sizeof(*fsm));
+    free(fsm);
+}
+
+// Freed while queued or running, with the executor busy with the others
+static void test_deinit_running(void)
+{
+    static fsm_ctx_t ctx[NUM_FSM];
+    fsm_t *fsms[NUM_FSM];
+
+    for (int i = 0; i < NUM_FSM; i++)
+    {
+        fsms[i] = node_create(&ctx[i]);
+    }
+    for (int round = 0; round < NUM_ROUNDS; round++)
+    {
+        int victim = round % NUM_FSM;
+
+        for (int n = 0; n < NUM_EVENTS; n++)
+        {
+            for (int i = 0; i < NUM_FSM; i++)
+            {
+                fsm_dispatch(fsms[i], EV_PING, NULL);
+            }
+        }
+        node_free(fsms[victim], &ctx[victim]);
+        fsms[victim] = node_create(&ctx[victim]);
+    }
+    for (int i = 0; i < NUM_FSM; i++)
+    {
+        node_free(fsms[i], &ctx[i]);
+    }
+}
+
+// Its own action can not take it out, the worker would wait for itself
+static void test_remove_self(void)
+{
+    fsm_ctx_t ctx;
+    fsm_t *fsm = node_create(&ctx);
+
+    TEST_EQUAL(fsm_dispatch(fsm, EV_LEAVE, NULL), FSM_DISPATCH_OK);
+    TEST_EQUAL(fsm_dispatch(fsm, EV_PING, NULL), FSM_DISPATCH_OK);
+    while (__atomic_load_n(&ctx.pings, __ATOMIC_ACQUIRE) != 1) sched_yield();
+    TEST_CHECK(__atomic_load_n(&FSM_EXT(fsm)->exec, __ATOMIC_ACQUIRE) == &exec);
+
+    node_free(fsm, &ctx);
+}
+
+int main(void)
+{
+    TEST_EQUAL(fsm_exec_init(&exec, 4), 0);
+
+    test_deinit_running();
+    test_remove_self();
+
+    fsm_exec_stop(&exec);
+
+    // After the stop it does not wait for the workers
+    fsm_ctx_t ctx;
+    fsm_t *fsm = node_create(&ctx);
+    TEST_EQUAL(fsm_dispatch(fsm, EV_PING, NULL), FSM_DISPATCH_OK);
+    node_free(fsm, &ctx);
+    return 0;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file test_exec_stress.c
+ * @author Mauro Medina
+ * @brief Executor with work stealing, many producers dispatching to its fsm
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include "fsm.h"
+#include "fsm_exec.h"
+#include "fsm_test.h"
+
+#define NUM_PRODUCERS   3
+#define NUM_FSM         8
+#define NUM_WORKERS     4
+#define NUM_EVENTS      (640 * FSM_EVENTS_BATCH)
+
+enum { ST_IDLE = FSM_ST_FIRST };
+enum { EV_PING = FSM_EV_FIRST, EV_LAST };
+
+typedef struct {
+    // Set while a worker runs an action of the fsm
+    uint32_t busy;
+    // Next sequence number of every producer, only touched by the actions
+    uint32_t next[NUM_PRODUCERS];
+} node_t;
+
+static node_t nodes[NUM_FSM];
+static fsm_t fsms[NUM_FSM];
+static fsm_exec_t exec;
+static uint32_t handled;
+
+// data is the producer in the high bits and its sequence number below
+static void ping_work(fsm_t *self, void *data)
+{
+    node_t *node = self->current_data;
+    uintptr_t value = (uintptr_t)data;
+    uint32_t producer = (uint32_t)(value >> 24);
+
+    // One worker at a time
+    TEST_EQUAL(__atomic_exchange_n(&node->busy, 1, __ATOMIC_ACQUIRE), 0);
+    TEST_CHECK(producer < NUM_PRODUCERS);
+    TEST_EQUAL(value & 0xffffff, node->next[producer]);
+    node->next[producer]++;
+    __atomic_store_n(&node->busy, 0, __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&handled, 1, __ATOMIC_RELEASE);
+}
+
+FSM_STATES_INIT(node)
+    FSM_CREATE_STATE(node, ST_IDLE, FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(node)
+    FSM_TRANSITION_WORK_CREATE(node, ST_IDLE, EV_PING, ST_IDLE, ping_work)
+FSM_TRANSITIONS_END()
+
+// Round robin over the fsm, events one by one or in batches of FSM_EVENTS_BATCH
+static void *producer_run(void *arg)
+{
+    uintptr_t producer = (uintptr_t)arg;
+    struct fsm_events_t evs[FSM_EVENTS_BATCH] = {0};
+
+    for (uintptr_t seq = 0; seq < NUM_EVENTS; seq += FSM_EVENTS_BATCH)
+    {
+        for (int i = 0; i < NUM_FSM; i++)
+        {
+            for (uint32_t n = 0; n < FSM_EVENTS_BATCH; n++)
+            {
+                void *data = (void *)((producer << 24) | (seq + n));
+
+                if ((seq / FSM_EVENTS_BATCH) & 1)
+                {
+                    evs[n].event = EV_PING;
+                    evs[n].data  = data;
+                    continue;
+                }
+                while (fsm_dispatch(&fsms[i], EV_PING, data) < FSM_DISPATCH_OK) sched_yield();
+            }
+            // The events not accepted go again, after the ones that were
+            for (size_t sent = 0; ((seq / FSM_EVENTS_BATCH) & 1) && (sent < FSM_EVENTS_BATCH); )
+            {
+                int accepted = fsm_dispatch_batch(&fsms[i], &evs[sent], FSM_EVENTS_BATCH - sent);
+
+                TEST_CHECK(accepted >= 0);
+                sent += accepted;
+                if (sent < FSM_EVENTS_BATCH) sched_yield();
+            }
+        }
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    const fsm_config_t config = { .queue = FSM_QUEUE_MPSC, .overflow = FSM_OVERFLOW_REJECT };
+    pthread_t producers[NUM_PRODUCERS];
+    fsm_exec_stats_t stats;
+
+    TEST_EQUAL(fsm_exec_init(&exec, NUM_WORKERS), 0);
+    for (int i = 0; i < NUM_FSM; i++)
+    {
+        TEST_EQUAL(fsm_init_ex(&fsms[i], FSM_TRANSITIONS_GET(node), FSM_TRANSITIONS_SIZE(node), EV_LAST, 0, &FSM_STATE_GET(node, ST_IDLE), &nodes[i], &config), 0);
+        TEST_EQUAL(fsm_exec_add(&exec, &fsms[i]), 0);
+    }
+
+    for (uintptr_t i = 0; i < NUM_PRODUCERS; i++)
+    {
+        TEST_EQUAL(pthread_create(&producers[i], NULL, producer_run, (void *)i), 0);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    while (__atomic_load_n(&handled, __ATOMIC_ACQUIRE) < NUM_PRODUCERS * NUM_FSM * NUM_EVENTS) sched_yield();
+
+    fsm_exec_stop(&exec);
+    TEST_EQUAL(handled, NUM_PRODUCERS * NUM_FSM * NUM_EVENTS);
+    for (int i = 0; i < NUM_FSM; i++)
+    {
+        for (int p = 0; p < NUM_PRODUCERS; p++)
+        {
+            TEST_EQUAL(nodes[i].next[p], NUM_EVENTS);
+        }
+        TEST_EQUAL(fsm_has_pending_events(&fsms[i]), 0);
+        fsm_deinit(&fsms[i]);
+    }
+    TEST_EQUAL(fsm_exec_stats_get(&exec, &stats), 0);
+    TEST_CHECK(stats.runs > 0);
+    return 0;
+}
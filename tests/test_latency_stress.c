@@ -0,0 +1,61 @@
+/**
+ * @file test_latency_stress.c
+ * @author Mauro Medina
+ * @brief Latency histograms written by many threads at once
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <pthread.h>
+#include <stdint.h>
+
+#include "fsm.h"
+#include "fsm_latency.h"
+#include "fsm_test.h"
+
+#define NUM_WRITERS 4
+#define NUM_ITEMS   100000
+#define NUM_EVENTS  2
+
+static fsm_latency_t latency;
+static fsm_latency_hist_t hists[NUM_EVENTS];
+
+// Every writer records the same cycles, the longest one last
+static void *writer_run(void *arg)
+{
+    (void)arg;
+    for (uint32_t i = 1; i <= NUM_ITEMS; i++)
+    {
+        fsm_latency_record(&latency, i % NUM_EVENTS, i);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t writers[NUM_WRITERS];
+    fsm_latency_summary_t summary;
+
+    TEST_EQUAL(fsm_latency_init(&latency, hists, NUM_EVENTS), 0);
+    for (int i = 0; i < NUM_WRITERS; i++)
+    {
+        TEST_EQUAL(pthread_create(&writers[i], NULL, writer_run, NULL), 0);
+    }
+    for (int i = 0; i < NUM_WRITERS; i++)
+    {
+        pthread_join(writers[i], NULL);
+    }
+
+    // No measure is lost, and the max is the longest of all the writers
+    for (uint32_t event = 0; event < NUM_EVENTS; event++)
+    {
+        TEST_EQUAL(fsm_latency_get(&latency, event, &summary), 0);
+        TEST_EQUAL(summary.count, NUM_WRITERS * NUM_ITEMS / NUM_EVENTS);
+        TEST_EQUAL(hists[event].max, NUM_ITEMS - event);
+    }
+    TEST_EQUAL(fsm_latency_get(&latency, FSM_LATENCY_ALL, &summary), 0);
+    TEST_EQUAL(summary.count, NUM_WRITERS * NUM_ITEMS);
+    return 0;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file test_mpsc_stress.c
+ * @author Mauro Medina
+ * @brief MPSC queue with many producers and one consumer
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include "mpsc_queue.h"
+#include "fsm_test.h"
+
+#define NUM_PRODUCERS   4
+#define NUM_ITEMS       100000
+#define QUEUE_LEN       64
+#define PUT_N_MAX       8
+
+typedef struct {
+    uint32_t producer;
+    uint32_t seq;
+} item_t;
+
+static struct mpsc_queue queue;
+static uint8_t queue_buff[MPSC_QUEUE_BUF_SIZE(QUEUE_LEN, sizeof(item_t))] __attribute__((aligned(8)));
+
+// Odd producers put batches with mpsc_queue_put_n, the rest one by one
+static void *producer_run(void *arg)
+{
+    uint32_t producer = (uint32_t)(uintptr_t)arg;
+    item_t items[PUT_N_MAX];
+    uint32_t seq = 0;
+
+    while (seq < NUM_ITEMS)
+    {
+        if (producer & 1)
+        {
+            uint32_t n = 1 + (seq % PUT_N_MAX);
+
+            if (n > NUM_ITEMS - seq) n = NUM_ITEMS - seq;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                items[i].producer = producer;
+                items[i].seq = seq + i;
+            }
+            uint32_t put = mpsc_queue_put_n(&queue, items, n);
+
+            TEST_CHECK(put <= n);
+            seq += put;
+            if (put == 0) sched_yield();
+        }else
+        {
+            item_t item = {producer, seq};
+
+            if (mpsc_queue_put(&queue, &item) == 0) seq++;
+            else sched_yield();
+        }
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t producers[NUM_PRODUCERS];
+    uint32_t next[NUM_PRODUCERS] = {0};
+    uint32_t received = 0;
+    item_t item;
+
+    TEST_EQUAL(mpsc_queue_init(&queue, queue_buff, QUEUE_LEN, sizeof(item_t)), 0);
+
+    for (uintptr_t i = 0; i < NUM_PRODUCERS; i++)
+    {
+        TEST_EQUAL(pthread_create(&producers[i], NULL, producer_run, (void *)i), 0);
+    }
+
+    // Every item once, in the order of its producer
+    while (received < NUM_PRODUCERS * NUM_ITEMS)
+    {
+        TEST_CHECK(mpsc_queue_num(&queue) <= QUEUE_LEN);
+        if (mpsc_queue_get(&queue, &item) != 0)
+        {
+            sched_yield();
+            continue;
+        }
+        TEST_CHECK(item.producer < NUM_PRODUCERS);
+        TEST_EQUAL(item.seq, next[item.producer]);
+        next[item.producer]++;
+        received++;
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+        TEST_EQUAL(next[i], NUM_ITEMS);
+    }
+    TEST_EQUAL(mpsc_queue_get(&queue, &item), -1);
+    TEST_EQUAL(mpsc_queue_num(&queue), 0);
+    return 0;
+}
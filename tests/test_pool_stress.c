@@ -0,0 +1,140 @@
+/**
+ * @file test_pool_stress.c
+ * @author Mauro Medina
+ * @brief Pooled payloads shared by many producers and two consumers
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include "fsm.h"
+#include "fsm_pool.h"
+#include "fsm_test.h"
+
+#define NUM_PRODUCERS   4
+#define NUM_CONSUMERS   2
+#define NUM_ITEMS       50000
+// Fewer blocks than events in flight, the free list is always busy
+#define NUM_BLOCKS      16
+
+enum { ST_IDLE = FSM_ST_FIRST };
+enum { EV_ITEM = FSM_EV_FIRST, EV_LAST };
+
+typedef struct {
+    uint32_t producer;
+    uint32_t seq;
+    // ~seq, a block given to two producers at once breaks it
+    uint32_t check;
+} item_t;
+
+typedef struct {
+    uint32_t handled;
+    // Next sequence number of every producer, only touched by the consumer
+    uint32_t next[NUM_PRODUCERS];
+} node_t;
+
+static node_t nodes[NUM_CONSUMERS];
+static fsm_t fsms[NUM_CONSUMERS];
+static fsm_pool_t pool;
+static uint8_t pool_buff[FSM_POOL_BUFF_SIZE(sizeof(item_t), NUM_BLOCKS)] __attribute__((aligned(8)));
+
+static void item_work(fsm_t *self, void *data)
+{
+    node_t *node = self->current_data;
+    const item_t *item = data;
+
+    TEST_CHECK(item->producer < NUM_PRODUCERS);
+    TEST_EQUAL(item->check, ~item->seq);
+    TEST_EQUAL(item->seq, node->next[item->producer]);
+    node->next[item->producer]++;
+    node->handled++;
+}
+
+FSM_STATES_INIT(node)
+    FSM_CREATE_STATE(node, ST_IDLE, FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(node)
+    FSM_TRANSITION_WORK_CREATE(node, ST_IDLE, EV_ITEM, ST_IDLE, item_work)
+FSM_TRANSITIONS_END()
+
+// Every payload goes to all the consumers, the producer drops its reference after
+static void *producer_run(void *arg)
+{
+    uint32_t producer = (uint32_t)(uintptr_t)arg;
+
+    for (uint32_t seq = 0; seq < NUM_ITEMS; seq++)
+    {
+        item_t *item;
+
+        while ((item = fsm_pool_acquire(&pool)) == NULL) sched_yield();
+        item->producer = producer;
+        item->seq      = seq;
+        item->check    = ~seq;
+        for (int i = 0; i < NUM_CONSUMERS; i++)
+        {
+            while (fsm_dispatch_pooled(&fsms[i], EV_ITEM, item) < FSM_DISPATCH_OK) sched_yield();
+        }
+        fsm_pool_release(item);
+    }
+    return NULL;
+}
+
+static void *consumer_run(void *arg)
+{
+    fsm_t *fsm = arg;
+    node_t *node = fsm->current_data;
+
+    while (node->handled < NUM_PRODUCERS * NUM_ITEMS)
+    {
+        if (fsm_run(fsm) == 0) sched_yield();
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    const fsm_config_t config = { .queue = FSM_QUEUE_MPSC, .overflow = FSM_OVERFLOW_REJECT };
+    pthread_t producers[NUM_PRODUCERS], consumers[NUM_CONSUMERS];
+
+    TEST_EQUAL(fsm_pool_init(&pool, pool_buff, sizeof(item_t), NUM_BLOCKS), 0);
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        TEST_EQUAL(fsm_init_ex(&fsms[i], FSM_TRANSITIONS_GET(node), FSM_TRANSITIONS_SIZE(node), EV_LAST, 0, &FSM_STATE_GET(node, ST_IDLE), &nodes[i], &config), 0);
+    }
+
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        TEST_EQUAL(pthread_create(&consumers[i], NULL, consumer_run, &fsms[i]), 0);
+    }
+    for (uintptr_t i = 0; i < NUM_PRODUCERS; i++)
+    {
+        TEST_EQUAL(pthread_create(&producers[i], NULL, producer_run, (void *)i), 0);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        pthread_join(consumers[i], NULL);
+    }
+
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        for (int p = 0; p < NUM_PRODUCERS; p++)
+        {
+            TEST_EQUAL(nodes[i].next[p], NUM_ITEMS);
+        }
+        TEST_EQUAL(fsm_has_pending_events(&fsms[i]), 0);
+        fsm_deinit(&fsms[i]);
+    }
+    // Every reference was given back
+    TEST_EQUAL(fsm_pool_available(&pool), NUM_BLOCKS);
+    return 0;
+}
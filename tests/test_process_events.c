@@ -0,0 +1,136 @@
+/**
+ * @file test_process_events.c
+ * @author Mauro Medina
+ * @brief Priority events raised in the middle of a batch, batches cut by terminate and flush
+ * @version 1.0.1
+ * @date 2024-07-17
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "fsm_test.h"
+
+#define NUM_DATA    (FSM_EVENTS_BATCH + 2)
+// Data of the event whose action raises, terminates or flushes
+#define DATA_ACT    2
+
+_Static_assert(FSM_PRIO_LANES > 1, "built with the priority lanes");
+
+enum { ST_IDLE = FSM_ST_FIRST };
+enum { EV_DATA = FSM_EV_FIRST, EV_ALARM, EV_LAST };
+enum { ACT_ALARM, ACT_TERMINATE, ACT_FLUSH };
+
+static uintptr_t handled[2 * NUM_DATA];
+static uint32_t num_handled;
+static int act;
+
+static void data_work(fsm_t *self, void *data)
+{
+    TEST_CHECK(num_handled < 2 * NUM_DATA);
+    handled[num_handled++] = (uintptr_t)data;
+    if ((uintptr_t)data != DATA_ACT) return;
+
+    switch (act)
+    {
+    case ACT_ALARM:
+        TEST_EQUAL(fsm_dispatch(self, EV_ALARM, (void *)100), FSM_DISPATCH_OK);
+        break;
+    case ACT_TERMINATE:
+        fsm_terminate(self, 7);
+        break;
+    case ACT_FLUSH:
+        fsm_flush_events(self);
+        break;
+    }
+}
+
+static void alarm_work(fsm_t *self, void *data)
+{
+    (void)self;
+    TEST_CHECK(num_handled < 2 * NUM_DATA);
+    handled[num_handled++] = (uintptr_t)data;
+}
+
+FSM_STATES_INIT(proc)
+    FSM_CREATE_STATE(proc, ST_IDLE, FSM_ST_NONE, FSM_ST_NONE, NULL, NULL, NULL)
+FSM_STATES_END()
+
+FSM_TRANSITIONS_INIT(proc)
+    FSM_TRANSITION_WORK_CREATE(proc, ST_IDLE, EV_DATA,  ST_IDLE, data_work)
+    FSM_TRANSITION_WORK_CREATE(proc, ST_IDLE, EV_ALARM, ST_IDLE, alarm_work)
+FSM_TRANSITIONS_END()
+
+static const uint8_t priorities[EV_LAST] = { [EV_ALARM] = FSM_PRIO_HIGHEST };
+
+// NUM_DATA events queued, numbered from 1
+static void fsm_open(fsm_t *fsm, enum fsm_queue_e queue, int action)
+{
+    fsm_config_t config = {
+        .queue          = queue,
+        .overflow       = FSM_OVERFLOW_REJECT,
+        .priorities     = priorities,
+        .num_priorities = EV_LAST,
+    };
+
+    TEST_EQUAL(fsm_init_ex(fsm, FSM_TRANSITIONS_GET(proc), FSM_TRANSITIONS_SIZE(proc), EV_LAST, 0, &FSM_STATE_GET(proc, ST_IDLE), NULL, &config), 0);
+    memset(handled, 0, sizeof(handled));
+    num_handled = 0;
+    act = action;
+    for (uintptr_t i = 1; i <= NUM_DATA; i++)
+    {
+        TEST_EQUAL(fsm_dispatch(fsm, EV_DATA, (void *)i), FSM_DISPATCH_OK);
+    }
+}
+
+static void test_queue(enum fsm_queue_e queue)
+{
+    fsm_t fsm;
+    fsm_stats_t stats;
+
+    // The alarm goes right after the event that raised it, before the rest of its batch
+    fsm_open(&fsm, queue, ACT_ALARM);
+    TEST_EQUAL(fsm_run(&fsm), 0);
+    TEST_EQUAL(num_handled, NUM_DATA + 1);
+    TEST_EQUAL(handled[DATA_ACT - 1], DATA_ACT);
+    TEST_EQUAL(handled[DATA_ACT], 100);
+    for (uint32_t i = DATA_ACT + 1; i < num_handled; i++)
+    {
+        TEST_EQUAL(handled[i], i);
+    }
+    TEST_EQUAL(fsm_stats_get(&fsm, &stats), 0);
+    TEST_EQUAL(stats.processed, NUM_DATA + 1);
+    TEST_EQUAL(stats.dropped, 0);
+    fsm_deinit(&fsm);
+
+    // The rest of the batch is dropped and counted, the events left in the queue stay there
+    fsm_open(&fsm, queue, ACT_TERMINATE);
+    TEST_EQUAL(fsm_run(&fsm), 0);
+    TEST_EQUAL(num_handled, DATA_ACT);
+    TEST_EQUAL(fsm_stats_get(&fsm, &stats), 0);
+    TEST_EQUAL(stats.processed, FSM_EVENTS_BATCH);
+    TEST_EQUAL(stats.dropped, FSM_EVENTS_BATCH - DATA_ACT);
+    TEST_EQUAL(stats.pending, NUM_DATA - FSM_EVENTS_BATCH);
+    TEST_EQUAL(fsm_run(&fsm), 7);
+    fsm_deinit(&fsm);
+
+    // Same with a flush, which empties the queue too
+    fsm_open(&fsm, queue, ACT_FLUSH);
+    TEST_EQUAL(fsm_run(&fsm), 0);
+    TEST_EQUAL(num_handled, DATA_ACT);
+    TEST_EQUAL(fsm_stats_get(&fsm, &stats), 0);
+    TEST_EQUAL(stats.processed, FSM_EVENTS_BATCH);
+    TEST_EQUAL(stats.dropped, FSM_EVENTS_BATCH - DATA_ACT);
+    TEST_EQUAL(stats.pending, 0);
+    fsm_deinit(&fsm);
+}
+
+int main(void)
+{
+    test_queue(FSM_QUEUE_RING);
+    test_queue(FSM_QUEUE_MPSC);
+    return 0;
+}
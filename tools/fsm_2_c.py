@@ -0,0 +1,227 @@
+# Author Mauro Medina <mauro93medina@gmail.com>
+
+"""Command-line state machine dispatcher generator
+
+This script takes a .c file that implemets a finite state machine using the FSM library macros:
+
+    * FSM_STATES_INIT
+    * FSM_CREATE_STATE
+    * FSM_TRANSITIONS_INIT
+    * FSM_TRANSITION_CREATE
+    * FSM_TRANSITION_WORK_CREATE
+
+and writes, for every fsm in the file, a name_dispatch.h with a C dispatcher
+specialized for it: a switch on (state, event), or a computed goto with
+--goto, where inherited transitions are flattened and the exit, transition
+and entry actions are called directly. Include it in the .c file after the
+tables and init the definition with name_def_init().
+
+Usage: Call script from command line
+
+    - python fsm_2_c file_name [--goto]
+
+    Where file_name is the .c file that implements the fsm (has to have FSM_CREATE_STATE and FSM_TRANSITION_CREATE somewhere)
+
+"""
+
+import argparse
+import os
+import re
+
+class fsm_c_gen:
+
+    fsm_init_pat = r"FSM_STATES_INIT\((.+?)\)"
+    fsm_none = ("FSM_ST_NONE", "0", "NULL")
+
+    def __init__(self):
+
+        # Set up argument parser
+        parser = argparse.ArgumentParser(description="Create a C dispatcher from a fsm file.")
+        parser.add_argument("file_name", type=str, help="The name of the C file with the fsm.")
+        parser.add_argument("--goto", action="store_true", help="Dispatch with a computed goto instead of a switch.")
+        args = parser.parse_args()
+
+        self.file_name = args.file_name
+        self.use_goto = args.goto
+
+        with open(self.file_name+".c", "r") as file:
+            self.content = file.read()
+
+        for self.fsm_name in re.findall(self.fsm_init_pat, self.content):
+            self.fsm_parse()
+            self.dispatch_file_write()
+
+#------------------------------------------------------------------------------
+
+    def fsm_args_get(self, macro):
+        pattern = rf"{macro}\({self.fsm_name},\s*(.+?)\)\s*$"
+        return [[item.strip() for item in line.split(',')] for line in re.findall(pattern, self.content, re.MULTILINE)]
+
+    def fsm_parse(self):
+        # States by id: parent, default substate and actions
+        self.states = {}
+        self.state_order = []
+        for st_id, parent, sub, entry, run, exit_ in self.fsm_args_get("FSM_CREATE_STATE"):
+            self.states[st_id] = {
+                "parent": None if parent in self.fsm_none else parent,
+                "sub":    None if sub in self.fsm_none else sub,
+                "entry":  None if entry in self.fsm_none else entry,
+                "exit":   None if exit_ in self.fsm_none else exit_,
+            }
+            self.state_order.append(st_id)
+
+        # Transitions in table order, the first one of a state wins
+        self.transitions = []
+        for args in self.fsm_args_get("FSM_TRANSITION_CREATE"):
+            self.transitions.append((args[0], args[1], args[2], None))
+        for args in self.fsm_args_get("FSM_TRANSITION_WORK_CREATE"):
+            self.transitions.append((args[0], args[1], args[2], None if args[3] in self.fsm_none else args[3]))
+        self.transitions.sort(key=self.transition_line)
+
+    def transition_line(self, transition):
+        # Position in the file, both macros can be mixed in the table
+        pattern = rf"FSM_TRANSITION_(?:WORK_)?CREATE\({self.fsm_name},\s*{re.escape(transition[0])}\s*,\s*{re.escape(transition[1])}\s*,\s*{re.escape(transition[2])}\b"
+        match = re.search(pattern, self.content)
+        return match.start() if match else 0
+
+    def ancestors(self, state):
+        # The state and its parents up to the root
+        path = []
+        while state is not None:
+            path.append(state)
+            state = self.states[state]["parent"]
+        return path
+
+    def leaf_get(self, state):
+        while self.states[state]["sub"] is not None:
+            state = self.states[state]["sub"]
+        return state
+
+    def lca_get(self, s1, s2):
+        # Deepest state in both paths, None for states without a common root
+        up = self.ancestors(s2)
+        for s in self.ancestors(s1):
+            if s in up:
+                return s
+        return None
+
+    def route_build(self, current, target, work):
+        """Same steps as fsm_route_build in fsm.c"""
+        lca = self.lca_get(current, target)
+        leaf = self.leaf_get(target)
+        route = {"exit": [], "entry": [], "work": work, "leaf": leaf, "num_exited": 0,
+                 "exit_actor": lca if lca is not None else "FSM_ST_NONE", "entry_actor": target}
+
+        s = current
+        while s is not None and s != lca:
+            if self.states[s]["exit"]:
+                route["exit"].append(self.states[s]["exit"])
+            route["num_exited"] += 1
+            s = self.states[s]["parent"]
+
+        path = []
+        s = leaf
+        while s is not None and s != lca:
+            path.append(s)
+            s = self.states[s]["parent"]
+        for s in reversed(path):
+            if self.states[s]["entry"]:
+                route["entry"].append(self.states[s]["entry"])
+
+        # When source state is target state, execute entry action
+        if lca == leaf and not path and self.states[lca]["entry"]:
+            route["entry"].append(self.states[lca]["entry"])
+        return route
+
+    def routes_get(self):
+        """(state, event, route) for every state that can stay active, inherited transitions included"""
+        routes = []
+        for st_id in self.state_order:
+            if self.states[st_id]["sub"] is not None:
+                continue
+            handled = set()
+            for s in self.ancestors(st_id):
+                for source, event, target, work in self.transitions:
+                    if source != s or event in handled:
+                        continue
+                    handled.add(event)
+                    routes.append((st_id, event, self.route_build(st_id, target, work)))
+        return routes
+
+#------------------------------------------------------------------------------
+
+    def route_write(self, file, indent, state, event, route):
+        file.write(f"{indent}// {state} -> {route['leaf']}\n")
+        for action in route["exit"]:
+            file.write(f"{indent}{action}(fsm, data);\n")
+        file.write(f"{indent}fsm_compiled_exit(fsm, {route['exit_actor']}, {route['num_exited']}, data);\n")
+        if route["work"]:
+            file.write(f"{indent}{route['work']}(fsm, data);\n")
+        for action in route["entry"]:
+            file.write(f"{indent}{action}(fsm, data);\n")
+        file.write(f"{indent}fsm_compiled_enter(fsm, {route['entry_actor']}, {route['leaf']}, {route['num_exited']}, data);\n")
+        file.write(f"{indent}return 1;\n")
+
+    def switch_write(self, file, routes):
+        file.write("    switch (fsm->state_id) {\n")
+        for st_id in self.state_order:
+            state_routes = [r for r in routes if r[0] == st_id]
+            if not state_routes:
+                continue
+            file.write(f"    case {st_id}:\n")
+            file.write("        switch (event) {\n")
+            for state, event, route in state_routes:
+                file.write(f"        case {event}:\n")
+                self.route_write(file, "            ", state, event, route)
+            file.write("        default:\n")
+            file.write("            return 0;\n")
+            file.write("        }\n")
+        file.write("    default:\n")
+        file.write("        return 0;\n")
+        file.write("    }\n")
+
+    def goto_write(self, file, routes):
+        file.write("    static const void *const table[FSM_MAX_STATES+1][FSM_MAX_EVENTS+FSM_EV_FIRST] = {\n")
+        for idx, (state, event, route) in enumerate(routes):
+            file.write(f"        [{state}][{event}] = &&route_{idx},\n")
+        file.write("    };\n")
+        file.write("    const void *target;\n\n")
+        file.write("    if (event >= FSM_MAX_EVENTS+FSM_EV_FIRST) return 0;\n")
+        file.write("    target = table[fsm->state_id][event];\n")
+        file.write("    if (target == NULL) return 0;\n")
+        file.write("    goto *target;\n")
+        for idx, (state, event, route) in enumerate(routes):
+            file.write(f"\nroute_{idx}:\n")
+            self.route_write(file, "    ", state, event, route)
+
+    def dispatch_file_write(self):
+        name = self.fsm_name
+        guard = f"{name.upper()}_DISPATCH_H_"
+        routes = self.routes_get()
+
+        with open(name+"_dispatch.h", "w") as file:
+            file.write(f"/* Generated by tools/fsm_2_c.py from {os.path.basename(self.file_name)}.c, do not edit */\n")
+            file.write(f"#ifndef {guard}\n#define {guard}\n\n")
+            file.write("#include \"fsm.h\"\n\n")
+
+            file.write(f"static int {name}_dispatch(fsm_t *fsm, uint32_t event, void *data)\n{{\n")
+            if self.use_goto:
+                self.goto_write(file, routes)
+            else:
+                self.switch_write(file, routes)
+            file.write("}\n\n")
+
+            file.write(f"// Compiles the tables of {name} and sets the generated dispatcher\n")
+            file.write(f"static int {name}_def_init(fsm_def_t *def, size_t num_events, fsm_state_t *initial_state)\n{{\n")
+            file.write(f"    int ret = fsm_def_init(def, FSM_TRANSITIONS_GET({name}), FSM_TRANSITIONS_SIZE({name}), num_events, initial_state);\n\n")
+            file.write(f"    if (ret == 0) def->dispatch = {name}_dispatch;\n")
+            file.write("    return ret;\n}\n\n")
+            file.write(f"#endif /* {guard} */\n")
+
+#------------------------------------------------------------------------------
+
+if __name__ == "__main__":
+
+    gen = fsm_c_gen()
+
+    raise SystemExit
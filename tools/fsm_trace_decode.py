@@ -0,0 +1,111 @@
+# Author Mauro Medina <mauro93medina@gmail.com>
+
+"""Command-line decoder of fsm trace files
+
+This script reads a binary trace file written with the fsm_trace.h API:
+
+    * fsm_trace_header_get, the header
+    * fsm_trace_read, the records after the header
+
+Usage: Call script from command line
+
+    - python fsm_trace_decode.py file_name [--csv] [--slowest N]
+
+    Where file_name is the binary trace file. Times are printed in us when the
+    header has the cycle counter frequency, in cycles otherwise.
+
+"""
+
+import argparse
+import struct
+
+class fsm_trace:
+
+    magic = 0x544d5346
+    header_fmt = "<IHHQII"
+    record_fmt = "<QIHBBIIII"
+    record_fields = ("timestamp", "fsm_id", "event", "source", "target",
+                     "exit", "transition", "entry", "seq")
+
+    def __init__(self):
+
+        # Set up argument parser
+        parser = argparse.ArgumentParser(description="Decode a fsm trace file.")
+        parser.add_argument("file_name", type=str, help="The binary trace file.")
+        parser.add_argument("--csv", action="store_true", help="Print CSV instead of a table.")
+        parser.add_argument("--slowest", type=int, default=0, help="Only the N transitions taking more cycles.")
+        args = parser.parse_args()
+
+        self.file_name = args.file_name
+        self.csv = args.csv
+        self.slowest = args.slowest
+
+        self.trace_parse()
+        self.trace_print()
+
+#------------------------------------------------------------------------------
+
+    def trace_parse(self):
+        """Reads the header and the records
+        """
+        with open(self.file_name, "rb") as file:
+            content = file.read()
+
+        header_size = struct.calcsize(self.header_fmt)
+        magic, version, record_size, self.cycles_hz, num, _ = struct.unpack_from(self.header_fmt, content)
+
+        if magic != self.magic:
+            raise SystemExit(f"{self.file_name}: not a fsm trace file")
+        if record_size != struct.calcsize(self.record_fmt):
+            raise SystemExit(f"{self.file_name}: unknown record size {record_size} (version {version})")
+
+        # A file cut short keeps the complete records
+        num = min(num, (len(content) - header_size) // record_size)
+
+        self.records = []
+        for idx in range(num):
+            values = struct.unpack_from(self.record_fmt, content, header_size + idx * record_size)
+            self.records.append(dict(zip(self.record_fields, values)))
+
+        self.records.sort(key=lambda rec: rec["seq"])
+
+    def time_get(self, cycles):
+        # us when the frequency is known
+        if self.cycles_hz:
+            return f"{cycles * 1e6 / self.cycles_hz:.3f}"
+        return str(cycles)
+
+    def trace_print(self):
+        records = self.records
+        unit = "us" if self.cycles_hz else "cycles"
+
+        if self.slowest > 0:
+            records = sorted(records, key=lambda rec: rec["exit"] + rec["transition"] + rec["entry"], reverse=True)
+            records = records[:self.slowest]
+
+        start = self.records[0]["timestamp"] if self.records else 0
+        columns = ["time", "fsm", "event", "source", "target", "exit", "transition", "entry", "total"]
+
+        if self.csv:
+            print(",".join(columns) + f",unit={unit}")
+        else:
+            print(("{:>14} " * len(columns)).format(*columns) + f" ({unit})")
+
+        for rec in records:
+            total = rec["exit"] + rec["transition"] + rec["entry"]
+            row = [self.time_get(rec["timestamp"] - start), rec["fsm_id"], rec["event"],
+                   rec["source"], rec["target"], self.time_get(rec["exit"]),
+                   self.time_get(rec["transition"]), self.time_get(rec["entry"]), self.time_get(total)]
+
+            if self.csv:
+                print(",".join(str(item) for item in row))
+            else:
+                print(("{:>14} " * len(row)).format(*row))
+
+#------------------------------------------------------------------------------
+
+if __name__ == "__main__":
+
+    ft = fsm_trace()
+
+    raise SystemExit